@@ -0,0 +1,30 @@
+
+
+#Runs every program in data/JIT_tests with the switch engine and with the JIT compiling each block the first time
+#it is jumped to (-t 1), and fails if the output differs - interrupts included, so bailouts are checked too
+gcc -pthread ./src/compiler_structs.c ./src/intepret_IR.c ./src/intepret_IR_JIT.c ./src/intepret_IR_batch.c ./src/intepret_IR_debug.c ./src/intepret_IR_heap.c ./src/intepret_IR_io.c ./src/intepret_IR_trace.c ./src/intepret_IR_vector.c ./src/main.c ./src/stack.c ./src/storage_controller.c -o ./output/VM_OUT || exit 1
+
+failed=0
+for program in ./data/JIT_tests/*.ir; do
+    case "$(basename "$program")" in
+        memory.ir) options="-m 4096" ;;       #Runs off the end of RAM
+        call_depth.ir) options="-C 100" ;;    #Recurses until the return stack is full
+        *) options="" ;;
+    esac
+
+    expected=$(timeout 60 ./output/VM_OUT "$program" -e switch $options < /dev/null 2>&1)
+    actual=$(timeout 60 ./output/VM_OUT "$program" -e jit -t 1 $options < /dev/null 2>&1)
+    if echo "$expected" | grep -q "^\[VM\] "; then #Not loaded - nothing was compared
+        echo "[FAIL] $program"
+        echo "$expected" | grep "^\[VM\] "
+        failed=1
+    elif [ "$expected" == "$actual" ]; then
+        echo "[PASS] $program"
+    else
+        echo "[FAIL] $program"
+        diff <(echo "$expected") <(echo "$actual") | head -n 10
+        failed=1
+    fi
+done
+
+exit $failed
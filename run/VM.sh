@@ -1,7 +1,7 @@
 
 
 clear
-gcc ./src/compiler_structs.c ./src/intepret_IR.c ./src/main.c ./src/stack.c ./src/storage_controller.c -o ./output/VM_OUT
+gcc -pthread ./src/compiler_structs.c ./src/intepret_IR.c ./src/intepret_IR_JIT.c ./src/intepret_IR_batch.c ./src/intepret_IR_debug.c ./src/intepret_IR_heap.c ./src/intepret_IR_io.c ./src/intepret_IR_trace.c ./src/intepret_IR_vector.c ./src/main.c ./src/stack.c ./src/storage_controller.c -o ./output/VM_OUT
 ./output/VM_OUT
 
 
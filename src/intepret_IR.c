@@ -1,118 +1,273 @@
-#include "intepret_IR.h"
+#define _GNU_SOURCE //memfd_create
+#include "intepret_IR_structs.h"
+#include "intepret_IR_JIT.h"
+#include "intepret_IR_trace.h"
+#include "intepret_IR_heap.h"
+#include "intepret_IR_vector.h"
+#include "intepret_IR_io.h"
+#include <float.h>
 
 
 
-#define INT_TYPE int
-#define FLOAT_TYPE float
+#define LABEL_SIZE 16 //Initial label table size (doubles when full)
+#define PARALLEL_LOAD_SIZE (1 << 20) //Minimum bytes of IR decoded by each loader thread
+#define MAX_LOAD_THREADS 16
+#define PACING_QUANTA_PER_SECOND 1000 //The paced engine checks the clock about once per millisecond of VM time
+#define PROFILE_INTERVAL_US 1000 //CPU time between profiler samples
+#define PROFILE_MAX_DEPTH 128 //Innermost calls kept in each profiler sample
+#define BYTECODE_MAGIC "JBC"
+#define BYTECODE_VERSION 6
+#define BYTECODE_BYTE_ORDER 0x01020304
+#define BYTECODE_ALIGNMENT 64 //Instruction array starts on a cache line
+#define EMPTY_LABEL SIZE_MAX //Marks an unused label table slot - label numbers are at most 19 digits so never match
+#define DEFAULT_CORES 8 //Cores available to PARALLEL_START unless set_VM_cores is used
+#define DEFAULT_CALL_DEPTH 65536 //Nested JAL calls allowed unless set_VM_call_depth is used
+#define GUARD_SIZE (((size_t)1 << 32) + 4096) //PROT_NONE bytes after guarded RAM - past any 32 bit address plus 4 bytes
+#define MAX_FIELDS 5   //Opcode + 3 operands, one extra to detect too many operands
 
 
-#define OPCODE_SIZE 7
-#define LINE_SIZE 20 //TEMPORARY - read in line buffer
-#define INSTR_SIZE 10 //Instruction memory expansion size
 
-typedef union DataTypes {
+typedef enum OPERAND_FORMAT {
+    FORMAT_NONE,      ///< OPCODE|||
+    FORMAT_REG,       ///< OPCODE|||R|||
+    FORMAT_LABEL,     ///< OPCODE|||LABEL|||
+    FORMAT_ID,        ///< OPCODE|||[ID]||| - core or sync ID
+    FORMAT_REG_REG,   ///< OPCODE|||R|||R|||
+    FORMAT_REG_REG_REG,   ///< OPCODE|||Rdest|||Rsource|||Rsource|||
+    FORMAT_REG_REG_INT,   ///< OPCODE|||Rdest|||Rsource|||[IMMEDIATE]|||
+    FORMAT_REG_REG_FLOAT, ///< OPCODE|||Rdest|||Rsource|||[IMMEDIATE]|||
+    FORMAT_REG_REG_ITEMS, ///< OPCODE|||Rptr|||Rdest|||[Xitems]|||
+    FORMAT_REG_REG_LABEL, ///< OPCODE|||R1|||R2|||[LABEL]|||
+} OPERAND_FORMAT;
 
-    INT_TYPE intVal;
-    FLOAT_TYPE floatVal;
 
-} DataTypes;
-typedef struct VirtualMachine {
-    size_t instructionsPerSecond;  ///< The number of instructions the VM can execute per second.
-    DataTypes *registerArray;      ///< Pointer to the array of registers.
-    size_t numRegisters;           ///< Number of registers in the register array.
+typedef struct OpcodeDefinition {
+    const char *name;             ///< Opcode as it appears in the IR file
+    VALID_INSTRUCTIONS opcode;    ///< Decoded opcode
+    OPERAND_FORMAT format;        ///< Expected operands
+} OpcodeDefinition;
 
-    DataTypes *ramArray;                ///< Pointer to the array representing the VM's RAM.
-    size_t RAMsize;                ///< Size of the RAM array (NUMBER OF BYTES).
-    
-    size_t programCounter;         ///< Index of the current instruction in the instruction set (COUNT BITS NOT BYTES).
 
-} VirtualMachine;
+//Only used during the preprocessor pass - nothing here is touched once execution starts
+static const OpcodeDefinition opcodeDefinitions[] = {
+    {"ADD", ADD, FORMAT_REG_REG_REG},
+    {"SUB", SUB, FORMAT_REG_REG_REG},
+    {"MUL", MUL, FORMAT_REG_REG_REG},
+    {"DIV", DIV, FORMAT_REG_REG_REG},
+    {"MOD", MOD, FORMAT_REG_REG_REG},
+    {"ADD_F", ADD_F, FORMAT_REG_REG_REG},
+    {"SUB_F", SUB_F, FORMAT_REG_REG_REG},
+    {"MUL_F", MUL_F, FORMAT_REG_REG_REG},
+    {"DIV_F", DIV_F, FORMAT_REG_REG_REG},
 
+    {"ADI", ADI, FORMAT_REG_REG_INT},
+    {"SUI", SUI, FORMAT_REG_REG_INT},
+    {"MUI", MUI, FORMAT_REG_REG_INT},
+    {"DII", DII, FORMAT_REG_REG_INT},
+    {"ADI_F", ADI_F, FORMAT_REG_REG_FLOAT},
+    {"SUI_F", SUI_F, FORMAT_REG_REG_FLOAT},
+    {"MUI_F", MUI_F, FORMAT_REG_REG_FLOAT},
+    {"DII_F", DII_F, FORMAT_REG_REG_FLOAT},
 
-typedef struct Instruction {
+    {"STR", STR, FORMAT_REG_REG_ITEMS},
+    {"REA", LOD, FORMAT_REG_REG_ITEMS},
+    {"LOD", LOD, FORMAT_REG_REG_ITEMS},
 
-    char opcode[OPCODE_SIZE];
-    size_t ARG1; //Register
-    size_t ARG2; //Register
+    {"GRT", GRT, FORMAT_REG_REG_LABEL},
+    {"GRE", GRE, FORMAT_REG_REG_LABEL},
+    {"LES", LES, FORMAT_REG_REG_LABEL},
+    {"LEQ", LTE, FORMAT_REG_REG_LABEL},
+    {"EQU", EQU, FORMAT_REG_REG_LABEL},
+    {"NEQ", NEQ, FORMAT_REG_REG_LABEL},
 
-    union ARG3{
-        size_t reg; //Register, Label or Immediate
-        size_t label;
-        double immediate;
-    } ARG3;
+    {"GOTO", JMP, FORMAT_LABEL},
+    {"JAL", JAL, FORMAT_LABEL},
+    {"JRT", JRT, FORMAT_NONE},
+    {"NOP", NOP, FORMAT_NONE},
 
+    {"INPUT_I", INPUT_I, FORMAT_REG},
+    {"INPUT_F", INPUT_F, FORMAT_REG},
+    {"INPUT_C", INPUT_C, FORMAT_REG},
+    {"OUTPUT_I", OUTPUT_I, FORMAT_REG},
+    {"OUTPUT_F", OUTPUT_F, FORMAT_REG},
+    {"OUTPUT_C", OUTPUT_C, FORMAT_REG},
 
-} Instruction;
+    {"PARALLEL_START", PARALLEL_START, FORMAT_ID},
+    {"PARALLEL_STOP", PARALLEL_STOP, FORMAT_NONE},
+    {"SYNC", SYNC, FORMAT_ID},
 
+    {"ALLOCATE", ALLOCATE, FORMAT_REG_REG},
+    {"FREE", FREE, FORMAT_REG},
 
+    {"VADD", VADD, FORMAT_REG_REG_REG},
+    {"VSUB", VSUB, FORMAT_REG_REG_REG},
+    {"VMUL", VMUL, FORMAT_REG_REG_REG},
+    {"VADD_F", VADD_F, FORMAT_REG_REG_REG},
+    {"VSUB_F", VSUB_F, FORMAT_REG_REG_REG},
+    {"VMUL_F", VMUL_F, FORMAT_REG_REG_REG},
+};
 
 
 
-typedef enum VALID_INSTRUCTIONS {
-    INVALID,  ///< Interpreter use only - not part of instruction set
-    ADD,      ///< Add instruction
-    SUB,      ///< Subtract instruction
-    MUL,      ///< Multiply instruction
-    DIV,      ///< Divide instruction
-    MOD,      ///< Mod instruction
-    STR,      ///< Store instruction
-    LOD,      ///< Load instruction
-    GRT,      ///< Greater than instruction
-    GRE,      ///< Greater than or equal instruction
-    LTE,      ///< Less than or equal instruction
-    LES,      ///< Less than instruction
-    EQU,      ///< Equal instruction
-    NEQ,      ///< Not equal instruction
-    JMP,      ///< Jump instruction
-    JAL,      ///< Jump and link instruction
-    JRT,      ///< Jump return instruction
-    NOP       ///< No operation instruction
-} VALID_INSTRUCTIONS;
+typedef struct IRField {
+    const char *start; ///< First character of the field (points into the IR file - NOT NULL terminated)
+    size_t length;     ///< Number of characters in the field
+} IRField;
 
 
 
-// Only ONE VM exists - allow for better encapsulation
-VirtualMachine VM;
+typedef struct LabelTable {
+    Label *slots;     ///< Open addressing slots - labelID is EMPTY_LABEL for unused slots.
+    size_t capacity;  ///< Number of slots (power of two).
+    size_t count;     ///< Number of labels stored.
+} LabelTable;
 
 
+typedef struct LoadChunk {
+    VirtualMachine *vm;         ///< VM the program is being loaded onto (read only while decoding).
+    const char *start;          ///< First character of the slice (start of a line).
+    const char *end;            ///< One past the last character of the slice.
+
+    Instruction *instructions;  ///< Decoded instructions - label operands are still label numbers.
+    size_t numInstructions;
+    Label *labels;              ///< Label definitions - addresses relative to the start of the chunk.
+    size_t numLabels;
+    size_t labelsSize;
+    size_t numLines;            ///< Lines scanned so far - used for error line numbers.
+
+    bool success;               ///< false if decoding stopped on an error.
+    const char *error;          ///< Description of the error.
+    IRField errorLine;          ///< Last line scanned - the line with the error if success is false.
+} LoadChunk;
+
+
+/*
+ * Bytecode file (.jbc) layout - all sections are in host byte order:
+ *
+ * | BytecodeHeader | padding | Instruction[numInstructions + 1] | BytecodeLabel[numLabels] | DataTypes[numConstants] |
+ *
+ * Instructions are stored exactly as they are in instruction memory (already resolved and fused, including the
+ * closing HALT, handler addresses zeroed) so the file is mapped and executed without decoding.
+ */
+typedef struct BytecodeHeader {
+    char magic[4];              ///< BYTECODE_MAGIC
+    uint32_t version;           ///< BYTECODE_VERSION
+    uint32_t byteOrder;         ///< BYTECODE_BYTE_ORDER as written by the host that produced the file
+    uint32_t instructionSize;   ///< sizeof(Instruction) of the host that produced the file
+    uint64_t numRegisters;      ///< Registers the program was decoded for
+    uint64_t numInstructions;   ///< Excluding the HALT
+    uint64_t instructionOffset; ///< File offset of the instruction array
+    uint64_t numLabels;
+    uint64_t labelOffset;       ///< File offset of the label table
+    uint64_t numConstants;      ///< Constant pool - reserved for immediates wider than ARG3, currently always empty
+    uint64_t constantOffset;    ///< File offset of the constant pool
+} BytecodeHeader;
+
+
+typedef struct BytecodeLabel {
+    uint64_t labelID;
+    uint64_t address;
+} BytecodeLabel;
+
+
+
+/**
+ * @brief Padding placed before RAM so it ends exactly on a page boundary.
+ *
+ * Guarded RAM ends where its guard pages start, and snapshot files hold RAM at this offset so they can be mapped
+ * straight over guarded RAM.
+ *
+ * @param RAMsize Size of RAM in bytes.
+ * @return Bytes of padding.
+ */
+static size_t RAM_padding(size_t RAMsize) {
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (page - RAMsize % page) % page;
+}
+
+
+/**
+ * @brief Free a VM's RAM, whether it is on the heap or mapped.
+ *
+ * @param vm The VM.
+ */
+static void release_RAM(VirtualMachine *vm) {
+
+    if(vm->ramMapping != NULL) {
+        munmap(vm->ramMapping, vm->ramMappingSize);
+    } else {
+        free(vm->ramArray);
+    }
+    vm->ramArray = NULL;
+    vm->ramMapping = NULL;
+    vm->ramMappingSize = 0;
+
+    return;
+}
+
 
 /**
- * @brief Initialize the virtual machine with the specified RAM size, number of registers, and instructions per second.
+ * @brief Create a virtual machine with the specified RAM size, number of registers, and instructions per second.
  *
  * This function allocates memory for the register array and RAM array, and sets the program counter to 0.
+ * VMs share no state, each can be loaded and run on its own thread.
  *
  * @param RAMsize Size of the RAM array to allocate.
  * @param numRegisters Number of registers to allocate in the register array.
- * @param instructionsPerSecond Number of instructions the VM can execute per second.
- * @return true if initialization is successful, false otherwise.
+ * @param instructionsPerSecond Number of instructions the VM can execute per second, or VM_UNTHROTTLED.
+ * @return The new VM, or NULL if the arguments are invalid or allocation failed.
  */
-bool initialise_virtual_machine(size_t RAMsize, size_t numRegisters, size_t instructionsPerSecond) {
-
-    VM.numRegisters = numRegisters;
-    VM.RAMsize = RAMsize;
-    VM.programCounter = 0;
+VirtualMachine *vm_create(size_t RAMsize, size_t numRegisters, size_t instructionsPerSecond) {
 
+    if(numRegisters == 0 || numRegisters > UINT16_MAX) {
+        return NULL;
+    }
 
-    if(instructionsPerSecond == 0) {
-        return false;
+    VirtualMachine *vm = (VirtualMachine*)calloc(1, sizeof(VirtualMachine)); //Every pointer starts NULL
+    if(vm == NULL) {
+        return NULL;
     }
-    VM.instructionsPerSecond = instructionsPerSecond; //Clockspeed basically
 
-    VM.registerArray = (DataTypes*)malloc(numRegisters * sizeof(DataTypes)); //Store space for a full word
-    VM.ramArray = (DataTypes*)malloc(RAMsize * sizeof(DataTypes)); //Store space for a full word - yes this wastes space
+    vm->numRegisters = numRegisters;
+    vm->RAMsize = RAMsize;
+    vm->heapStart = 0;
+    vm->programCounter = 0;
+    vm->interrupt = INTERRUPT_NONE;
+    vm->engine = VM_ENGINE_THREADED;
+    vm->loadThreads = 0;
+    vm->jitThreshold = JIT_DEFAULT_THRESHOLD;
+    vm->collectStatistics = false;
+    vm->numCores = DEFAULT_CORES;
+    vm->coreID = 0;
+    vm->collectProfile = false;
+    vm->triggeredWatch = SIZE_MAX;
+    vm->input = stdin;
+    vm->output = stdout;
+    vm->outputUsed = 0;
+    vm->lineBuffered = false;
+    vm->flushLines = (isatty(STDOUT_FILENO) == 1); //Like stdio - a terminal sees every line as it is printed
+    vm->returnStackDepth = 0;
+    vm->returnStackLimit = DEFAULT_CALL_DEPTH;
 
-    if(VM.registerArray == NULL || VM.ramArray == NULL) {
-        if(VM.ramArray == NULL) {
-            free(VM.registerArray);
-        } else if(VM.registerArray == NULL){
-            free(VM.ramArray);
-        } else {
-            //Should never happen but left here for readability
-        }
+    vm->instructionsPerSecond = instructionsPerSecond; //Clockspeed basically - VM_UNTHROTTLED runs as fast as possible
+
+    vm->registerArray = (DataTypes*)calloc(numRegisters, sizeof(DataTypes)); //Store space for a full word
+    vm->returnStack = (uint32_t*)malloc(vm->returnStackLimit * sizeof(uint32_t)); //Pages are only committed as calls nest
+    vm->ramArray = (uint8_t*)calloc(RAMsize == 0 ? 1 : RAMsize, sizeof(uint8_t)); //Byte addressed - STR/LOD move Xitems bytes
+    vm->outputBuffer = (char*)malloc(VM_OUTPUT_BUFFER_SIZE);
+    vm->inputBuffer = (VMInputBuffer*)calloc(1, sizeof(VMInputBuffer) + VM_INPUT_BUFFER_SIZE);
+    vm->ramMapping = NULL;
+    vm->guardPages = false;
+
+    if(vm->registerArray == NULL || vm->ramArray == NULL || vm->returnStack == NULL || vm->outputBuffer == NULL
+    || vm->inputBuffer == NULL) {
+        vm_destroy(vm);
+        return NULL;
     }
 
 
-    return true;
+    return vm;
 }
 
 
@@ -122,146 +277,4025 @@ bool initialise_virtual_machine(size_t RAMsize, size_t numRegisters, size_t inst
  *
  * This function prints the current properties of the virtual machine, including instructions per second,
  * number of registers, and RAM size.
+ *
+ * @param vm The VM to print.
  */
-void print_VM_properties(void) {
+void print_VM_properties(VirtualMachine *vm) {
     //Print the VM info
 
     printf("=======Virtual machine properties=======\n");
-    printf("Instructions per second:    %zu\n", VM.instructionsPerSecond);
-    printf("Number of registers:        %zu\n", VM.numRegisters);
-    printf("Ram size:                   %zu\n",VM.RAMsize);
+    if(vm->instructionsPerSecond == VM_UNTHROTTLED) {
+        printf("Instructions per second:    Unthrottled\n");
+    } else {
+        printf("Instructions per second:    %zu\n", vm->instructionsPerSecond);
+    }
+    printf("Number of registers:        %zu\n", vm->numRegisters);
+    printf("Ram size:                   %zu\n",vm->RAMsize);
+    if(vm->guardPages == true) {
+        printf("Ram guard pages:            Enabled\n");
+    }
+    if(vm->lineBuffered == true) {
+        printf("Output:                     Line buffered\n");
+    }
+    printf("Vector instructions:        %s\n", vector_instruction_set());
     printf("========================================\n");
 
     return;
 }
 
 
+
 /**
- * @brief Run the virtual machine with the given intermediate representation (IR) file.
+ * @brief Parse an unsigned decimal number directly from the bytes of a field.
  *
- * This function reads the IR output file line by line and interprets each line on the VM.
- * It performs a pass on the file first to put it into a token array, where each index in the token array
- * acts as an index into the instruction memory. This approach allows labels to be defined in a map
- * (Label name -> jump address). The debug flag can be used to print what the VM is doing.
- * If an error occurs, such as an out-of-bounds access in the VM memory, the corresponding interrupt flag
- * is set and the function returns false. If debug mode is enabled, error messages are printed.
- *
- * @param fileName The name of the IR file to execute.
- * @param debug If true, prints debugging information.
- * @return true if the file was successfully opened and processed, false otherwise.
+ * @param field The field to parse.
+ * @param result Where the parsed number is placed.
+ * @return true if the whole field is a valid number, false otherwise.
  */
-bool run_VM(char *fileName, bool debug) {
+static bool parse_unsigned(IRField field, size_t *result) {
 
+    if(field.length == 0 || field.length > 19) { //19 digits always fits
+        return false;
+    }
+
+    size_t value = 0;
+    for(size_t i = 0; i < field.length; i++) {
+        unsigned digit = (unsigned)(field.start[i] - '0');
+        if(digit > 9) {
+            return false;
+        }
+        value = value * 10 + digit;
+    }
 
-    //Basically reads the IR output file line by line and inteprets (line by line) on the VM
-    //Does a PASS on the file FIRST - put it into a token array
-    //Each index in the token array is like an index into the instruction memory
-    //This approach also allows lables to be defined in a map (Label name -> jump Address)
+    *result = value;
+    return true;
+}
 
-    //Returns false if file cant be opened
-    //If something goes wrong in the VM itself (e.g OOB access in the VM memory) set the corrosponding interupt flag
-    //Continue execution then return false - if debug mode on then also print that a error happened
-    
-    //In instruction IR file all have the form OPERATION|||argument1|||argument2|||argument3|||
-    //Irregardless of r i or j instruction
-    //Use strtok to break it up
 
+/**
+ * @brief Parse a signed decimal integer directly from the bytes of a field.
+ *
+ * @param field The field to parse.
+ * @param result Where the parsed number is placed.
+ * @return true if the whole field is a valid integer that fits INT_TYPE, false otherwise.
+ */
+static bool parse_int(IRField field, INT_TYPE *result) {
 
+    bool negative = false;
+    if(field.length > 0 && (field.start[0] == '-' || field.start[0] == '+')) {
+        negative = (field.start[0] == '-');
+        field.start++;
+        field.length--;
+    }
 
-    //Debug is used to print what the VM is doing
-    //input filename for source file
-    if(fileName == NULL) {
+    size_t magnitude = 0;
+    if(parse_unsigned(field, &magnitude) == false || magnitude > (size_t)INT32_MAX + 1) {
+        return false;
+    }
+    if(negative == false && magnitude > INT32_MAX) {
         return false;
     }
-    FILE *fptr = fopen(fileName, "r");
-    if(fptr == NULL) {
 
-        if(debug == true) {
-            printf("[VM - DEBUG] FAILED to open: %s\n",fileName);
+    *result = (INT_TYPE)(negative ? -(long long)magnitude : (long long)magnitude);
+    return true;
+}
+
+
+/**
+ * @brief Parse a decimal floating point number ([-]digits[.digits][e[-]digits]) directly from the bytes of a field.
+ *
+ * The syntax is checked while the digits are accumulated. Short mantissas (up to 2^24) with small exponents are
+ * converted with a single float multiply or divide by an exact power of ten, which rounds once and so gives the
+ * correctly rounded result. Everything else is copied out of the field and converted by strtof.
+ *
+ * @param field The field to parse.
+ * @param result Where the parsed number is placed.
+ * @return true if the whole field is a valid number, false otherwise.
+ */
+static bool parse_float(IRField field, FLOAT_TYPE *result) {
+
+    static const float powersOfTen[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+    const char *current = field.start;
+    const char *end = field.start + field.length;
+
+    bool negative = false;
+    if(current < end && (*current == '-' || *current == '+')) {
+        negative = (*current == '-');
+        current++;
+    }
+
+    //Only used by the fast path - simple is cleared once the mantissa no longer fits
+    uint32_t mantissa = 0;
+    int exponent = 0;
+    bool simple = true;
+    size_t digits = 0;
+
+    for(; current < end && isdigit((unsigned char)*current); current++, digits++) {
+        if(mantissa <= (1u << 24)) {
+            mantissa = mantissa * 10 + (uint32_t)(*current - '0');
+        } else {
+            simple = false;
         }
+    }
+    if(current < end && *current == '.') {
+        current++;
+        for(; current < end && isdigit((unsigned char)*current); current++, digits++) {
+            if(mantissa <= (1u << 24)) {
+                mantissa = mantissa * 10 + (uint32_t)(*current - '0');
+                exponent--;
+            } else {
+                simple = false;
+            }
+        }
+    }
+    if(digits == 0) {
+        return false;
+    }
 
+    if(current < end && (*current == 'e' || *current == 'E')) {
+        current++;
+        bool negativeExponent = false;
+        if(current < end && (*current == '-' || *current == '+')) {
+            negativeExponent = (*current == '-');
+            current++;
+        }
+        int written = 0;
+        size_t exponentDigits = 0;
+        for(; current < end && isdigit((unsigned char)*current); current++, exponentDigits++) {
+            if(written < 10000) {
+                written = written * 10 + (*current - '0');
+            }
+        }
+        if(exponentDigits == 0) {
+            return false;
+        }
+        exponent += (negativeExponent ? -written : written);
+    }
+    if(current != end) {
         return false;
     }
 
-    if(debug == true) {
-        printf("[VM - DEBUG] Opened: %s\n",fileName);
+
+#if FLT_EVAL_METHOD == 0 //Float operations are rounded to float, not to a wider type
+    if(simple == true && mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10) {
+        float value = (exponent < 0 ? (float)mantissa / powersOfTen[-exponent] : (float)mantissa * powersOfTen[exponent]);
+        *result = (FLOAT_TYPE)(negative ? -value : value);
+        return true;
+    }
+#endif
+
+    char local[64];
+    char *text = (field.length < sizeof(local) ? local : (char*)malloc(field.length + 1));
+    if(text == NULL) {
+        return false;
     }
-    
+    memcpy(text, field.start, field.length);
+    text[field.length] = '\0';
+    *result = (FLOAT_TYPE)strtof(text, NULL);
+    if(text != local) {
+        free(text);
+    }
+
+    return true;
+}
 
 
+/**
+ * @brief Check a field holds exactly the given text.
+ *
+ * @param field The field to check.
+ * @param text NULL terminated text to compare against.
+ * @return true if they are equal, false otherwise.
+ */
+static bool field_equals(IRField field, const char *text) {
+
+    size_t length = strlen(text);
+    return (field.length == length && memcmp(field.start, text, length) == 0);
+}
 
 
-    //Each line goes into the instruction memory array (which is a dynamic array)
-    //Read file line by line
-    //Extract tokens with strtok by |||
-    //Place into dynamic array of tokens
-    //Move onto intepreting
+/**
+ * @brief Split the next line of an IR file into fields, in place.
+ *
+ * Fields are separated by runs of '|' (the IR uses '|||'). Nothing is copied - each field points into the
+ * file contents. Lines can be any length.
+ *
+ * @param cursor Position to start scanning from, moved to the start of the following line.
+ * @param end End of the file contents.
+ * @param fields Where the fields of the line are placed.
+ * @param line Where the whole line (without its newline) is placed - used for error messages.
+ * @return Number of fields on the line - may exceed MAX_FIELDS, in which case only MAX_FIELDS are stored.
+ */
+static size_t scan_line(const char **cursor, const char *end, IRField fields[MAX_FIELDS], IRField *line) {
 
+    const char *current = *cursor;
+    const char *lineEnd = memchr(current, '\n', (size_t)(end - current));
+    if(lineEnd == NULL) {
+        lineEnd = end;
+    }
 
-    //Read line by line
-    char lineBuffer[LINE_SIZE];
+    line->start = current;
+    line->length = (size_t)(lineEnd - current);
+    *cursor = (lineEnd == end ? end : lineEnd + 1);
 
 
-    Instruction *instructionMemoryArray = (Instruction*)malloc(sizeof(Instruction) * INSTR_SIZE);
-    size_t instructionMemorySize = INSTR_SIZE;
-    if(instructionMemoryArray == NULL) {
-        if(debug == true) {
-            printf("[VM - DEBUG] FAILED to allocate memory for instructions\n");
+    size_t numFields = 0;
+    while(current < lineEnd) {
+
+        while(current < lineEnd && (*current == '|' || *current == '\r')) {
+            current++;
+        }
+        if(current == lineEnd) {
+            break;
+        }
+
+        const char *fieldStart = current;
+        while(current < lineEnd && *current != '|' && *current != '\r') {
+            current++;
         }
+
+        if(numFields < MAX_FIELDS) {
+            fields[numFields].start = fieldStart;
+            fields[numFields].length = (size_t)(current - fieldStart);
+        }
+        numFields++;
+    }
+
+    return numFields;
+}
+
+
+/**
+ * @brief Parse a register number from a field and check it exists on the VM.
+ *
+ * @param vm The VM the register belongs to.
+ * @param field The field to parse.
+ * @param result Where the register index is placed.
+ * @return true if the field is a valid register, false otherwise.
+ */
+static bool parse_register(VirtualMachine *vm, IRField field, uint16_t *result) {
+
+    size_t reg = 0;
+    if(parse_unsigned(field, &reg) == false || reg >= vm->numRegisters) {
+        return false;
+    }
+
+    *result = (uint16_t)reg;
+    return true;
+}
+
+
+/**
+ * @brief Hash a label number into a slot index.
+ *
+ * Labels are often consecutive numbers, so the bits are mixed before masking (splitmix64 finaliser).
+ *
+ * @param labelID Label number to hash.
+ * @param mask Table capacity - 1 (capacity is a power of two).
+ * @return Slot to start probing from.
+ */
+static size_t hash_label(size_t labelID, size_t mask) {
+
+    uint64_t hash = (uint64_t)labelID;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    hash = hash ^ (hash >> 31);
+
+    return (size_t)hash & mask;
+}
+
+
+/**
+ * @brief Create an empty open addressing label table with room for a number of labels.
+ *
+ * The capacity is at least twice the number of labels so probe sequences stay short.
+ *
+ * @param table The table to initialise.
+ * @param numLabels Number of labels that will be inserted.
+ * @return true if the table was allocated, false otherwise.
+ */
+static bool label_table_create(LabelTable *table, size_t numLabels) {
+
+    size_t capacity = 16;
+    while(capacity < numLabels * 2) {
+        capacity *= 2;
+    }
+
+    table->slots = (Label*)malloc(sizeof(Label) * capacity);
+    if(table->slots == NULL) {
         return false;
     }
+    for(size_t i = 0; i < capacity; i++) {
+        table->slots[i].labelID = EMPTY_LABEL;
+    }
+    table->capacity = capacity;
+    table->count = 0;
 
+    return true;
+}
 
-    Instruction currentInstruction = {-1,-1,-1,-1};
-    char *currentToken = NULL;
-    for(int i = 0; fgets(lineBuffer, sizeof(lineBuffer), fptr) != NULL; i++) {
 
-        if(i % (INSTR_SIZE - 1) == 0) { //Need to expand instruction memory
+/**
+ * @brief Find the label table entry for a label number.
+ *
+ * @param table The label table.
+ * @param labelID Label number to search for.
+ * @return Pointer to the entry, or NULL if the label was never defined.
+ */
+static Label *label_table_find(LabelTable *table, size_t labelID) {
 
-            instructionMemorySize += INSTR_SIZE;
-            instructionMemoryArray = (Instruction*)realloc(instructionMemoryArray, instructionMemorySize);
+    size_t mask = table->capacity - 1;
+    for(size_t slot = hash_label(labelID, mask); table->slots[slot].labelID != EMPTY_LABEL; slot = (slot + 1) & mask) {
+        if(table->slots[slot].labelID == labelID) {
+            return &(table->slots[slot]);
         }
+    }
+
+    return NULL;
+}
+
 
+/**
+ * @brief Insert a label definition into the label table.
+ *
+ * The table never grows - label_table_create is given the number of labels up front.
+ *
+ * @param table The label table.
+ * @param labelID Label number.
+ * @param address Index of the instruction the label refers to.
+ * @return true if inserted, false if the label is already defined or the table is full.
+ */
+static bool label_table_insert(LabelTable *table, size_t labelID, size_t address) {
 
-        //Get opcode
-        currentToken = strtok(lineBuffer, "|||");
-        if(currentToken == NULL) {
-            printf("[VM] EXPECTED more operands on line %s\n",lineBuffer);
+    if(table->count * 2 >= table->capacity) {
+        return false;
+    }
+
+    size_t mask = table->capacity - 1;
+    size_t slot = hash_label(labelID, mask);
+    for(; table->slots[slot].labelID != EMPTY_LABEL; slot = (slot + 1) & mask) {
+        if(table->slots[slot].labelID == labelID) {
             return false;
         }
-        strncpy(currentInstruction.opcode, currentToken, OPCODE_SIZE);
+    }
+
+    table->slots[slot].labelID = labelID;
+    table->slots[slot].address = address;
+    table->count++;
+    return true;
+}
+
+
+
+/**
+ * @brief Decode the operands of a single IR line into an instruction.
+ *
+ * Label operands are left as label numbers and resolved after the whole file has been read.
+ *
+ * @param vm The VM the program is being loaded onto.
+ * @param definition The decoded opcode.
+ * @param operands Fields following the opcode.
+ * @param numOperands Number of fields following the opcode.
+ * @param instruction Where the decoded instruction is placed.
+ * @return true if the operands match the expected format, false otherwise.
+ */
+static bool decode_operands(VirtualMachine *vm, const OpcodeDefinition *definition, const IRField *operands, size_t numOperands, Instruction *instruction) {
+
+    size_t expected = 0;
+
+    switch(definition->format) {
+        case FORMAT_NONE:
+            expected = 0;
+            break;
+        case FORMAT_REG:
+        case FORMAT_LABEL:
+        case FORMAT_ID:
+            expected = 1;
+            break;
+        case FORMAT_REG_REG:
+            expected = 2;
+            break;
+        default:
+            expected = 3;
+            break;
+    }
+
+    if(numOperands != expected) {
+        return false;
+    }
 
 
-        //Continue here
+    instruction->opcode = definition->opcode;
+    instruction->ARG1 = 0;
+    instruction->ARG2 = 0;
+    instruction->ARG3.reg = 0;
 
+    size_t value = 0;
+    uint16_t reg = 0;
+    switch(definition->format) {
+        case FORMAT_NONE:
+            return true;
 
+        case FORMAT_REG:
+            return parse_register(vm, operands[0], &(instruction->ARG1));
 
+        case FORMAT_LABEL:
+            if(parse_unsigned(operands[0], &value) == false || value > UINT32_MAX) {
+                return false;
+            }
+            instruction->ARG3.label = (uint32_t)value;
+            return true;
 
+        case FORMAT_ID:
+            if(parse_unsigned(operands[0], &value) == false || value > UINT16_MAX) {
+                return false;
+            }
+            instruction->ARG1 = (uint16_t)value;
+            return true;
 
-        instructionMemoryArray[i] = currentInstruction;
+        default:
+            break;
     }
 
 
+    if(parse_register(vm, operands[0], &(instruction->ARG1)) == false
+    || parse_register(vm, operands[1], &(instruction->ARG2)) == false) {
+        return false;
+    }
 
+    switch(definition->format) {
+        case FORMAT_REG_REG:
+            return true;
 
+        case FORMAT_REG_REG_REG:
+            if(parse_register(vm, operands[2], &reg) == false) {
+                return false;
+            }
+            instruction->ARG3.reg = reg;
+            return true;
 
-    return true;
+        case FORMAT_REG_REG_INT:
+            return parse_int(operands[2], &(instruction->ARG3.intImmediate));
+
+        case FORMAT_REG_REG_FLOAT:
+            return parse_float(operands[2], &(instruction->ARG3.floatImmediate));
+
+        case FORMAT_REG_REG_ITEMS:
+            if(parse_unsigned(operands[2], &value) == false || value == 0 || value > sizeof(DataTypes)) {
+                return false;
+            }
+            instruction->ARG3.items = (uint32_t)value;
+            if(value != 3) { //Common widths get their own handler, 3 bytes stays on the generic one
+                static const uint16_t storeOpcodes[] = {INVALID, STR_1, STR_2, INVALID, STR_4};
+                static const uint16_t loadOpcodes[] = {INVALID, LOD_1, LOD_2, INVALID, LOD_4};
+                instruction->opcode = (instruction->opcode == STR ? storeOpcodes[value] : loadOpcodes[value]);
+            }
+            return true;
+
+        case FORMAT_REG_REG_LABEL:
+            if(parse_unsigned(operands[2], &value) == false || value > UINT32_MAX) {
+                return false;
+            }
+            instruction->ARG3.label = (uint32_t)value;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+
+
+/**
+ * @brief Point every PARALLEL_START at the instruction after its matching PARALLEL_STOP.
+ *
+ * Blocks may be nested - each PARALLEL_STOP closes the most recent unclosed PARALLEL_START.
+ *
+ * @param vm The VM holding the decoded program.
+ * @return true if every PARALLEL_START has a PARALLEL_STOP, false otherwise.
+ */
+static bool match_parallel_blocks(VirtualMachine *vm) {
+
+    Instruction *program = vm->instructionMemory;
+    bool success = true;
+
+    for(size_t i = 0; i < vm->numInstructions; i++) {
+        if(program[i].opcode != PARALLEL_START) {
+            continue;
+        }
+
+        size_t depth = 0;
+        size_t end = i + 1;
+        for(; end < vm->numInstructions; end++) {
+            if(program[end].opcode == PARALLEL_START) {
+                depth++;
+            } else if(program[end].opcode == PARALLEL_STOP) {
+                if(depth == 0) {
+                    break;
+                }
+                depth--;
+            }
+        }
+
+        if(end == vm->numInstructions) {
+            printf("[VM] PARALLEL_START in instruction %zu has no PARALLEL_STOP\n", i);
+            success = false;
+        } else {
+            program[i].ARG3.label = (uint32_t)(end + 1);
+        }
+    }
+
+    return success;
+}
+
+
+/**
+ * @brief Fuse common instruction pairs into superinstructions.
+ *
+ * The first instruction of a pair is replaced by a superinstruction that performs both operations and skips
+ * the second. The second instruction is left untouched, so a jump that lands on it still executes it alone
+ * and fusion never needs to know where labels point.
+ *
+ * Fused pairs:
+ * - ADI followed by a compare-branch on the ADI destination (loop counter increment and test)
+ * - MUL/MUL_F followed by ADD/ADD_F reading the MUL destination (multiply accumulate)
+ *
+ * @param vm The VM holding the decoded program.
+ * @return Number of pairs fused.
+ */
+static size_t fuse_instructions(VirtualMachine *vm) {
+
+    Instruction *program = vm->instructionMemory;
+    size_t fused = 0;
+
+    for(size_t i = 0; i + 1 < vm->numInstructions; i++) {
+
+        Instruction *first = &(program[i]);
+        Instruction *second = &(program[i + 1]);
+        uint16_t superinstruction = INVALID;
+
+        if(first->opcode == ADI && (second->ARG1 == first->ARG1 || second->ARG2 == first->ARG1)) {
+            switch(second->opcode) {
+                case GRT: superinstruction = ADI_GRT; break;
+                case GRE: superinstruction = ADI_GRE; break;
+                case LTE: superinstruction = ADI_LTE; break;
+                case LES: superinstruction = ADI_LES; break;
+                case EQU: superinstruction = ADI_EQU; break;
+                case NEQ: superinstruction = ADI_NEQ; break;
+                default: break;
+            }
+
+        } else if(first->opcode == MUL && second->opcode == ADD
+        && (second->ARG2 == first->ARG1 || second->ARG3.reg == first->ARG1)) {
+            superinstruction = MUL_ADD;
+
+        } else if(first->opcode == MUL_F && second->opcode == ADD_F
+        && (second->ARG2 == first->ARG1 || second->ARG3.reg == first->ARG1)) {
+            superinstruction = MUL_ADD_F;
+        }
+
+        if(superinstruction != INVALID) {
+            first->opcode = superinstruction;
+            fused++;
+            i++; //Second instruction can not start another pair
+        }
+    }
+
+    return fused;
+}
+
+
+/**
+ * @brief Opcode of the first half of a superinstruction.
+ *
+ * Used to split a pair when execution has to stop on its second instruction (snapshot labels, breakpoints).
+ *
+ * @param opcode Any opcode.
+ * @return The opcode the superinstruction was fused from, or opcode itself if it is not a superinstruction.
+ */
+static uint16_t unfused_opcode(uint16_t opcode) {
+
+    switch(opcode) {
+        case ADI_GRT: case ADI_GRE: case ADI_LTE: case ADI_LES: case ADI_EQU: case ADI_NEQ:
+            return ADI;
+        case MUL_ADD:
+            return MUL;
+        case MUL_ADD_F:
+            return MUL_F;
+        default:
+            return opcode;
+    }
 }
 
 
 
+/**
+ * @brief qsort comparison - order labels by the address they refer to.
+ */
+static int compare_label_address(const void *a, const void *b) {
 
+    const Label *labelA = (const Label*)a;
+    const Label *labelB = (const Label*)b;
 
+    if(labelA->address != labelB->address) {
+        return (labelA->address < labelB->address ? -1 : 1);
+    }
+    return (labelA->labelID < labelB->labelID ? -1 : (labelA->labelID > labelB->labelID));
+}
 
 
+/**
+ * @brief Free the program currently loaded on a VM.
+ *
+ * Programs loaded from bytecode live in a private file mapping rather than on the heap.
+ *
+ * @param vm The VM to unload.
+ */
+static void release_program(VirtualMachine *vm) {
 
+    if(vm->programMapping != NULL) {
+        munmap(vm->programMapping, vm->programMappingSize);
+    } else {
+        free(vm->instructionMemory);
+    }
+    free(vm->labels);
+    JIT_destroy(vm); //Compiled blocks belong to the program being unloaded
+    trace_destroy(vm);
+    free(vm->debugOpcodes);
+    free(vm->breakpoints);
 
+    vm->programMapping = NULL;
+    vm->programMappingSize = 0;
+    vm->instructionMemory = NULL;
+    vm->numInstructions = 0;
+    vm->labels = NULL;
+    vm->numLabels = 0;
+    vm->handlerTable = NULL;
+    vm->debugOpcodes = NULL;
+    vm->breakpoints = NULL;
+    vm->breakRequested = 0;
 
+    return;
+}
 
 
 
+/**
+ * @brief Decode one slice of an IR file into a chunk of instructions.
+ *
+ * Slices always start at the beginning of a line and end after a newline (or at the end of the file), so
+ * chunks can be decoded independently. Label addresses are recorded relative to the start of the chunk and
+ * label operands are left as label numbers - both are fixed up by load_IR once every chunk is decoded.
+ * Nothing is printed here, the first error is recorded in the chunk instead.
+ *
+ * @param chunkPtr The chunk to decode (LoadChunk*). Runs on a loader thread.
+ * @return Always NULL - the result is in chunk->success.
+ */
+static void *decode_chunk(void *chunkPtr) {
 
+    LoadChunk *chunk = (LoadChunk*)chunkPtr;
+    const char *end = chunk->end;
 
+    chunk->success = false;
+    chunk->numInstructions = 0;
+    chunk->numLabels = 0;
+    chunk->numLines = 0;
 
+    //Every instruction is on its own line - size the chunk once from the number of lines
+    size_t instructionsSize = 2; //Last line may have no newline, plus space for the HALT
+    for(const char *current = chunk->start; (current = memchr(current, '\n', (size_t)(end - current))) != NULL; current++) {
+        instructionsSize++;
+    }
 
+    chunk->instructions = (Instruction*)malloc(sizeof(Instruction) * instructionsSize);
+    chunk->labels = (Label*)malloc(sizeof(Label) * LABEL_SIZE);
+    chunk->labelsSize = LABEL_SIZE;
+    if(chunk->instructions == NULL || chunk->labels == NULL) {
+        chunk->error = "FAILED to allocate memory for instructions";
+        return NULL;
+    }
 
+
+    IRField fields[MAX_FIELDS];
+    const char *cursor = chunk->start;
+    while(cursor < end) {
+
+        size_t numFields = scan_line(&cursor, end, fields, &(chunk->errorLine));
+        chunk->numLines++;
+        if(numFields == 0) { //Empty line
+            continue;
+        }
+
+
+        if(field_equals(fields[0], "LABEL") == true) { //Label definition - not an instruction
+
+            size_t labelID = 0;
+            if(numFields != 2 || parse_unsigned(fields[1], &labelID) == false) {
+                chunk->error = "INVALID label definition";
+                return NULL;
+            }
+
+            if(chunk->numLabels == chunk->labelsSize) { //Need to expand label table
+                Label *newLabels = (Label*)realloc(chunk->labels, sizeof(Label) * chunk->labelsSize * 2);
+                if(newLabels == NULL) {
+                    chunk->error = "FAILED to allocate memory for labels";
+                    return NULL;
+                }
+                chunk->labels = newLabels;
+                chunk->labelsSize *= 2;
+            }
+            chunk->labels[chunk->numLabels].labelID = labelID;
+            chunk->labels[chunk->numLabels].address = chunk->numInstructions;
+            chunk->numLabels++;
+            continue;
+        }
+
+
+        const OpcodeDefinition *definition = NULL;
+        for(size_t i = 0; i < sizeof(opcodeDefinitions)/sizeof(opcodeDefinitions[0]); i++) {
+            if(field_equals(fields[0], opcodeDefinitions[i].name) == true) {
+                definition = &(opcodeDefinitions[i]);
+                break;
+            }
+        }
+        if(definition == NULL) {
+            chunk->error = "UNRECOGNISED opcode";
+            return NULL;
+        }
+
+        if(decode_operands(chunk->vm, definition, fields + 1, numFields - 1, &(chunk->instructions[chunk->numInstructions])) == false) {
+            chunk->error = "INVALID operands";
+            return NULL;
+        }
+        chunk->numInstructions++;
+    }
+
+    chunk->success = true;
+    return NULL;
+}
+
+
+/**
+ * @brief Preprocessor pass - decode the contents of an IR file into instruction memory.
+ *
+ * Each line is matched against the opcode table and decoded into a packed Instruction. Label definitions
+ * (LABEL|||N|||) are recorded in a label table and do not take up space in instruction memory. Once the
+ * whole file is read every label operand is replaced by the index of the instruction it refers to, and a
+ * HALT instruction is placed at the end so the interpreter never needs to check the program counter.
+ *
+ * The text is scanned in place (it is normally the memory mapped file) and is never modified. Large files
+ * are split at line boundaries and the slices are decoded in parallel by loader threads, then stitched
+ * together in order before labels are resolved.
+ *
+ * @param vm The VM to load the program onto.
+ * @param text Contents of the IR file.
+ * @param length Length of the contents in bytes.
+ * @param debug If true, prints debugging information.
+ * @return true if every line was decoded and every label resolved, false otherwise.
+ */
+static bool load_IR(VirtualMachine *vm, const char *text, size_t length, bool debug) {
+
+    const char *end = text + length;
+    bool success = false;
+
+    size_t numChunks = vm->loadThreads;
+    if(numChunks == 0) { //One thread per core
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numChunks = (cores > 0 ? (size_t)cores : 1);
+    }
+    if(numChunks > MAX_LOAD_THREADS) {
+        numChunks = MAX_LOAD_THREADS;
+    }
+    if(numChunks > length / PARALLEL_LOAD_SIZE) { //Not worth starting a thread for less than PARALLEL_LOAD_SIZE bytes
+        numChunks = length / PARALLEL_LOAD_SIZE;
+    }
+    if(numChunks == 0) {
+        numChunks = 1;
+    }
+
+
+    //Split at newlines - each chunk starts at the beginning of a line
+    LoadChunk chunks[MAX_LOAD_THREADS];
+    const char *chunkStart = text;
+    for(size_t i = 0; i < numChunks; i++) {
+
+        const char *chunkEnd = end;
+        if(i + 1 < numChunks) {
+            chunkEnd = text + (length / numChunks) * (i + 1);
+            if(chunkEnd < chunkStart) {
+                chunkEnd = chunkStart;
+            }
+            const char *newline = memchr(chunkEnd, '\n', (size_t)(end - chunkEnd));
+            chunkEnd = (newline == NULL ? end : newline + 1);
+        }
+
+        chunks[i].vm = vm;
+        chunks[i].start = chunkStart;
+        chunks[i].end = chunkEnd;
+        chunks[i].instructions = NULL;
+        chunks[i].labels = NULL;
+        chunks[i].success = false;
+        chunks[i].error = NULL;
+        chunkStart = chunkEnd;
+    }
+
+
+    //Chunk 0 is decoded on this thread while the others run
+    pthread_t threads[MAX_LOAD_THREADS];
+    bool threadStarted[MAX_LOAD_THREADS] = {false};
+    for(size_t i = 1; i < numChunks; i++) {
+        threadStarted[i] = (pthread_create(&(threads[i]), NULL, decode_chunk, &(chunks[i])) == 0);
+        if(threadStarted[i] == false) {
+            decode_chunk(&(chunks[i]));
+        }
+    }
+    decode_chunk(&(chunks[0]));
+    for(size_t i = 1; i < numChunks; i++) {
+        if(threadStarted[i] == true) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+
+    size_t numInstructions = 0;
+    size_t numLabels = 0;
+    size_t lineNumber = 0;
+    for(size_t i = 0; i < numChunks; i++) {
+        if(chunks[i].success == false) {
+            if(chunks[i].instructions == NULL || chunks[i].labels == NULL) {
+                printf("[VM] %s\n",chunks[i].error);
+            } else {
+                printf("[VM] %s on line %zu: %.*s\n",chunks[i].error, lineNumber + chunks[i].numLines, (int)chunks[i].errorLine.length, chunks[i].errorLine.start);
+            }
+            goto cleanup;
+        }
+        numInstructions += chunks[i].numInstructions;
+        numLabels += chunks[i].numLabels;
+        lineNumber += chunks[i].numLines;
+    }
+
+
+    //Stitch chunks together - label addresses become absolute
+    //A single chunk already has space for the HALT and is used as it is
+    Instruction *instructionMemoryArray = NULL;
+    if(numChunks == 1) {
+        instructionMemoryArray = chunks[0].instructions;
+        chunks[0].instructions = NULL;
+    } else {
+        instructionMemoryArray = (Instruction*)malloc(sizeof(Instruction) * (numInstructions + 1)); //+1 for the HALT
+    }
+
+    LabelTable labels;
+    labels.slots = NULL;
+    if(instructionMemoryArray == NULL || label_table_create(&labels, numLabels) == false) {
+        if(debug == true) {
+            printf("[VM - DEBUG] FAILED to allocate memory for instructions\n");
+        }
+        free(instructionMemoryArray);
+        goto cleanup;
+    }
+
+    size_t base = 0;
+    for(size_t i = 0; i < numChunks; i++) {
+
+        if(chunks[i].instructions != NULL) {
+            memcpy(instructionMemoryArray + base, chunks[i].instructions, sizeof(Instruction) * chunks[i].numInstructions);
+        }
+
+        for(size_t j = 0; j < chunks[i].numLabels; j++) {
+            if(label_table_insert(&labels, chunks[i].labels[j].labelID, chunks[i].labels[j].address + base) == false) {
+                printf("[VM] REDEFINED label %zu\n",chunks[i].labels[j].labelID);
+                free(instructionMemoryArray);
+                free(labels.slots);
+                goto cleanup;
+            }
+        }
+        base += chunks[i].numInstructions;
+    }
+
+
+
+    //Resolve labels - after this point only indices into instruction memory are used
+    //Every unresolved label is reported before giving up
+    size_t numUnresolved = 0;
+    for(size_t i = 0; i < numInstructions; i++) {
+
+        Instruction *instruction = &(instructionMemoryArray[i]);
+        if((instruction->opcode >= GRT && instruction->opcode <= JAL)) {
+
+            Label *label = label_table_find(&labels, instruction->ARG3.label);
+            if(label == NULL) {
+                printf("[VM] UNRESOLVED label %u in instruction %zu\n",instruction->ARG3.label, i);
+                numUnresolved++;
+            } else {
+                instruction->ARG3.label = (uint32_t)label->address;
+            }
+        }
+    }
+
+    if(numUnresolved != 0) {
+        printf("[VM] %zu UNRESOLVED label references\n",numUnresolved);
+        free(instructionMemoryArray);
+        free(labels.slots);
+        goto cleanup;
+    }
+
+
+    //Keep the label definitions (sorted by address) for writing bytecode and reporting
+    size_t labelIndex = 0;
+    for(size_t i = 0; i < labels.capacity; i++) {
+        if(labels.slots[i].labelID != EMPTY_LABEL) {
+            labels.slots[labelIndex] = labels.slots[i];
+            labelIndex++;
+        }
+    }
+    qsort(labels.slots, labelIndex, sizeof(Label), compare_label_address);
+
+    instructionMemoryArray[numInstructions].opcode = HALT;
+    instructionMemoryArray[numInstructions].ARG1 = 0;
+    instructionMemoryArray[numInstructions].ARG2 = 0;
+    instructionMemoryArray[numInstructions].ARG3.reg = 0;
+
+
+    release_program(vm);
+    vm->instructionMemory = instructionMemoryArray;
+    vm->numInstructions = numInstructions;
+    vm->labels = labels.slots;
+    vm->numLabels = labelIndex;
+    vm->handlerTable = NULL;
+
+    if(match_parallel_blocks(vm) == false) {
+        release_program(vm);
+        goto cleanup;
+    }
+    size_t fused = fuse_instructions(vm);
+
+    if(debug == true) {
+        printf("[VM - DEBUG] Decoded %zu instructions and %zu labels using %zu threads\n",numInstructions, numLabels, numChunks);
+        printf("[VM - DEBUG] Fused %zu instruction pairs\n",fused);
+    }
+    success = true;
+
+
+cleanup:
+    for(size_t i = 0; i < numChunks; i++) {
+        free(chunks[i].instructions);
+        free(chunks[i].labels);
+    }
+    return success;
+}
+
+
+
+/*
+ * Multi-core
+ * ----------
+ * PARALLEL_START copies the requesting core's registers into a free core and runs the block after it on its own
+ * host thread. Each core has its own program counter, registers and return stack, RAM is shared. Requested cores
+ * always run the switch or threaded engine.
+ */
+static bool execute_core(VirtualMachine *vm);
+
+
+/**
+ * @brief Release every sync point that all running cores have reached. The cores lock must be held.
+ *
+ * @param cores The shared multi-core state.
+ */
+static void release_sync_points(VMCores *cores) {
+
+    for(size_t i = 0; i < cores->numSyncPoints; i++) {
+        SyncPoint *point = &(cores->syncPoints[i]);
+        if(point->arrived != 0 && point->arrived >= cores->activeCores) {
+            point->arrived = 0;
+            point->generation++;
+            pthread_cond_broadcast(&(cores->changed));
+        }
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Host thread of a requested core - runs the core until it stops, then marks it idle.
+ *
+ * @param argument The core's VirtualMachine.
+ * @return NULL.
+ */
+static void *core_thread(void *argument) {
+
+    VirtualMachine *vm = (VirtualMachine*)argument;
+    VMCores *cores = vm->cores;
+
+    execute_core(vm);
+    output_flush(vm);
+
+    pthread_mutex_lock(&(cores->lock));
+    if(vm->interrupt != INTERRUPT_NONE && cores->interrupt == INTERRUPT_NONE) {
+        cores->interrupt = vm->interrupt;
+        cores->interruptCounter = vm->programCounter;
+    }
+    cores->running[vm->coreID] = false;
+    cores->activeCores--;
+    release_sync_points(cores); //This core no longer holds anyone up
+    pthread_cond_broadcast(&(cores->changed));
+    pthread_mutex_unlock(&(cores->lock));
+
+    return NULL;
+}
+
+
+/**
+ * @brief Start a core on a parallel block (PARALLEL_START).
+ *
+ * If the core is still running a previous block, waits for it to stop first.
+ *
+ * @param vm The requesting core.
+ * @param coreID The core to start.
+ * @param programCounter First instruction of the block.
+ * @return true if the core was started, false if the ID is invalid or the thread could not be created.
+ */
+static bool start_core(VirtualMachine *vm, size_t coreID, size_t programCounter) {
+
+    VMCores *cores = vm->cores;
+    if(cores == NULL || coreID == 0 || coreID >= cores->numCores || coreID == vm->coreID) {
+        return false;
+    }
+    output_flush(vm); //Printed before the block starts, so before anything the block prints
+
+    pthread_mutex_lock(&(cores->lock));
+    while(cores->running[coreID] == true) {
+        pthread_cond_wait(&(cores->changed), &(cores->lock));
+    }
+    if(cores->joinable[coreID] == true) {
+        pthread_join(cores->threads[coreID], NULL);
+        cores->joinable[coreID] = false;
+    }
+
+    VirtualMachine *core = &(cores->cores[coreID]);
+    DataTypes *registerArray = core->registerArray;
+    uint32_t *returnStack = core->returnStack;
+    char *outputBuffer = core->outputBuffer;
+    *core = *vm; //Shares RAM, program and settings with the requester
+    core->registerArray = registerArray;
+    memcpy(core->registerArray, vm->registerArray, vm->numRegisters * sizeof(DataTypes));
+    core->returnStack = returnStack;
+    core->returnStackDepth = 0;
+    core->outputBuffer = outputBuffer;
+    core->outputUsed = 0;
+    core->programCounter = programCounter;
+    core->interrupt = INTERRUPT_NONE;
+    core->coreID = coreID;
+
+    cores->running[coreID] = true;
+    cores->activeCores++;
+    bool success = (pthread_create(&(cores->threads[coreID]), NULL, core_thread, core) == 0);
+    if(success == true) {
+        cores->joinable[coreID] = true;
+    } else {
+        cores->running[coreID] = false;
+        cores->activeCores--;
+    }
+    pthread_mutex_unlock(&(cores->lock));
+
+    return success;
+}
+
+
+/**
+ * @brief Wait until every running core has reached a SYNC with the same ID (or stopped).
+ *
+ * @param vm The core executing the SYNC.
+ * @param syncID The sync ID.
+ */
+static void sync_cores(VirtualMachine *vm, uint16_t syncID) {
+
+    VMCores *cores = vm->cores;
+    if(cores == NULL) { //Single core - nothing to wait for
+        return;
+    }
+    output_flush(vm); //Printed before the sync, so before anything printed after it
+
+    pthread_mutex_lock(&(cores->lock));
+
+    SyncPoint *point = NULL;
+    for(size_t i = 0; i < cores->numSyncPoints; i++) {
+        if(cores->syncPoints[i].syncID == syncID) {
+            point = &(cores->syncPoints[i]);
+            break;
+        }
+    }
+    if(point == NULL) {
+        if(cores->numSyncPoints == cores->syncPointsCapacity) {
+            size_t capacity = (cores->syncPointsCapacity == 0 ? 8 : cores->syncPointsCapacity * 2);
+            SyncPoint *syncPoints = (SyncPoint*)realloc(cores->syncPoints, capacity * sizeof(SyncPoint));
+            if(syncPoints == NULL) {
+                pthread_mutex_unlock(&(cores->lock));
+                return;
+            }
+            cores->syncPoints = syncPoints;
+            cores->syncPointsCapacity = capacity;
+        }
+        point = &(cores->syncPoints[cores->numSyncPoints]);
+        point->syncID = syncID;
+        point->arrived = 0;
+        point->generation = 0;
+        cores->numSyncPoints++;
+    }
+
+    size_t index = (size_t)(point - cores->syncPoints); //syncPoints may move while waiting
+    size_t generation = point->generation;
+    point->arrived++;
+    release_sync_points(cores);
+    while(cores->syncPoints[index].generation == generation) {
+        pthread_cond_wait(&(cores->changed), &(cores->lock));
+    }
+
+    pthread_mutex_unlock(&(cores->lock));
+    return;
+}
+
+
+/**
+ * @brief Allocate the shared multi-core state if the program uses PARALLEL_START or SYNC.
+ *
+ * @param vm The VM about to run.
+ * @return true if the program can run, false if the cores could not be allocated.
+ */
+static bool setup_cores(VirtualMachine *vm) {
+
+    vm->cores = NULL;
+    vm->coreID = 0;
+
+    bool parallel = false;
+    for(size_t i = 0; i < vm->numInstructions; i++) {
+        if(vm->instructionMemory[i].opcode == PARALLEL_START || vm->instructionMemory[i].opcode == SYNC) {
+            parallel = true;
+            break;
+        }
+    }
+    if(parallel == false) {
+        return true;
+    }
+
+    VMCores *cores = (VMCores*)calloc(1, sizeof(VMCores));
+    if(cores == NULL) {
+        return false;
+    }
+    cores->numCores = vm->numCores;
+    cores->cores = (VirtualMachine*)calloc(vm->numCores, sizeof(VirtualMachine));
+    cores->threads = (pthread_t*)calloc(vm->numCores, sizeof(pthread_t));
+    cores->running = (bool*)calloc(vm->numCores, sizeof(bool));
+    cores->joinable = (bool*)calloc(vm->numCores, sizeof(bool));
+    bool success = (cores->cores != NULL && cores->threads != NULL && cores->running != NULL && cores->joinable != NULL);
+    for(size_t i = 1; i < vm->numCores && success == true; i++) {
+        cores->cores[i].registerArray = (DataTypes*)calloc(vm->numRegisters, sizeof(DataTypes));
+        cores->cores[i].returnStack = (uint32_t*)malloc(vm->returnStackLimit * sizeof(uint32_t));
+        cores->cores[i].outputBuffer = (char*)malloc(VM_OUTPUT_BUFFER_SIZE);
+        success = (cores->cores[i].registerArray != NULL && cores->cores[i].returnStack != NULL
+        && cores->cores[i].outputBuffer != NULL);
+    }
+    if(success == false) {
+        for(size_t i = 1; cores->cores != NULL && i < vm->numCores; i++) {
+            free(cores->cores[i].registerArray);
+            free(cores->cores[i].returnStack);
+            free(cores->cores[i].outputBuffer);
+        }
+        free(cores->cores);
+        free(cores->threads);
+        free(cores->running);
+        free(cores->joinable);
+        free(cores);
+        return false;
+    }
+
+    pthread_mutex_init(&(cores->lock), NULL);
+    pthread_mutex_init(&(cores->heapLock), NULL);
+    pthread_mutex_init(&(cores->outputLock), NULL);
+    pthread_mutex_init(&(cores->inputLock), NULL);
+    pthread_cond_init(&(cores->changed), NULL);
+    cores->activeCores = 1; //Core 0
+    cores->interrupt = INTERRUPT_NONE;
+    vm->cores = cores;
+
+    return true;
+}
+
+
+/**
+ * @brief Wait for every requested core to stop and free the multi-core state.
+ *
+ * Core 0 stops taking part in syncs first, so cores waiting on it are released.
+ *
+ * @param vm The VM that finished running.
+ * @param result Result of core 0.
+ * @return false if core 0 or any requested core raised an interrupt, true otherwise.
+ */
+static bool finish_cores(VirtualMachine *vm, bool result) {
+
+    VMCores *cores = vm->cores;
+    if(cores == NULL) {
+        return result;
+    }
+
+    pthread_mutex_lock(&(cores->lock));
+    cores->activeCores--;
+    release_sync_points(cores);
+    pthread_mutex_unlock(&(cores->lock));
+
+    for(size_t i = 1; i < cores->numCores; i++) {
+        if(cores->joinable[i] == true) {
+            pthread_join(cores->threads[i], NULL);
+        }
+        free(cores->cores[i].registerArray);
+        free(cores->cores[i].returnStack);
+        free(cores->cores[i].outputBuffer);
+    }
+
+    if(result == true && cores->interrupt != INTERRUPT_NONE) {
+        vm->interrupt = cores->interrupt;
+        vm->programCounter = cores->interruptCounter;
+        result = false;
+    }
+
+    pthread_mutex_destroy(&(cores->lock));
+    pthread_mutex_destroy(&(cores->heapLock));
+    pthread_mutex_destroy(&(cores->outputLock));
+    pthread_mutex_destroy(&(cores->inputLock));
+    pthread_cond_destroy(&(cores->changed));
+    free(cores->cores);
+    free(cores->threads);
+    free(cores->running);
+    free(cores->joinable);
+    free(cores->syncPoints);
+    free(cores);
+    vm->cores = NULL;
+
+    return result;
+}
+
+
+
+/*
+ * Execution engines
+ * -----------------
+ * All engines include the same instruction handlers from intepret_IR_dispatch.h and only differ in how
+ * control moves between handlers.
+ */
+#define VM_ENGINE_LOCALS \
+    Instruction *program = vm->instructionMemory; \
+    Instruction *ip = program + vm->programCounter; \
+    DataTypes *R = vm->registerArray; \
+    uint8_t *RAM = vm->ramArray; \
+    size_t address = 0; \
+    (void)address;
+
+#define VM_TRAP(code) \
+    vm->interrupt = (code); \
+    goto stop
+
+
+
+/**
+ * @brief Execute the decoded program with a single central switch.
+ *
+ * Portable across compilers and used as the reference engine.
+ *
+ * @param vm The VM to run.
+ * @return true if the program ran to completion, false if an interrupt was raised.
+ */
+static bool execute_switch(VirtualMachine *vm) {
+
+    VM_ENGINE_LOCALS
+
+#define VM_CASE(op) case op:
+#define VM_NEXT() \
+    ip++; \
+    continue
+#define VM_JUMP(target) \
+    ip = program + (target); \
+    continue
+
+    for(;;) {
+        switch(ip->opcode) {
+            #include "intepret_IR_dispatch.h"
+
+            default: //Should never happen - preprocessor only emits valid opcodes
+                VM_TRAP(INTERRUPT_NONE);
+        }
+    }
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+stop:
+    vm->programCounter = (size_t)(ip - program);
+    return (vm->interrupt == INTERRUPT_NONE);
+}
+
+
+
+#if defined(__GNUC__) //GCC and Clang - labels as values
+
+//Handler table of a computed goto engine whose VM_CASE labels are prefix##opcode
+#define VM_THREADED_HANDLERS(prefix) { \
+    [INVALID] = &&prefix##INVALID, \
+    [ADD] = &&prefix##ADD, [SUB] = &&prefix##SUB, [MUL] = &&prefix##MUL, [DIV] = &&prefix##DIV, [MOD] = &&prefix##MOD, \
+    [ADD_F] = &&prefix##ADD_F, [SUB_F] = &&prefix##SUB_F, [MUL_F] = &&prefix##MUL_F, [DIV_F] = &&prefix##DIV_F, \
+    [ADI] = &&prefix##ADI, [SUI] = &&prefix##SUI, [MUI] = &&prefix##MUI, [DII] = &&prefix##DII, \
+    [ADI_F] = &&prefix##ADI_F, [SUI_F] = &&prefix##SUI_F, [MUI_F] = &&prefix##MUI_F, [DII_F] = &&prefix##DII_F, \
+    [STR] = &&prefix##STR, [LOD] = &&prefix##LOD, \
+    [STR_1] = &&prefix##STR_1, [STR_2] = &&prefix##STR_2, [STR_4] = &&prefix##STR_4, \
+    [LOD_1] = &&prefix##LOD_1, [LOD_2] = &&prefix##LOD_2, [LOD_4] = &&prefix##LOD_4, \
+    [GRT] = &&prefix##GRT, [GRE] = &&prefix##GRE, [LTE] = &&prefix##LTE, [LES] = &&prefix##LES, [EQU] = &&prefix##EQU, [NEQ] = &&prefix##NEQ, \
+    [JMP] = &&prefix##JMP, [JAL] = &&prefix##JAL, [JRT] = &&prefix##JRT, [NOP] = &&prefix##NOP, \
+    [INPUT_I] = &&prefix##INPUT_I, [INPUT_F] = &&prefix##INPUT_F, [INPUT_C] = &&prefix##INPUT_C, \
+    [OUTPUT_I] = &&prefix##OUTPUT_I, [OUTPUT_F] = &&prefix##OUTPUT_F, [OUTPUT_C] = &&prefix##OUTPUT_C, \
+    [PARALLEL_START] = &&prefix##PARALLEL_START, [PARALLEL_STOP] = &&prefix##PARALLEL_STOP, [SYNC] = &&prefix##SYNC, \
+    [ALLOCATE] = &&prefix##ALLOCATE, [FREE] = &&prefix##FREE, \
+    [VADD] = &&prefix##VADD, [VSUB] = &&prefix##VSUB, [VMUL] = &&prefix##VMUL, \
+    [VADD_F] = &&prefix##VADD_F, [VSUB_F] = &&prefix##VSUB_F, [VMUL_F] = &&prefix##VMUL_F, \
+    [ADI_GRT] = &&prefix##ADI_GRT, [ADI_GRE] = &&prefix##ADI_GRE, [ADI_LTE] = &&prefix##ADI_LTE, \
+    [ADI_LES] = &&prefix##ADI_LES, [ADI_EQU] = &&prefix##ADI_EQU, [ADI_NEQ] = &&prefix##ADI_NEQ, \
+    [MUL_ADD] = &&prefix##MUL_ADD, [MUL_ADD_F] = &&prefix##MUL_ADD_F, \
+    [BREAK] = &&prefix##BREAK, [HALT] = &&prefix##HALT, \
+}
+
+/**
+ * @brief Execute the decoded program with direct threaded dispatch.
+ *
+ * Before running, the handler address of each instruction is written into the instruction itself. Every handler
+ * then ends with its own indirect jump to the next handler instead of returning to one shared switch, which gives
+ * the branch predictor one jump site per opcode.
+ *
+ * @param vm The VM to run.
+ * @return true if the program ran to completion, false if an interrupt was raised.
+ */
+static bool execute_threaded(VirtualMachine *vm) {
+
+    static const void *const handlerTable[NUM_INSTRUCTIONS] = VM_THREADED_HANDLERS(op_);
+
+    if(vm->handlerTable != handlerTable) { //Thread the program - only needed once per load
+        for(size_t i = 0; i <= vm->numInstructions; i++) {
+            vm->instructionMemory[i].handler = handlerTable[vm->instructionMemory[i].opcode];
+        }
+        vm->handlerTable = handlerTable;
+    }
+
+    VM_ENGINE_LOCALS
+
+#define VM_CASE(op) op_##op:
+#define VM_NEXT() \
+    ip++; \
+    goto *(ip->handler)
+#define VM_JUMP(target) \
+    ip = program + (target); \
+    goto *(ip->handler)
+
+    goto *(ip->handler);
+
+    #include "intepret_IR_dispatch.h"
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+stop:
+    vm->programCounter = (size_t)(ip - program);
+    return (vm->interrupt == INTERRUPT_NONE);
+}
+
+
+static __thread VirtualMachine *guardedVM = NULL; //VM running on this thread with the guarded engine
+static __thread sigjmp_buf guardJump;
+static pthread_once_t guardHandlerOnce = PTHREAD_ONCE_INIT;
+static struct sigaction guardOldAction;
+
+/**
+ * @brief SIGSEGV handler - turns a fault on the guard pages of this thread's guarded VM into INTERRUPT_OOB.
+ *
+ * Any other fault is not the VM's, so the previous action is put back and the faulting access runs again under it.
+ */
+static void guard_signal_handler(int signal, siginfo_t *info, void *context) {
+
+    (void)signal;
+    (void)context;
+    VirtualMachine *vm = guardedVM;
+    uint8_t *faultAddress = (uint8_t*)info->si_addr;
+    if(vm != NULL && faultAddress >= vm->ramArray + vm->RAMsize && faultAddress < (uint8_t*)vm->ramMapping + vm->ramMappingSize) {
+        siglongjmp(guardJump, 1);
+    }
+
+    sigaction(SIGSEGV, &guardOldAction, NULL);
+    return;
+}
+
+/**
+ * @brief Install guard_signal_handler for SIGSEGV - run once per process, the first time a guarded VM runs.
+ */
+static void install_guard_handler(void) {
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = guard_signal_handler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER; //Left by siglongjmp - SIGSEGV must not stay blocked
+    sigemptyset(&(action.sa_mask));
+    sigaction(SIGSEGV, &action, &guardOldAction);
+
+    return;
+}
+
+
+/**
+ * @brief Direct threaded dispatch with no RAM bounds checks - the body of execute_guarded.
+ *
+ * Handlers record the memory instruction they are about to execute instead of comparing the address against
+ * RAMsize. Kept out of line so the sigsetjmp in execute_guarded does not force the dispatch loop's locals onto
+ * the stack.
+ *
+ * @param vm The VM to run.
+ * @return true if the program ran to completion, false if an interrupt was raised.
+ */
+static __attribute__((noinline)) bool run_guarded(VirtualMachine *vm) {
+
+    static const void *const handlerTable[NUM_INSTRUCTIONS] = VM_THREADED_HANDLERS(op_);
+
+    if(vm->handlerTable != handlerTable) { //Thread the program - only needed once per load
+        for(size_t i = 0; i <= vm->numInstructions; i++) {
+            vm->instructionMemory[i].handler = handlerTable[vm->instructionMemory[i].opcode];
+        }
+        vm->handlerTable = handlerTable;
+    }
+
+    VM_ENGINE_LOCALS
+
+#define VM_UNCHECKED_RAM
+#define VM_CASE(op) op_##op:
+#define VM_NEXT() \
+    ip++; \
+    goto *(ip->handler)
+#define VM_JUMP(target) \
+    ip = program + (target); \
+    goto *(ip->handler)
+
+    goto *(ip->handler);
+
+    #include "intepret_IR_dispatch.h"
+
+#undef VM_UNCHECKED_RAM
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+stop:
+    vm->programCounter = (size_t)(ip - program);
+    return (vm->interrupt == INTERRUPT_NONE);
+}
+
+
+/**
+ * @brief Execute the decoded program on guarded RAM, with the threaded engine minus its RAM bounds checks.
+ *
+ * Only used when RAM has guard pages (set_VM_guard_pages). Every address a register can hold lands either in RAM
+ * or on a guard page, and the SIGSEGV handler jumps back here to raise INTERRUPT_OOB at the faulting instruction.
+ *
+ * @param vm The VM to run.
+ * @return true if the program ran to completion, false if an interrupt was raised.
+ */
+static bool execute_guarded(VirtualMachine *vm) {
+
+    pthread_once(&guardHandlerOnce, install_guard_handler);
+    if(sigsetjmp(guardJump, 1) != 0) { //Out of bounds access faulted on a guard page
+        guardedVM = NULL;
+        vm->interrupt = INTERRUPT_OOB;
+        vm->programCounter = (size_t)(vm->guardInstruction - vm->instructionMemory);
+        return false;
+    }
+
+    guardedVM = vm;
+    bool result = run_guarded(vm);
+    guardedVM = NULL;
+
+    return result;
+}
+
+#else //No labels as values - fall back to the switch engine
+
+static bool execute_threaded(VirtualMachine *vm) {
+    return execute_switch(vm);
+}
+
+static bool execute_guarded(VirtualMachine *vm) {
+    return execute_switch(vm);
+}
+
+#endif
+
+
+/**
+ * @brief Execute a requested core - threaded (guarded if RAM has guard pages) if core 0 threaded the program,
+ * otherwise switch. Always switch while core 0 runs with watches.
+ *
+ * @param vm The core to run.
+ * @return true if the core stopped normally, false if an interrupt was raised.
+ */
+static bool execute_core(VirtualMachine *vm) {
+
+    if(vm->numWatches != 0) { //Watches only apply to core 0 - its engine threads the program for itself
+        return execute_switch(vm);
+    }
+    if(vm->handlerTable != NULL && vm->guardPages == true) {
+        return execute_guarded(vm);
+    }
+    if(vm->handlerTable != NULL) {
+        return execute_threaded(vm);
+    }
+    return execute_switch(vm);
+}
+
+
+
+/**
+ * @brief Sleep until the wall clock catches up with the number of instructions executed.
+ *
+ * The deadline is absolute (start of pacing + cycles / instructionsPerSecond) so rounding and oversleeping do
+ * not accumulate. If the VM has fallen more than a quantum behind, e.g. while blocked on input, pacing restarts
+ * from now instead of running a burst to catch up.
+ *
+ * @param vm The VM being run.
+ * @param start Time pacing started - updated if pacing restarts.
+ * @param startCycles Cycles executed when pacing started - updated if pacing restarts.
+ * @param cycles Cycles executed so far.
+ */
+static void pace_clock(VirtualMachine *vm, struct timespec *start, uint64_t *startCycles, uint64_t cycles) {
+
+    uint64_t elapsed = cycles - *startCycles;
+    uint64_t seconds = elapsed / vm->instructionsPerSecond;
+    uint64_t nanoseconds = (elapsed % vm->instructionsPerSecond) * 1000000000ull / vm->instructionsPerSecond;
+
+    struct timespec deadline;
+    deadline.tv_sec = start->tv_sec + (time_t)seconds;
+    deadline.tv_nsec = start->tv_nsec + (long)nanoseconds;
+    if(deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t behind = (int64_t)(now.tv_sec - deadline.tv_sec) * 1000000000ll + (now.tv_nsec - deadline.tv_nsec);
+    if(behind > 1000000000ll / PACING_QUANTA_PER_SECOND) {
+        *start = now;
+        *startCycles = cycles;
+        return;
+    }
+
+    output_flush(vm); //Shown while the VM sleeps, not once the buffer fills
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) { //Restart if interrupted by a signal
+        continue;
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Execute the decoded program at instructionsPerSecond.
+ *
+ * Uses the same switch as execute_switch, but counts cycles and sleeps once every quantum (about 1ms of VM time)
+ * against an absolute deadline, rather than once per instruction. Every instruction is one cycle, including NOP,
+ * so a run of NOPs takes the same wall clock time as the program expects. Superinstructions count as the two
+ * instructions they replace.
+ *
+ * @param vm The VM to run.
+ * @return true if the program ran to completion, false if an interrupt was raised.
+ */
+static bool execute_paced(VirtualMachine *vm) {
+
+    VM_ENGINE_LOCALS
+
+    uint64_t quantum = vm->instructionsPerSecond / PACING_QUANTA_PER_SECOND;
+    if(quantum == 0) {
+        quantum = 1;
+    }
+    uint64_t cycles = 0;
+    uint64_t nextPause = quantum;
+    uint64_t startCycles = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+#define VM_CASE(op) case op:
+#define VM_NEXT() \
+    ip++; \
+    continue
+#define VM_JUMP(target) \
+    ip = program + (target); \
+    continue
+
+    for(;;) {
+        cycles += (ip->opcode >= ADI_GRT && ip->opcode <= MUL_ADD_F) ? 2 : 1;
+        if(cycles >= nextPause) {
+            pace_clock(vm, &start, &startCycles, cycles);
+            nextPause = cycles + quantum;
+        }
+
+        switch(ip->opcode) {
+            #include "intepret_IR_dispatch.h"
+
+            default: //Should never happen - preprocessor only emits valid opcodes
+                VM_TRAP(INTERRUPT_NONE);
+        }
+    }
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+stop:
+    vm->programCounter = (size_t)(ip - program);
+    return (vm->interrupt == INTERRUPT_NONE);
+}
+
+
+
+//Operands counted by the statistics engine for each opcode
+#define STATISTICS_ARG1 0x01 //ARG1 is a register
+#define STATISTICS_ARG2 0x02 //ARG2 is a register
+#define STATISTICS_ARG3 0x04 //ARG3 is a register
+#define STATISTICS_BRANCH 0x08 //Opcode is a branch
+
+static const uint8_t statisticsOperands[NUM_INSTRUCTIONS] = {
+    [ADD] = 0x07, [SUB] = 0x07, [MUL] = 0x07, [DIV] = 0x07, [MOD] = 0x07,
+    [ADD_F] = 0x07, [SUB_F] = 0x07, [MUL_F] = 0x07, [DIV_F] = 0x07,
+    [ADI] = 0x03, [SUI] = 0x03, [MUI] = 0x03, [DII] = 0x03,
+    [ADI_F] = 0x03, [SUI_F] = 0x03, [MUI_F] = 0x03, [DII_F] = 0x03,
+    [STR] = 0x03, [LOD] = 0x03,
+    [STR_1] = 0x03, [STR_2] = 0x03, [STR_4] = 0x03, [LOD_1] = 0x03, [LOD_2] = 0x03, [LOD_4] = 0x03,
+    [GRT] = 0x0B, [GRE] = 0x0B, [LTE] = 0x0B, [LES] = 0x0B, [EQU] = 0x0B, [NEQ] = 0x0B,
+    [JMP] = 0x08, [JAL] = 0x08, [JRT] = 0x08,
+    [INPUT_I] = 0x01, [INPUT_F] = 0x01, [INPUT_C] = 0x01,
+    [OUTPUT_I] = 0x01, [OUTPUT_F] = 0x01, [OUTPUT_C] = 0x01,
+    [PARALLEL_START] = 0x08,
+    [ALLOCATE] = 0x03, [FREE] = 0x01,
+    [VADD] = 0x07, [VSUB] = 0x07, [VMUL] = 0x07, [VADD_F] = 0x07, [VSUB_F] = 0x07, [VMUL_F] = 0x07,
+};
+
+
+/**
+ * @brief Lower the minimum memory usage to the return stack plus live heap bytes, once memory has been used.
+ *
+ * @param statistics The statistics being collected.
+ */
+static inline void record_minimum_memory(VMStatistics *statistics) {
+
+    size_t memory = statistics->stackDepth * sizeof(uint32_t) + statistics->heapBytesUsed;
+    if(statistics->memoryUsed == false && memory != 0) {
+        statistics->memoryUsed = true;
+        statistics->minimumMemory = memory;
+    } else if(statistics->memoryUsed == true && memory < statistics->minimumMemory) {
+        statistics->minimumMemory = memory;
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Read the live heap bytes if the last instruction was an ALLOCATE or FREE.
+ *
+ * @param vm The VM being run.
+ * @return true if the live heap bytes were read (and the minimum memory usage updated), false otherwise.
+ */
+static inline bool record_heap_memory(VirtualMachine *vm) {
+
+    VMStatistics *statistics = &(vm->statistics);
+    if(statistics->heapChanged == false) {
+        return false;
+    }
+    statistics->heapChanged = false;
+    statistics->heapBytesUsed = heap_used_bytes(vm);
+    record_minimum_memory(statistics);
+
+    return true;
+}
+
+
+/**
+ * @brief Record one (unfused) instruction about to be executed by the statistics engine.
+ *
+ * @param vm The VM being run.
+ * @param instruction The instruction.
+ * @param opcode Opcode to record it as.
+ */
+static inline void record_instruction(VirtualMachine *vm, Instruction *instruction, uint16_t opcode) {
+
+    VMStatistics *statistics = &(vm->statistics);
+    uint8_t operands = statisticsOperands[opcode];
+
+    statistics->instructions++;
+    statistics->opcodeCounts[opcode]++;
+    if((operands & STATISTICS_ARG1) != 0) {
+        statistics->registerCounts[instruction->ARG1]++;
+    }
+    if((operands & STATISTICS_ARG2) != 0) {
+        statistics->registerCounts[instruction->ARG2]++;
+    }
+    if((operands & STATISTICS_ARG3) != 0) {
+        statistics->registerCounts[instruction->ARG3.reg]++;
+    }
+    if((operands & STATISTICS_BRANCH) != 0) {
+        statistics->branches++;
+    }
+
+    //Memory in use - RAM bytes written plus the return stack, minimum memory counts live heap bytes instead
+    bool memoryChanged = record_heap_memory(vm);
+    if(opcode == STR || (opcode >= VADD && opcode <= VMUL_F)) {
+        size_t address = (size_t)(unsigned INT_TYPE)vm->registerArray[instruction->ARG1].intVal;
+        size_t bytes = (opcode == STR ? instruction->ARG3.items
+        : (size_t)(uint32_t)vm->registerArray[instruction->ARG3.reg].intVal * VECTOR_ELEMENT_SIZE);
+        for(size_t i = 0; i < bytes && address + i < vm->RAMsize; i++) {
+            size_t byte = address + i;
+            if((statistics->ramTouched[byte / 8] & (1 << (byte % 8))) == 0) {
+                statistics->ramTouched[byte / 8] |= (uint8_t)(1 << (byte % 8));
+                statistics->ramBytesUsed++;
+                memoryChanged = true;
+            }
+        }
+    } else if(opcode == JAL && vm->returnStackDepth < vm->returnStackLimit) {
+        statistics->stackDepth++;
+        memoryChanged = true;
+    } else if(opcode == JRT && statistics->stackDepth > 0) {
+        statistics->stackDepth--;
+        memoryChanged = true;
+    }
+
+    if(memoryChanged == true) {
+        size_t memory = statistics->ramBytesUsed + statistics->stackDepth * sizeof(uint32_t);
+        if(memory > statistics->peakMemory) {
+            statistics->peakMemory = memory;
+        }
+        record_minimum_memory(statistics);
+    }
+    if(opcode == ALLOCATE || opcode == FREE) { //Read once it has run, at the next instruction or the end
+        statistics->heapChanged = true;
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Execute the decoded program with the switch dispatch, counting statistics for every instruction.
+ *
+ * A separate instantiation of the dispatch loop so the other engines pay nothing for statistics. Superinstructions
+ * are recorded as the two instructions they replace.
+ *
+ * @param vm The VM to run.
+ * @return true if the program ran to completion, false if an interrupt was raised.
+ */
+static bool execute_statistics(VirtualMachine *vm) {
+
+    VMStatistics *statistics = &(vm->statistics);
+    free(statistics->registerCounts);
+    free(statistics->ramTouched);
+    memset(statistics, 0, sizeof(*statistics));
+    statistics->registerCounts = (uint64_t*)calloc(vm->numRegisters, sizeof(uint64_t));
+    statistics->ramTouched = (uint8_t*)calloc(vm->RAMsize / 8 + 1, sizeof(uint8_t));
+    if(statistics->registerCounts == NULL || statistics->ramTouched == NULL) {
+        return execute_switch(vm);
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    VM_ENGINE_LOCALS
+
+#define VM_CASE(op) case op:
+#define VM_NEXT() \
+    ip++; \
+    continue
+#define VM_JUMP(target) \
+    statistics->branchesTaken++; \
+    ip = program + (target); \
+    continue
+
+    for(;;) {
+        switch(ip->opcode) {
+            case ADI_GRT: case ADI_GRE: case ADI_LTE: case ADI_LES: case ADI_EQU: case ADI_NEQ:
+                record_instruction(vm, ip, ADI);
+                record_instruction(vm, ip + 1, ip[1].opcode);
+                break;
+            case MUL_ADD:
+                record_instruction(vm, ip, MUL);
+                record_instruction(vm, ip + 1, ADD);
+                break;
+            case MUL_ADD_F:
+                record_instruction(vm, ip, MUL_F);
+                record_instruction(vm, ip + 1, ADD_F);
+                break;
+            case STR_1: case STR_2: case STR_4:
+                record_instruction(vm, ip, STR);
+                break;
+            case LOD_1: case LOD_2: case LOD_4:
+                record_instruction(vm, ip, LOD);
+                break;
+            case HALT: case BREAK:
+                break;
+            default:
+                record_instruction(vm, ip, ip->opcode);
+                break;
+        }
+
+        switch(ip->opcode) {
+            #include "intepret_IR_dispatch.h"
+
+            default: //Should never happen - preprocessor only emits valid opcodes
+                VM_TRAP(INTERRUPT_NONE);
+        }
+    }
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+stop:
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    record_heap_memory(vm);
+    statistics->seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    vm->programCounter = (size_t)(ip - program);
+    return (vm->interrupt == INTERRUPT_NONE);
+}
+
+
+
+//The SIGPROF timer is per process, so it is shared by every VM being profiled
+static volatile sig_atomic_t profileTicks = 0; //Incremented by SIGPROF - each profiled VM samples when it changes
+static pthread_mutex_t profilerLock = PTHREAD_MUTEX_INITIALIZER;
+static size_t profilerUsers = 0; //VMs currently profiling - the timer runs while this is non zero
+static struct sigaction profilerOldAction;
+static struct itimerval profilerOldTimer;
+
+static void profile_signal_handler(int signal) {
+    (void)signal;
+    profileTicks++;
+    return;
+}
+
+
+/**
+ * @brief Start the SIGPROF timer unless another VM being profiled already started it.
+ *
+ * @return true if the timer is running, false if it could not be started.
+ */
+static bool start_profiler_timer(void) {
+
+    bool success = true;
+    pthread_mutex_lock(&profilerLock);
+
+    if(profilerUsers == 0) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = profile_signal_handler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&(action.sa_mask));
+
+        struct itimerval timer;
+        timer.it_interval.tv_sec = 0;
+        timer.it_interval.tv_usec = PROFILE_INTERVAL_US;
+        timer.it_value = timer.it_interval;
+
+        if(sigaction(SIGPROF, &action, &profilerOldAction) != 0) {
+            success = false;
+        } else if(setitimer(ITIMER_PROF, &timer, &profilerOldTimer) != 0) {
+            sigaction(SIGPROF, &profilerOldAction, NULL);
+            success = false;
+        }
+    }
+    if(success == true) {
+        profilerUsers++;
+    }
+
+    pthread_mutex_unlock(&profilerLock);
+    return success;
+}
+
+
+/**
+ * @brief Stop the SIGPROF timer once no VM is being profiled, restoring the previous handler and timer.
+ */
+static void stop_profiler_timer(void) {
+
+    pthread_mutex_lock(&profilerLock);
+    profilerUsers--;
+    if(profilerUsers == 0) {
+        setitimer(ITIMER_PROF, &profilerOldTimer, NULL);
+        sigaction(SIGPROF, &profilerOldAction, NULL);
+    }
+    pthread_mutex_unlock(&profilerLock);
+
+    return;
+}
+
+
+/**
+ * @brief Record the current call stack and program counter as one profiler sample.
+ *
+ * @param vm The VM being profiled.
+ * @param programCounter The instruction about to be executed.
+ */
+static void record_profile_sample(VirtualMachine *vm, size_t programCounter) {
+
+    VMProfile *profile = &(vm->profile);
+    size_t frames = (profile->depth < PROFILE_MAX_DEPTH ? profile->depth : PROFILE_MAX_DEPTH);
+
+    if(profile->samplesUsed + frames + 2 > profile->samplesCapacity) {
+        size_t capacity = (profile->samplesCapacity == 0 ? 4096 : profile->samplesCapacity * 2);
+        while(capacity < profile->samplesUsed + frames + 2) {
+            capacity *= 2;
+        }
+        uint32_t *samples = (uint32_t*)realloc(profile->samples, capacity * sizeof(uint32_t));
+        if(samples == NULL) { //Drop the sample
+            return;
+        }
+        profile->samples = samples;
+        profile->samplesCapacity = capacity;
+    }
+
+    uint32_t *sample = profile->samples + profile->samplesUsed;
+    sample[0] = (uint32_t)frames;
+    memcpy(sample + 1, profile->callStack + (profile->depth - frames), frames * sizeof(uint32_t));
+    sample[frames + 1] = (uint32_t)programCounter;
+    profile->samplesUsed += frames + 2;
+    profile->numSamples++;
+
+    return;
+}
+
+
+/**
+ * @brief Execute the decoded program with the switch dispatch while sampling the program counter.
+ *
+ * A SIGPROF timer fires every PROFILE_INTERVAL_US of CPU time and only counts a tick - the sample (program counter
+ * plus the JAL call stack, tracked alongside the return stack) is taken by the loop at the next instruction, so
+ * the signal handler never touches the VM.
+ *
+ * @param vm The VM to run.
+ * @return true if the program ran to completion, false if an interrupt was raised.
+ */
+static bool execute_profiled(VirtualMachine *vm) {
+
+    VMProfile *profile = &(vm->profile);
+    free(profile->callStack);
+    free(profile->samples);
+    memset(profile, 0, sizeof(*profile));
+
+    if(start_profiler_timer() == false) {
+        return execute_switch(vm);
+    }
+    sig_atomic_t lastTick = profileTicks;
+
+    VM_ENGINE_LOCALS
+
+#define VM_CASE(op) case op:
+#define VM_NEXT() \
+    ip++; \
+    continue
+#define VM_JUMP(target) \
+    ip = program + (target); \
+    continue
+
+    for(;;) {
+        if(profileTicks != lastTick) {
+            lastTick = profileTicks;
+            record_profile_sample(vm, (size_t)(ip - program));
+        }
+
+        if(ip->opcode == JAL) {
+            if(profile->depth == profile->callStackCapacity) {
+                size_t capacity = (profile->callStackCapacity == 0 ? 64 : profile->callStackCapacity * 2);
+                uint32_t *callStack = (uint32_t*)realloc(profile->callStack, capacity * sizeof(uint32_t));
+                if(callStack != NULL) {
+                    profile->callStack = callStack;
+                    profile->callStackCapacity = capacity;
+                }
+            }
+            if(profile->depth < profile->callStackCapacity) {
+                profile->callStack[profile->depth] = (uint32_t)(ip - program);
+                profile->depth++;
+            }
+        } else if(ip->opcode == JRT && profile->depth > 0) {
+            profile->depth--;
+        }
+
+        switch(ip->opcode) {
+            #include "intepret_IR_dispatch.h"
+
+            default: //Should never happen - preprocessor only emits valid opcodes
+                VM_TRAP(INTERRUPT_NONE);
+        }
+    }
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+stop:
+    stop_profiler_timer();
+    vm->programCounter = (size_t)(ip - program);
+    return (vm->interrupt == INTERRUPT_NONE);
+}
+
+
+
+/**
+ * @brief Execute the decoded program with the switch engine, running hot blocks as native code.
+ *
+ * Every jump goes through JIT_run, which counts how often each target is reached, compiles it once it passes
+ * the JIT threshold and runs compiled blocks until one exits to an instruction that has to be interpreted.
+ * Falls back to the plain switch engine if the JIT could not be set up.
+ *
+ * @param vm The VM to run.
+ * @return true if the program ran to completion, false if an interrupt was raised.
+ */
+static bool execute_jit(VirtualMachine *vm) {
+
+    if(JIT_initialise(vm) == false) {
+        return execute_switch(vm);
+    }
+
+    VM_ENGINE_LOCALS
+
+#define VM_CASE(op) case op:
+#define VM_NEXT() \
+    ip++; \
+    continue
+#define VM_JUMP(target) \
+    ip = program + (target); \
+    goto jit_entry
+
+    for(;;) {
+        switch(ip->opcode) {
+            #include "intepret_IR_dispatch.h"
+
+            default: //Should never happen - preprocessor only emits valid opcodes
+                VM_TRAP(INTERRUPT_NONE);
+        }
+
+    jit_entry:
+        ip = program + JIT_run(vm, (size_t)(ip - program));
+    }
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+stop:
+    vm->programCounter = (size_t)(ip - program);
+    return (vm->interrupt == INTERRUPT_NONE);
+}
+
+
+
+/**
+ * @brief Execute a single instruction with the switch dispatch (a superinstruction executes both halves).
+ *
+ * Used by the debugger to step. Every handler leaves through VM_NEXT, VM_JUMP or VM_TRAP, so each of them ends
+ * the run with the program counter on the next instruction to execute.
+ *
+ * @param vm The VM to run.
+ * @return true if the instruction completed (or the program has ended), false if an interrupt was raised.
+ */
+static bool execute_step(VirtualMachine *vm) {
+
+    VM_ENGINE_LOCALS
+
+#define VM_CASE(op) case op:
+#define VM_NEXT() \
+    ip++; \
+    goto stop
+#define VM_JUMP(target) \
+    ip = program + (target); \
+    goto stop
+
+    switch(ip->opcode) {
+        #include "intepret_IR_dispatch.h"
+
+        default: //Should never happen - preprocessor only emits valid opcodes
+            VM_TRAP(INTERRUPT_NONE);
+    }
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+stop:
+    vm->programCounter = (size_t)(ip - program);
+    return (vm->interrupt == INTERRUPT_NONE);
+}
+
+
+/*
+ * Watchpoints
+ * -----------
+ * A watch is compiled into a predicate when it is set (one small function per comparison and type). Only
+ * instructions that write a watched register evaluate the predicates - they are threaded with a second copy of
+ * every handler that checks the watches before moving on, every other instruction runs the plain handlers.
+ */
+#define WATCH_PREDICATE(name, field, operator) \
+    static bool name(DataTypes value, DataTypes operand) { \
+        return (value.field operator operand.field); \
+    }
+
+WATCH_PREDICATE(watch_greater_int, intVal, >)
+WATCH_PREDICATE(watch_greater_equal_int, intVal, >=)
+WATCH_PREDICATE(watch_less_int, intVal, <)
+WATCH_PREDICATE(watch_less_equal_int, intVal, <=)
+WATCH_PREDICATE(watch_equal_int, intVal, ==)
+WATCH_PREDICATE(watch_not_equal_int, intVal, !=)
+WATCH_PREDICATE(watch_greater_float, floatVal, >)
+WATCH_PREDICATE(watch_greater_equal_float, floatVal, >=)
+WATCH_PREDICATE(watch_less_float, floatVal, <)
+WATCH_PREDICATE(watch_less_equal_float, floatVal, <=)
+WATCH_PREDICATE(watch_equal_float, floatVal, ==)
+WATCH_PREDICATE(watch_not_equal_float, floatVal, !=)
+
+#undef WATCH_PREDICATE
+
+//Indexed by [isFloat][VM_WATCH_COMPARISON]
+static const WatchPredicate watchPredicates[2][6] = {
+    {watch_greater_int, watch_greater_equal_int, watch_less_int, watch_less_equal_int, watch_equal_int, watch_not_equal_int},
+    {watch_greater_float, watch_greater_equal_float, watch_less_float, watch_less_equal_float, watch_equal_float, watch_not_equal_float},
+};
+
+
+/**
+ * @brief Check whether an instruction writes a register that has a watch.
+ *
+ * @param vm The VM holding the program.
+ * @param index The instruction.
+ * @return true if the instruction must evaluate the watches after executing, false otherwise.
+ */
+static bool writes_watched_register(VirtualMachine *vm, size_t index) {
+
+    Instruction *instruction = &(vm->instructionMemory[index]);
+    uint16_t opcode = (vm->debugOpcodes != NULL ? vm->debugOpcodes[index] : instruction->opcode);
+    uint16_t destinations[2] = {UINT16_MAX, UINT16_MAX};
+
+    switch(opcode) {
+        case ADD: case SUB: case MUL: case DIV: case MOD: case ADD_F: case SUB_F: case MUL_F: case DIV_F:
+        case ADI: case SUI: case MUI: case DII: case ADI_F: case SUI_F: case MUI_F: case DII_F:
+        case ADI_GRT: case ADI_GRE: case ADI_LTE: case ADI_LES: case ADI_EQU: case ADI_NEQ:
+        case INPUT_I: case INPUT_F: case INPUT_C: case ALLOCATE:
+            destinations[0] = instruction->ARG1;
+            break;
+        case LOD: case LOD_1: case LOD_2: case LOD_4:
+            destinations[0] = instruction->ARG2;
+            break;
+        case MUL_ADD: case MUL_ADD_F: //Both halves write a register
+            destinations[0] = instruction->ARG1;
+            destinations[1] = instruction[1].ARG1;
+            break;
+        default:
+            return false;
+    }
+
+    for(size_t i = 0; i < vm->numWatches; i++) {
+        if(vm->watches[i].reg == destinations[0] || vm->watches[i].reg == destinations[1]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief Evaluate every watch.
+ *
+ * @param vm The VM being run.
+ * @return true if a watch's condition holds (its index is placed in triggeredWatch), false otherwise.
+ */
+static inline bool watch_triggered(VirtualMachine *vm) {
+
+    for(size_t i = 0; i < vm->numWatches; i++) {
+        VMWatch *watch = &(vm->watches[i]);
+        if(watch->predicate(vm->registerArray[watch->reg], watch->operand) == true) {
+            vm->triggeredWatch = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+#if defined(__GNUC__) //GCC and Clang - labels as values
+
+/**
+ * @brief Execute the decoded program with direct threaded dispatch, stopping when a watch's condition holds.
+ *
+ * The handlers are included twice - op_ labels move on as the threaded engine does, watch_ labels evaluate the
+ * watches first. Instructions that write a watched register are threaded with the watch_ copy, so the rest of
+ * the program runs at threaded speed. The program is rethreaded on every run since the watches may have changed.
+ *
+ * @param vm The VM to run.
+ * @return true if the program ran to completion, false if an interrupt was raised (INTERRUPT_BREAK for a watch).
+ */
+static bool execute_watched(VirtualMachine *vm) {
+
+    static const void *const handlerTable[NUM_INSTRUCTIONS] = VM_THREADED_HANDLERS(op_);
+    static const void *const watchHandlerTable[NUM_INSTRUCTIONS] = VM_THREADED_HANDLERS(watch_);
+
+    for(size_t i = 0; i <= vm->numInstructions; i++) {
+        uint16_t opcode = vm->instructionMemory[i].opcode;
+        bool watched = (i < vm->numInstructions && writes_watched_register(vm, i) == true);
+        vm->instructionMemory[i].handler = (watched == true ? watchHandlerTable[opcode] : handlerTable[opcode]);
+    }
+    vm->handlerTable = handlerTable; //Breakpoints patched during the run use the plain handlers
+
+    VM_ENGINE_LOCALS
+
+#define VM_CASE(op) op_##op:
+#define VM_NEXT() \
+    ip++; \
+    goto *(ip->handler)
+#define VM_JUMP(target) \
+    ip = program + (target); \
+    goto *(ip->handler)
+
+    goto *(ip->handler);
+
+    #include "intepret_IR_dispatch.h"
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+#define VM_CASE(op) watch_##op:
+#define VM_NEXT() \
+    ip++; \
+    goto check_watches
+#define VM_JUMP(target) \
+    ip = program + (target); \
+    goto check_watches
+
+    #include "intepret_IR_dispatch.h"
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+check_watches: //Stops before the next instruction, as if it had a breakpoint
+    if(watch_triggered(vm) == true) {
+        VM_TRAP(INTERRUPT_BREAK);
+    }
+    goto *(ip->handler);
+
+stop:
+    vm->programCounter = (size_t)(ip - program);
+    return (vm->interrupt == INTERRUPT_NONE);
+}
+
+#else //No labels as values - step with the switch dispatch and check after every watched instruction
+
+static bool execute_watched(VirtualMachine *vm) {
+
+    for(;;) {
+        size_t programCounter = vm->programCounter;
+        if(vm->instructionMemory[programCounter].opcode == HALT) {
+            vm->interrupt = INTERRUPT_NONE;
+            return true;
+        }
+        if(execute_step(vm) == false) {
+            return false;
+        }
+        if(writes_watched_register(vm, programCounter) == true && watch_triggered(vm) == true) {
+            vm->interrupt = INTERRUPT_BREAK;
+            return false;
+        }
+    }
+}
+
+#endif
+
+
+
+#if defined(__GNUC__) //GCC and Clang - labels as values
+
+/**
+ * @brief Execute the decoded program with direct threaded dispatch, running hot loops as superblocks.
+ *
+ * Runs on the trace tier's copy of the program. Loop heads are threaded with trace_count, which counts arrivals
+ * and starts recording once the loop is hot. While recording, the handlers are the record_ copy, which passes
+ * every instruction to trace_record before executing it. Once a loop head has a superblock it is threaded with
+ * trace_enter, and the superblock runs on the op_ handlers like the rest of the copy.
+ * Falls back to the threaded engine if the copy could not be allocated.
+ *
+ * @param vm The VM to run.
+ * @return true if the program ran to completion, false if an interrupt was raised.
+ */
+static bool execute_traced(VirtualMachine *vm) {
+
+    static const void *const handlerTable[NUM_INSTRUCTIONS] = VM_THREADED_HANDLERS(op_);
+    static const void *const recordHandlerTable[NUM_INSTRUCTIONS] = VM_THREADED_HANDLERS(record_);
+
+    if(trace_initialise(vm, handlerTable, &&trace_count, &&trace_enter) == false) {
+        return execute_threaded(vm);
+    }
+
+    VM_ENGINE_LOCALS
+    program = vm->trace.program;
+    ip = program + vm->programCounter;
+
+#define VM_CASE(op) op_##op:
+#define VM_NEXT() \
+    ip++; \
+    goto *(ip->handler)
+#define VM_JUMP(target) \
+    ip = program + (target); \
+    goto *(ip->handler)
+
+    goto *(ip->handler);
+
+    #include "intepret_IR_dispatch.h"
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+trace_count: //Loop head without a superblock
+    vm->trace.counters[ip - program]++;
+    if(vm->trace.counters[ip - program] < vm->jitThreshold) {
+        goto *(handlerTable[ip->opcode]);
+    }
+    trace_begin(vm, (size_t)(ip - program));
+    goto record_next;
+
+trace_enter:
+    ip = program + vm->trace.entries[ip - program];
+    goto *(ip->handler);
+
+#define VM_CASE(op) record_##op:
+#define VM_NEXT() \
+    ip++; \
+    goto record_next
+#define VM_JUMP(target) \
+    ip = program + (target); \
+    goto record_next
+
+    #include "intepret_IR_dispatch.h"
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+
+record_next:
+    if(trace_record(vm, (size_t)(ip - program)) == true) {
+        goto *(recordHandlerTable[ip->opcode]);
+    }
+    goto *(ip->handler);
+
+stop:
+    vm->programCounter = trace_program_counter(vm, (size_t)(ip - program));
+    return (vm->interrupt == INTERRUPT_NONE);
+}
+
+#else //No labels as values - nothing to thread superblocks with
+
+static bool execute_traced(VirtualMachine *vm) {
+    return execute_threaded(vm);
+}
+
+#endif
+
+
+
+/**
+ * @brief Set the streams used by INPUT_x and OUTPUT_x.
+ *
+ * @param vm The VM to configure.
+ * @param input Stream read by INPUT_x.
+ * @param output Stream written by OUTPUT_x.
+ */
+void set_VM_streams(VirtualMachine *vm, FILE *input, FILE *output) {
+
+    output_flush(vm);
+    input_release(vm);
+    vm->inputBuffer->start = 0; //Whatever could not be given back belongs to the old stream
+    vm->inputBuffer->end = 0;
+    vm->input = input;
+    vm->output = output;
+    vm->flushLines = (vm->lineBuffered == true || isatty(fileno(output)) == 1);
+    return;
+}
+
+
+/**
+ * @brief Write OUTPUT_x text at every newline instead of in large blocks.
+ *
+ * Output to a terminal is always line buffered. Output is also written before INPUT_x reads, when a paced VM
+ * sleeps and when the run ends, so line buffering is only needed to follow the output of a running program.
+ *
+ * @param vm The VM to configure.
+ * @param lineBuffered true to write the output at every newline.
+ */
+void set_VM_line_buffered(VirtualMachine *vm, bool lineBuffered) {
+
+    vm->lineBuffered = lineBuffered;
+    vm->flushLines = (lineBuffered == true || isatty(fileno(vm->output)) == 1);
+    return;
+}
+
+
+/**
+ * @brief Place RAM directly in front of PROT_NONE guard pages, or move it back onto the heap.
+ *
+ * With guard pages the threaded engine leaves bounds checking to the MMU - an access past the end of RAM faults
+ * and the fault is turned into INTERRUPT_OOB at the instruction that made it. RAM keeps its contents.
+ *
+ * @param vm The VM to configure.
+ * @param guardPages true to enable guard pages, false to disable them.
+ * @return true if RAM was moved, false if the guard region could not be reserved (RAM is left unchanged).
+ */
+bool set_VM_guard_pages(VirtualMachine *vm, bool guardPages) {
+
+    if(guardPages == vm->guardPages) {
+        return true;
+    }
+
+    uint8_t *ramArray = NULL;
+    void *mapping = NULL;
+    size_t mappingSize = 0;
+    if(guardPages == true) {
+        //RAM ends on a page boundary and every 32 bit address (plus the widest access) past it is PROT_NONE
+        size_t padding = RAM_padding(vm->RAMsize);
+        mappingSize = padding + vm->RAMsize + GUARD_SIZE;
+        mapping = mmap(NULL, mappingSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(mapping == MAP_FAILED) {
+            return false;
+        }
+        if(padding + vm->RAMsize != 0 && mprotect(mapping, padding + vm->RAMsize, PROT_READ | PROT_WRITE) != 0) {
+            munmap(mapping, mappingSize);
+            return false;
+        }
+        ramArray = (uint8_t*)mapping + padding;
+    } else {
+        ramArray = (uint8_t*)calloc(vm->RAMsize == 0 ? 1 : vm->RAMsize, sizeof(uint8_t));
+        if(ramArray == NULL) {
+            return false;
+        }
+        mapping = NULL;
+        mappingSize = 0;
+    }
+
+    memcpy(ramArray, vm->ramArray, vm->RAMsize);
+    release_RAM(vm);
+    vm->ramArray = ramArray;
+    vm->ramMapping = mapping;
+    vm->ramMappingSize = mappingSize;
+    vm->guardPages = guardPages;
+
+    return true;
+}
+
+
+/**
+ * @brief Set where the ALLOCATE heap starts in RAM.
+ *
+ * RAM below heapStart is never touched by ALLOCATE/FREE, so programs can keep fixed addresses there. Takes effect
+ * the next time RAM is cleared (the heap header is found at the old start until then).
+ *
+ * @param vm The VM to configure.
+ * @param heapStart First RAM address the heap may use.
+ * @return true if the heap still fits in RAM, false otherwise.
+ */
+bool set_VM_heap_start(VirtualMachine *vm, size_t heapStart) {
+
+    if(heapStart >= vm->RAMsize) {
+        return false;
+    }
+
+    vm->heapStart = heapStart;
+    return true;
+}
+
+
+/**
+ * @brief Print the allocator's state - how much of the heap is in use and how fragmented the free space is.
+ *
+ * Works at any time, including between runs and while a program is stopped.
+ *
+ * @param vm The VM to print.
+ */
+void print_VM_memory_statistics(VirtualMachine *vm) {
+
+    VMHeapStatistics heap;
+    bool valid = heap_statistics(vm, &heap);
+
+    printf("=========Virtual machine heap=========\n");
+    if(heap.initialised == false) {
+        printf("Heap not in use (starts at %zu)\n", vm->heapStart);
+    } else {
+        printf("Heap size:                  %zu bytes (from %zu)\n", heap.heapBytes, vm->heapStart);
+        printf("In use:                     %zu bytes in %zu blocks (peak %zu bytes)\n", heap.usedBytes, heap.usedBlocks, heap.peakUsedBytes);
+        printf("Free:                       %zu bytes in %zu blocks\n", heap.freeBytes, heap.freeBlocks);
+        printf("Largest free block:         %zu bytes\n", heap.largestFreeBlock);
+        printf("Fragmentation:              %.1f%%\n", heap.fragmentation * 100.0);
+        printf("Allocations:                %zu (%zu failed), %zu frees\n", heap.allocations, heap.failedAllocations, heap.frees);
+        if(valid == false) {
+            printf("[VM] Heap block tags are corrupt - the program wrote over allocator memory\n");
+        }
+    }
+    printf("======================================\n");
+
+    return;
+}
+
+
+/**
+ * @brief Set how deeply JAL calls can nest before JAL raises INTERRUPT_STACK.
+ *
+ * The return stack is one contiguous array of depth entries, so calls never allocate. Requested cores get their
+ * own return stack of the same depth.
+ *
+ * @param vm The VM to configure (not while a program is stopped inside a call).
+ * @param depth Maximum number of return addresses on the stack.
+ * @return true if the return stack was resized, false if depth is 0 or it could not be allocated.
+ */
+bool set_VM_call_depth(VirtualMachine *vm, size_t depth) {
+
+    if(depth == 0 || depth > SIZE_MAX / sizeof(uint32_t)) {
+        return false;
+    }
+
+    uint32_t *returnStack = (uint32_t*)realloc(vm->returnStack, depth * sizeof(uint32_t));
+    if(returnStack == NULL) {
+        return false;
+    }
+
+    vm->returnStack = returnStack;
+    vm->returnStackLimit = depth;
+    vm->returnStackDepth = 0;
+    return true;
+}
+
+
+/**
+ * @brief Set the number of cores available to PARALLEL_START.
+ *
+ * @param vm The VM to configure.
+ * @param numCores Number of cores, including core 0 which vm_run starts on.
+ * @return true if the number is valid, false otherwise.
+ */
+bool set_VM_cores(VirtualMachine *vm, size_t numCores) {
+
+    if(numCores == 0 || numCores > UINT16_MAX) {
+        return false;
+    }
+
+    vm->numCores = numCores;
+    return true;
+}
+
+
+/**
+ * @brief Set the number of threads used to decode large IR files.
+ *
+ * Files are only split when each thread would get at least PARALLEL_LOAD_SIZE bytes.
+ *
+ * @param vm The VM to configure.
+ * @param threads Number of loader threads, or 0 for one per core.
+ */
+void set_VM_load_threads(VirtualMachine *vm, size_t threads) {
+
+    vm->loadThreads = threads;
+    return;
+}
+
+
+/**
+ * @brief Set how many times a jump target is reached before the JIT engine compiles it.
+ *
+ * The trace engine uses the same threshold for arrivals at a loop head before recording it.
+ *
+ * @param vm The VM to configure.
+ * @param threshold Jumps before compiling, 0 compiles every target the first time it is reached.
+ */
+void set_VM_JIT_threshold(VirtualMachine *vm, uint32_t threshold) {
+
+    vm->jitThreshold = threshold;
+    return;
+}
+
+
+/**
+ * @brief Enable or disable collecting statistics on the next run.
+ *
+ * While enabled the program runs on the instrumented statistics engine regardless of the selected engine and
+ * clock speed.
+ *
+ * @param vm The VM to configure.
+ * @param collectStatistics true to collect statistics.
+ */
+void set_VM_statistics(VirtualMachine *vm, bool collectStatistics) {
+
+    vm->collectStatistics = collectStatistics;
+    return;
+}
+
+
+/**
+ * @brief Get the IR name of an opcode.
+ *
+ * @param opcode The opcode.
+ * @return The name used in IR files, or "HALT"/"INVALID" for interpreter only opcodes.
+ */
+static const char *opcode_name(uint16_t opcode) {
+
+    //Searched backwards so aliases (REA) lose to the name listed last (LOD)
+    for(size_t i = sizeof(opcodeDefinitions)/sizeof(opcodeDefinitions[0]); i > 0; i--) {
+        if(opcodeDefinitions[i - 1].opcode == opcode) {
+            return opcodeDefinitions[i - 1].name;
+        }
+    }
+
+    return (opcode == HALT ? "HALT" : "INVALID");
+}
+
+
+/**
+ * @brief Find the most used register and instruction of the last run.
+ *
+ * @param vm The VM that ran.
+ * @param mostUsedRegister Where the register is placed.
+ * @param mostUsedOpcode Where the opcode is placed.
+ */
+static void most_used_statistics(VirtualMachine *vm, size_t *mostUsedRegister, uint16_t *mostUsedOpcode) {
+
+    *mostUsedRegister = 0;
+    for(size_t i = 1; i < vm->numRegisters; i++) {
+        if(vm->statistics.registerCounts[i] > vm->statistics.registerCounts[*mostUsedRegister]) {
+            *mostUsedRegister = i;
+        }
+    }
+
+    *mostUsedOpcode = INVALID;
+    for(uint16_t i = 0; i < NUM_INSTRUCTIONS; i++) {
+        if(vm->statistics.opcodeCounts[i] > vm->statistics.opcodeCounts[*mostUsedOpcode]) {
+            *mostUsedOpcode = i;
+        }
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Print the statistics of the last run.
+ *
+ * Does nothing unless statistics were enabled with set_VM_statistics before the run.
+ *
+ * @param vm The VM that ran.
+ */
+void print_VM_statistics(VirtualMachine *vm) {
+
+    if(vm->statistics.registerCounts == NULL) {
+        return;
+    }
+
+    size_t mostUsedRegister = 0;
+    uint16_t mostUsedOpcode = INVALID;
+    most_used_statistics(vm, &mostUsedRegister, &mostUsedOpcode);
+
+    printf("=========Virtual machine statistics=========\n");
+    printf("Instructions executed:      %llu\n", (unsigned long long)vm->statistics.instructions);
+    printf("Branches:                   %llu (%llu taken)\n", (unsigned long long)vm->statistics.branches, (unsigned long long)vm->statistics.branchesTaken);
+    printf("Most used register:         %zu (%llu uses)\n", mostUsedRegister, (unsigned long long)vm->statistics.registerCounts[mostUsedRegister]);
+    printf("Most used instruction:      %s (%llu times)\n", opcode_name(mostUsedOpcode), (unsigned long long)vm->statistics.opcodeCounts[mostUsedOpcode]);
+    printf("Peak memory usage:          %zu bytes\n", vm->statistics.peakMemory);
+    printf("Minimum memory usage:       %zu bytes\n", vm->statistics.minimumMemory);
+    printf("Time to complete:           %f seconds\n", vm->statistics.seconds);
+    printf("============================================\n");
+
+    VMHeapStatistics heap;
+    heap_statistics(vm, &heap);
+    if(heap.initialised == true) {
+        print_VM_memory_statistics(vm);
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Write the statistics of the last run to a JSON file.
+ *
+ * Holds everything print_VM_statistics shows, plus every non zero opcode count and every register count.
+ *
+ * @param vm The VM that ran.
+ * @param fileName The file to write.
+ * @return true if the file was written, false if statistics were not collected or the file could not be written.
+ */
+bool write_VM_statistics_JSON(VirtualMachine *vm, char *fileName) {
+
+    if(vm->statistics.registerCounts == NULL) {
+        return false;
+    }
+
+    FILE *file = fopen(fileName, "w");
+    if(file == NULL) {
+        printf("[VM] Failed to open statistics file '%s'\n", fileName);
+        return false;
+    }
+
+    size_t mostUsedRegister = 0;
+    uint16_t mostUsedOpcode = INVALID;
+    most_used_statistics(vm, &mostUsedRegister, &mostUsedOpcode);
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"instructions\": %llu,\n", (unsigned long long)vm->statistics.instructions);
+    fprintf(file, "  \"branches\": %llu,\n", (unsigned long long)vm->statistics.branches);
+    fprintf(file, "  \"branchesTaken\": %llu,\n", (unsigned long long)vm->statistics.branchesTaken);
+    fprintf(file, "  \"mostUsedRegister\": %zu,\n", mostUsedRegister);
+    fprintf(file, "  \"mostUsedInstruction\": \"%s\",\n", opcode_name(mostUsedOpcode));
+    fprintf(file, "  \"peakMemoryBytes\": %zu,\n", vm->statistics.peakMemory);
+    fprintf(file, "  \"minimumMemoryBytes\": %zu,\n", vm->statistics.minimumMemory);
+    fprintf(file, "  \"seconds\": %f,\n", vm->statistics.seconds);
+    fprintf(file, "  \"interrupt\": %d,\n", (int)vm->interrupt);
+
+    VMHeapStatistics heap;
+    heap_statistics(vm, &heap);
+    fprintf(file, "  \"heap\": {\"usedBytes\": %zu, \"peakUsedBytes\": %zu, \"freeBytes\": %zu, \"largestFreeBlock\": %zu, ", heap.usedBytes, heap.peakUsedBytes, heap.freeBytes, heap.largestFreeBlock);
+    fprintf(file, "\"fragmentation\": %f, \"allocations\": %zu, \"frees\": %zu, \"failedAllocations\": %zu},\n", heap.fragmentation, heap.allocations, heap.frees, heap.failedAllocations);
+
+    fprintf(file, "  \"opcodes\": {");
+    bool first = true;
+    for(uint16_t i = 0; i < NUM_INSTRUCTIONS; i++) {
+        if(vm->statistics.opcodeCounts[i] != 0) {
+            fprintf(file, "%s\"%s\": %llu", (first == true ? "" : ", "), opcode_name(i), (unsigned long long)vm->statistics.opcodeCounts[i]);
+            first = false;
+        }
+    }
+    fprintf(file, "},\n");
+
+    fprintf(file, "  \"registers\": [");
+    for(size_t i = 0; i < vm->numRegisters; i++) {
+        fprintf(file, "%s%llu", (i == 0 ? "" : ", "), (unsigned long long)vm->statistics.registerCounts[i]);
+    }
+    fprintf(file, "]\n");
+    fprintf(file, "}\n");
+
+    bool success = (ferror(file) == 0);
+    fclose(file);
+    return success;
+}
+
+
+/**
+ * @brief Enable or disable the sampling profiler on the next run.
+ *
+ * While enabled the program runs on the profiler engine regardless of the selected engine and clock speed
+ * (statistics take priority if both are enabled).
+ *
+ * @param vm The VM to configure.
+ * @param collectProfile true to profile.
+ */
+void set_VM_profiling(VirtualMachine *vm, bool collectProfile) {
+
+    vm->collectProfile = collectProfile;
+    return;
+}
+
+
+static int compare_uint32(const void *a, const void *b) {
+
+    uint32_t valueA = *(const uint32_t*)a;
+    uint32_t valueB = *(const uint32_t*)b;
+    return (valueA > valueB) - (valueA < valueB);
+}
+
+static int compare_string(const void *a, const void *b) {
+    return strcmp(*(char *const*)a, *(char *const*)b);
+}
+
+
+/**
+ * @brief Append the name of the function enclosing an instruction to a collapsed stack line.
+ *
+ * Functions are the targets of JAL instructions, named by their label. Code before the first function is "entry".
+ *
+ * @param vm The VM that ran.
+ * @param line Where the name is appended.
+ * @param functions Sorted start address of every function.
+ * @param numFunctions Number of functions.
+ * @param address The instruction.
+ */
+static void append_function_name(VirtualMachine *vm, char *line, const uint32_t *functions, size_t numFunctions, uint32_t address) {
+
+    //Greatest function start <= address
+    size_t low = 0;
+    size_t high = numFunctions;
+    while(low < high) {
+        size_t middle = low + (high - low) / 2;
+        if(functions[middle] <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if(low == 0) {
+        strcat(line, "entry");
+        return;
+    }
+    uint32_t start = functions[low - 1];
+
+    //Label defined at that address
+    low = 0;
+    high = vm->numLabels;
+    while(low < high) {
+        size_t middle = low + (high - low) / 2;
+        if(vm->labels[middle].address < start) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    char name[32];
+    if(low < vm->numLabels && vm->labels[low].address == start) {
+        snprintf(name, sizeof(name), "label_%zu", vm->labels[low].labelID);
+    } else {
+        snprintf(name, sizeof(name), "instruction_%u", start);
+    }
+    strcat(line, name);
+
+    return;
+}
+
+
+/**
+ * @brief Write the samples of the last profiled run in collapsed stack format.
+ *
+ * One line per distinct call stack: enclosing functions from outermost to innermost separated by ';', followed by
+ * the number of samples - the input format of flamegraph.pl and similar tools.
+ *
+ * @param vm The VM that ran.
+ * @param fileName The file to write.
+ * @return true if the file was written, false if no profile was collected or the file could not be written.
+ */
+bool write_VM_profile(VirtualMachine *vm, char *fileName) {
+
+    VMProfile *profile = &(vm->profile);
+    if(vm->collectProfile == false || vm->instructionMemory == NULL) {
+        return false;
+    }
+
+    //Function starts are the distinct JAL targets
+    size_t numFunctions = 0;
+    uint32_t *functions = (uint32_t*)malloc((vm->numInstructions + 1) * sizeof(uint32_t));
+    char **lines = (char**)calloc(profile->numSamples + 1, sizeof(char*));
+    bool success = false;
+    if(functions == NULL || lines == NULL) {
+        goto cleanup;
+    }
+    for(size_t i = 0; i < vm->numInstructions; i++) {
+        if(vm->instructionMemory[i].opcode == JAL) {
+            functions[numFunctions] = vm->instructionMemory[i].ARG3.label;
+            numFunctions++;
+        }
+    }
+    qsort(functions, numFunctions, sizeof(uint32_t), compare_uint32);
+
+    //One line per sample, sorted so identical stacks are adjacent
+    size_t offset = 0;
+    for(size_t i = 0; i < profile->numSamples; i++) {
+        uint32_t frames = profile->samples[offset];
+        lines[i] = (char*)malloc((frames + 1) * 48 + 1);
+        if(lines[i] == NULL) {
+            goto cleanup;
+        }
+        lines[i][0] = '\0';
+        for(uint32_t j = 1; j <= frames + 1; j++) {
+            append_function_name(vm, lines[i], functions, numFunctions, profile->samples[offset + j]);
+            if(j <= frames) {
+                strcat(lines[i], ";");
+            }
+        }
+        offset += frames + 2;
+    }
+    qsort(lines, profile->numSamples, sizeof(char*), compare_string);
+
+    FILE *file = fopen(fileName, "w");
+    if(file == NULL) {
+        printf("[VM] Failed to open profile file '%s'\n", fileName);
+        goto cleanup;
+    }
+    for(size_t i = 0; i < profile->numSamples;) {
+        size_t count = 1;
+        while(i + count < profile->numSamples && strcmp(lines[i], lines[i + count]) == 0) {
+            count++;
+        }
+        fprintf(file, "%s %zu\n", lines[i], count);
+        i += count;
+    }
+    success = (ferror(file) == 0);
+    fclose(file);
+
+cleanup:
+    if(lines != NULL) {
+        for(size_t i = 0; i < profile->numSamples; i++) {
+            free(lines[i]);
+        }
+    }
+    free(lines);
+    free(functions);
+    return success;
+}
+
+
+/**
+ * @brief Select the engine used by vm_run.
+ *
+ * All engines produce identical results, this exists so they can be compared against each other. The engine is
+ * only used when the VM is unthrottled and not collecting statistics or a profile.
+ *
+ * @param vm The VM to configure.
+ * @param engine The engine to use.
+ * @return true if the engine is valid, false otherwise.
+ */
+bool set_VM_engine(VirtualMachine *vm, VM_ENGINE engine) {
+
+    if(engine != VM_ENGINE_SWITCH && engine != VM_ENGINE_THREADED && engine != VM_ENGINE_JIT && engine != VM_ENGINE_TRACE) {
+        return false;
+    }
+
+    vm->engine = engine;
+    return true;
+}
+
+
+
+/**
+ * @brief Check that a section of count entries of size bytes at offset lies inside a file, without overflowing.
+ */
+static inline bool bytecode_section_fits(uint64_t offset, uint64_t count, size_t size, size_t length) {
+    return (offset <= length && count <= (length - offset) / size);
+}
+
+
+/**
+ * @brief Operand format of an opcode as stored in instruction memory (after width specialisation and fusion).
+ *
+ * @param opcode Any opcode.
+ * @param format Where the format is placed.
+ * @return false for opcodes that never appear in a decoded program (INVALID, BREAK, HALT, out of range).
+ */
+static bool stored_operand_format(uint16_t opcode, OPERAND_FORMAT *format) {
+
+    switch(opcode) {
+        case STR_1: case STR_2: case STR_4: case LOD_1: case LOD_2: case LOD_4:
+            *format = FORMAT_REG_REG_ITEMS;
+            return true;
+        default:
+            break;
+    }
+
+    opcode = unfused_opcode(opcode);
+    for(size_t i = 0; i < sizeof(opcodeDefinitions)/sizeof(opcodeDefinitions[0]); i++) {
+        if(opcodeDefinitions[i].opcode == opcode) {
+            *format = opcodeDefinitions[i].format;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief Check every instruction of a bytecode file before it is executed in place.
+ *
+ * Handlers index registers, jump to labels and look up handler tables with the stored operands unchecked, so
+ * anything the preprocessor would have rejected must be rejected here (the file may have been edited or
+ * damaged since write_VM_bytecode produced it).
+ *
+ * @param vm The VM the program is loaded onto.
+ * @param instructions The mapped instruction array, closing HALT included.
+ * @param numInstructions Number of instructions, excluding the HALT.
+ * @return Index of the first invalid instruction, or numInstructions if every instruction is valid.
+ */
+static size_t validate_bytecode_instructions(VirtualMachine *vm, const Instruction *instructions, size_t numInstructions) {
+
+    for(size_t i = 0; i < numInstructions; i++) {
+
+        const Instruction *instruction = &(instructions[i]);
+        OPERAND_FORMAT format = FORMAT_NONE;
+        if(instruction->opcode >= NUM_INSTRUCTIONS || stored_operand_format(instruction->opcode, &format) == false) {
+            return i;
+        }
+
+        bool valid = true;
+        switch(format) {
+            case FORMAT_NONE:
+            case FORMAT_ID:
+                break;
+            case FORMAT_REG:
+                valid = (instruction->ARG1 < vm->numRegisters);
+                break;
+            case FORMAT_LABEL:
+                valid = (instruction->ARG3.label <= numInstructions);
+                break;
+            case FORMAT_REG_REG:
+            case FORMAT_REG_REG_INT:
+            case FORMAT_REG_REG_FLOAT:
+                valid = (instruction->ARG1 < vm->numRegisters && instruction->ARG2 < vm->numRegisters);
+                break;
+            case FORMAT_REG_REG_REG:
+                valid = (instruction->ARG1 < vm->numRegisters && instruction->ARG2 < vm->numRegisters
+                && instruction->ARG3.reg < vm->numRegisters);
+                break;
+            case FORMAT_REG_REG_ITEMS:
+                valid = (instruction->ARG1 < vm->numRegisters && instruction->ARG2 < vm->numRegisters
+                && instruction->ARG3.items >= 1 && instruction->ARG3.items <= sizeof(DataTypes));
+                break;
+            case FORMAT_REG_REG_LABEL:
+                valid = (instruction->ARG1 < vm->numRegisters && instruction->ARG2 < vm->numRegisters
+                && instruction->ARG3.label <= numInstructions);
+                break;
+        }
+
+        //PARALLEL_START continues after its PARALLEL_STOP (resolved by match_parallel_blocks)
+        if(instruction->opcode == PARALLEL_START) {
+            valid = (instruction->ARG3.label <= numInstructions);
+        }
+
+        //A superinstruction executes the next instruction's operands as the pair it was fused from
+        uint16_t second = HALT;
+        switch(instruction->opcode) {
+            case ADI_GRT: second = GRT; break;
+            case ADI_GRE: second = GRE; break;
+            case ADI_LTE: second = LTE; break;
+            case ADI_LES: second = LES; break;
+            case ADI_EQU: second = EQU; break;
+            case ADI_NEQ: second = NEQ; break;
+            case MUL_ADD: second = ADD; break;
+            case MUL_ADD_F: second = ADD_F; break;
+            default: break;
+        }
+        if(second != HALT && (i + 1 == numInstructions || instructions[i + 1].opcode != second)) {
+            valid = false;
+        }
+
+        if(valid == false) {
+            return i;
+        }
+    }
+
+    return numInstructions;
+}
+
+
+/**
+ * @brief Load a program from a mapped bytecode (.jbc) file.
+ *
+ * The instruction array is used in place - the mapping becomes the VM's instruction memory. The mapping is
+ * private and writable so the threaded engine can store handler addresses, which only copies the pages it
+ * touches. The file is not trusted: the header, every instruction and every label are validated first.
+ *
+ * @param vm The VM to load the program onto.
+ * @param mapping The mapped file.
+ * @param length Length of the file in bytes.
+ * @param debug If true, prints debugging information.
+ * @return true if the file is valid bytecode for this VM, false otherwise.
+ */
+static bool load_bytecode(VirtualMachine *vm, void *mapping, size_t length, bool debug) {
+
+    BytecodeHeader *header = (BytecodeHeader*)mapping;
+
+    if(header->version != BYTECODE_VERSION || header->byteOrder != BYTECODE_BYTE_ORDER
+    || header->instructionSize != sizeof(Instruction)) {
+        printf("[VM] Bytecode was produced by an incompatible VM\n");
+        return false;
+    }
+    if(header->numRegisters > vm->numRegisters) {
+        printf("[VM] Bytecode needs %llu registers but the VM has %zu\n",(unsigned long long)header->numRegisters, vm->numRegisters);
+        return false;
+    }
+    if(header->instructionOffset % BYTECODE_ALIGNMENT != 0
+    || header->numInstructions >= UINT32_MAX
+    || bytecode_section_fits(header->instructionOffset, header->numInstructions + 1, sizeof(Instruction), length) == false
+    || header->labelOffset % sizeof(uint64_t) != 0
+    || bytecode_section_fits(header->labelOffset, header->numLabels, sizeof(BytecodeLabel), length) == false
+    || bytecode_section_fits(header->constantOffset, header->numConstants, sizeof(DataTypes), length) == false) {
+        printf("[VM] Bytecode file is truncated\n");
+        return false;
+    }
+
+    Instruction *instructions = (Instruction*)((char*)mapping + header->instructionOffset);
+    size_t numInstructions = (size_t)header->numInstructions;
+    size_t invalid = validate_bytecode_instructions(vm, instructions, numInstructions);
+    if(instructions[numInstructions].opcode != HALT || invalid != numInstructions) {
+        printf("[VM] Bytecode file is corrupt (instruction %zu)\n", invalid);
+        return false;
+    }
+
+
+    //Labels are kept sorted by address (the debugger and profiler search them) and must point into the program
+    BytecodeLabel *fileLabels = (BytecodeLabel*)((char*)mapping + header->labelOffset);
+    for(size_t i = 0; i < header->numLabels; i++) {
+        if(fileLabels[i].address > numInstructions || (i > 0 && fileLabels[i].address < fileLabels[i - 1].address)) {
+            printf("[VM] Bytecode file is corrupt (label %zu)\n", i);
+            return false;
+        }
+    }
+
+    Label *labels = (Label*)malloc(sizeof(Label) * (header->numLabels + 1));
+    if(labels == NULL) {
+        return false;
+    }
+    for(size_t i = 0; i < header->numLabels; i++) {
+        labels[i].labelID = (size_t)fileLabels[i].labelID;
+        labels[i].address = (size_t)fileLabels[i].address;
+    }
+
+
+    release_program(vm);
+    vm->programMapping = mapping;
+    vm->programMappingSize = length;
+    vm->instructionMemory = instructions;
+    vm->numInstructions = (size_t)header->numInstructions;
+    vm->labels = labels;
+    vm->numLabels = (size_t)header->numLabels;
+
+    if(debug == true) {
+        printf("[VM - DEBUG] Mapped %zu instructions and %zu labels from bytecode\n",vm->numInstructions, vm->numLabels);
+    }
+    return true;
+}
+
+
+/**
+ * @brief Open and map a program file, then load it as bytecode or IR depending on its contents.
+ *
+ * @param vm The VM to load the program onto.
+ * @param fileName The IR or bytecode file.
+ * @param debug If true, prints debugging information.
+ * @return true if the program was loaded, false otherwise.
+ */
+static bool load_file(VirtualMachine *vm, char *fileName, bool debug) {
+
+    //Debug is used to print what the VM is doing
+    //input filename for source file
+    if(fileName == NULL || vm->registerArray == NULL) {
+        return false;
+    }
+    int fileDescriptor = open(fileName, O_RDONLY);
+    struct stat fileStatus;
+    if(fileDescriptor < 0 || fstat(fileDescriptor, &fileStatus) != 0) {
+
+        if(debug == true) {
+            printf("[VM - DEBUG] FAILED to open: %s\n",fileName);
+        }
+        if(fileDescriptor >= 0) {
+            close(fileDescriptor);
+        }
+
+        return false;
+    }
+
+    if(debug == true) {
+        printf("[VM - DEBUG] Opened: %s\n",fileName);
+    }
+
+
+    //Map the file instead of reading it - the preprocessor scans the mapped bytes directly
+    //Private and writable so bytecode can be executed in place (pages are only copied if written)
+    size_t fileSize = (size_t)fileStatus.st_size;
+    char *fileContents = NULL;
+    if(fileSize > 0) {
+        fileContents = (char*)mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileDescriptor, 0);
+        if(fileContents == MAP_FAILED) {
+            if(debug == true) {
+                printf("[VM - DEBUG] FAILED to map: %s\n",fileName);
+            }
+            close(fileDescriptor);
+            return false;
+        }
+    }
+    close(fileDescriptor); //Mapping stays valid after the descriptor is closed
+
+
+    if(fileSize >= sizeof(BytecodeHeader) && memcmp(fileContents, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC)) == 0) {
+        if(load_bytecode(vm, fileContents, fileSize, debug) == false) {
+            munmap(fileContents, fileSize);
+            return false;
+        }
+        return true; //Mapping now belongs to the VM
+    }
+
+
+    if(fileContents != NULL) {
+        madvise(fileContents, fileSize, MADV_SEQUENTIAL);
+    }
+    bool loaded = load_IR(vm, fileContents, fileSize, debug);
+    if(fileContents != NULL) {
+        munmap(fileContents, fileSize);
+    }
+
+    return loaded;
+}
+
+
+/**
+ * @brief Write the program loaded on a VM as a bytecode (.jbc) file.
+ *
+ * @param vm The VM holding the program.
+ * @param fileName The file to write.
+ * @return true if the whole file was written, false otherwise.
+ */
+static bool write_bytecode(VirtualMachine *vm, char *fileName) {
+
+    BytecodeHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC));
+    header.version = BYTECODE_VERSION;
+    header.byteOrder = BYTECODE_BYTE_ORDER;
+    header.instructionSize = sizeof(Instruction);
+    header.numRegisters = vm->numRegisters;
+    header.numInstructions = vm->numInstructions;
+    header.instructionOffset = (sizeof(BytecodeHeader) + BYTECODE_ALIGNMENT - 1) / BYTECODE_ALIGNMENT * BYTECODE_ALIGNMENT;
+    header.numLabels = vm->numLabels;
+    header.labelOffset = header.instructionOffset + (vm->numInstructions + 1) * sizeof(Instruction);
+    header.numConstants = 0;
+    header.constantOffset = header.labelOffset + vm->numLabels * sizeof(BytecodeLabel);
+
+    FILE *fptr = fopen(fileName, "wb");
+    if(fptr == NULL) {
+        return false;
+    }
+
+    bool success = (fwrite(&header, sizeof(header), 1, fptr) == 1);
+
+    char padding[BYTECODE_ALIGNMENT] = {0};
+    success = success && (fwrite(padding, 1, header.instructionOffset - sizeof(header), fptr) == header.instructionOffset - sizeof(header));
+
+    for(size_t i = 0; i <= vm->numInstructions && success == true; i++) {
+        Instruction instruction = vm->instructionMemory[i];
+        instruction.handler = NULL; //Only valid in this process
+        success = (fwrite(&instruction, sizeof(instruction), 1, fptr) == 1);
+    }
+
+    for(size_t i = 0; i < vm->numLabels && success == true; i++) {
+        BytecodeLabel label = {vm->labels[i].labelID, vm->labels[i].address};
+        success = (fwrite(&label, sizeof(label), 1, fptr) == 1);
+    }
+
+    if(fclose(fptr) != 0) {
+        success = false;
+    }
+    return success;
+}
+
+
+/**
+ * @brief Decode an IR file and write it as a bytecode (.jbc) file without running it.
+ *
+ * Bytecode files can be passed to vm_load in place of IR and are mapped and executed without being parsed.
+ * The VM must be initialised with at least as many registers as the program uses.
+ *
+ * @param vm The VM to decode the IR with (its loaded program is replaced).
+ * @param IRfileName The IR file to decode.
+ * @param bytecodeFileName The bytecode file to write.
+ * @param debug If true, prints debugging information.
+ * @return true if the IR was decoded and the bytecode written, false otherwise.
+ */
+bool convert_IR_to_bytecode(VirtualMachine *vm, char *IRfileName, char *bytecodeFileName, bool debug) {
+
+    if(bytecodeFileName == NULL || load_file(vm, IRfileName, debug) == false) {
+        return false;
+    }
+
+    if(write_bytecode(vm, bytecodeFileName) == false) {
+        printf("[VM] FAILED to write bytecode: %s\n",bytecodeFileName);
+        return false;
+    }
+
+    if(debug == true) {
+        printf("[VM - DEBUG] Wrote bytecode: %s\n",bytecodeFileName);
+    }
+    return true;
+}
+
+
+/**
+ * @brief Load an intermediate representation (IR) or bytecode file onto the virtual machine.
+ *
+ * IR files are decoded line by line into instruction memory. A pass is performed on the file first to put
+ * it into an instruction array, where each index in the array acts as an index into the instruction memory.
+ * This approach allows labels to be defined in a table (Label name -> jump address) and resolved before
+ * execution starts. Bytecode files (see convert_IR_to_bytecode) are mapped and executed without decoding.
+ * Any program already loaded is replaced.
+ *
+ * @param vm The VM to load the program onto.
+ * @param fileName The name of the IR or bytecode file to load.
+ * @param debug If true, prints debugging information.
+ * @return true if the file was successfully opened and decoded, false otherwise.
+ */
+bool vm_load(VirtualMachine *vm, char *fileName, bool debug) {
+
+    //In instruction IR file all have the form OPERATION|||argument1|||argument2|||argument3|||
+    //Irregardless of r i or j instruction
+
+    return load_file(vm, fileName, debug);
+}
+
+
+/*
+ * Debugger support
+ * ----------------
+ * Breakpoints cost nothing while the program runs: the instruction at a breakpoint is patched with BREAK, whose
+ * handler stops the engine with INTERRUPT_BREAK. debugOpcodes keeps every instruction's real opcode so patches
+ * can be undone, and vm_break patches every instruction at once so a running program can be stopped wherever it is.
+ */
+
+/**
+ * @brief Change the opcode of one instruction, keeping its threaded handler in step.
+ *
+ * @param vm The VM holding the program.
+ * @param index The instruction.
+ * @param opcode The new opcode.
+ */
+static void patch_opcode(VirtualMachine *vm, size_t index, uint16_t opcode) {
+
+    vm->instructionMemory[index].opcode = opcode;
+    if(vm->handlerTable != NULL) {
+        vm->instructionMemory[index].handler = vm->handlerTable[opcode];
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Undo a vm_break - every instruction goes back to its real opcode, or BREAK if it has a breakpoint.
+ *
+ * @param vm The VM being debugged.
+ */
+static void clear_break_request(VirtualMachine *vm) {
+
+    if(vm->breakRequested == 0 || vm->debugOpcodes == NULL) {
+        return;
+    }
+
+    for(size_t i = 0; i < vm->numInstructions; i++) {
+        patch_opcode(vm, i, (vm->breakpoints[i] == true ? BREAK : vm->debugOpcodes[i]));
+    }
+    vm->breakRequested = 0;
+
+    return;
+}
+
+
+/**
+ * @brief Prepare the loaded program for breakpoints, or remove every breakpoint.
+ *
+ * While debugging, the JIT engine is replaced by the threaded engine (compiled blocks would run past a BREAK).
+ * Loading another program ends debugging.
+ *
+ * @param vm The VM to configure.
+ * @param debugging true to start debugging, false to stop.
+ * @return true on success, false if no program is loaded or memory could not be allocated.
+ */
+bool set_VM_debugging(VirtualMachine *vm, bool debugging) {
+
+    if(vm->instructionMemory == NULL) {
+        return false;
+    }
+
+    if(debugging == false) {
+        if(vm->debugOpcodes != NULL) {
+            for(size_t i = 0; i < vm->numInstructions; i++) {
+                patch_opcode(vm, i, vm->debugOpcodes[i]);
+            }
+        }
+        free(vm->debugOpcodes);
+        free(vm->breakpoints);
+        vm->debugOpcodes = NULL;
+        vm->breakpoints = NULL;
+        vm->breakRequested = 0;
+        clear_VM_watches(vm, SIZE_MAX);
+        return true;
+    }
+
+    if(vm->debugOpcodes != NULL) {
+        return true;
+    }
+    uint16_t *debugOpcodes = (uint16_t*)malloc((vm->numInstructions + 1) * sizeof(uint16_t));
+    bool *breakpoints = (bool*)calloc(vm->numInstructions + 1, sizeof(bool));
+    if(debugOpcodes == NULL || breakpoints == NULL) {
+        free(debugOpcodes);
+        free(breakpoints);
+        return false;
+    }
+    for(size_t i = 0; i <= vm->numInstructions; i++) {
+        debugOpcodes[i] = vm->instructionMemory[i].opcode;
+    }
+    vm->breakRequested = 0;
+    vm->breakpoints = breakpoints;
+    vm->debugOpcodes = debugOpcodes; //Last - vm_break may run from a signal handler
+
+    return true;
+}
+
+
+/**
+ * @brief Set or remove a breakpoint - the VM stops with INTERRUPT_BREAK before executing the instruction.
+ *
+ * A superinstruction ending on the instruction is split back into its first half for the rest of the debugging
+ * session, otherwise it would execute the instruction without reaching the BREAK.
+ *
+ * @param vm The VM being debugged (see set_VM_debugging).
+ * @param index The instruction.
+ * @param enabled true to set the breakpoint, false to remove it.
+ * @return true on success, false if the VM is not being debugged or there is no such instruction.
+ */
+bool set_VM_breakpoint(VirtualMachine *vm, size_t index, bool enabled) {
+
+    if(vm->debugOpcodes == NULL || index >= vm->numInstructions) {
+        return false;
+    }
+
+    if(enabled == true && index > 0 && unfused_opcode(vm->debugOpcodes[index - 1]) != vm->debugOpcodes[index - 1]) {
+        vm->debugOpcodes[index - 1] = unfused_opcode(vm->debugOpcodes[index - 1]);
+        if(vm->breakpoints[index - 1] == false) {
+            patch_opcode(vm, index - 1, vm->debugOpcodes[index - 1]);
+        }
+    }
+
+    vm->breakpoints[index] = enabled;
+    patch_opcode(vm, index, (enabled == true ? BREAK : vm->debugOpcodes[index]));
+
+    return true;
+}
+
+
+/**
+ * @brief Stop the VM when a register is written and then meets a condition.
+ *
+ * The VM stops with INTERRUPT_BREAK before the instruction after the write. The condition is checked every time
+ * the register is written while it holds, not only when it first becomes true. Only core 0 is watched, and
+ * statistics, profiling and pacing are ignored while any watch is set.
+ *
+ * @param vm The VM to watch.
+ * @param reg The register.
+ * @param comparison How the register is compared with value.
+ * @param isFloat Compare the register as a float rather than an integer.
+ * @param value The value compared with.
+ * @return true if the watch was set, false if the register does not exist or memory could not be allocated.
+ */
+bool set_VM_watch(VirtualMachine *vm, size_t reg, VM_WATCH_COMPARISON comparison, bool isFloat, double value) {
+
+    if(reg >= vm->numRegisters || comparison > VM_WATCH_NOT_EQUAL) {
+        return false;
+    }
+
+    VMWatch *watches = (VMWatch*)realloc(vm->watches, (vm->numWatches + 1) * sizeof(VMWatch));
+    if(watches == NULL) {
+        return false;
+    }
+    vm->watches = watches;
+
+    VMWatch *watch = &(watches[vm->numWatches]);
+    watch->reg = (uint16_t)reg;
+    watch->predicate = watchPredicates[isFloat == true ? 1 : 0][comparison];
+    watch->comparison = comparison;
+    watch->isFloat = isFloat;
+    if(isFloat == true) {
+        watch->operand.floatVal = (FLOAT_TYPE)value;
+    } else {
+        watch->operand.intVal = (INT_TYPE)value;
+    }
+    vm->numWatches++;
+
+    return true;
+}
+
+
+/**
+ * @brief Remove the watches on a register.
+ *
+ * @param vm The VM.
+ * @param reg The register, or SIZE_MAX for every register.
+ */
+void clear_VM_watches(VirtualMachine *vm, size_t reg) {
+
+    size_t kept = 0;
+    for(size_t i = 0; i < vm->numWatches; i++) {
+        if(reg != SIZE_MAX && vm->watches[i].reg != reg) {
+            vm->watches[kept] = vm->watches[i];
+            kept++;
+        }
+    }
+    vm->numWatches = kept;
+    if(kept == 0) {
+        free(vm->watches);
+        vm->watches = NULL;
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Stop a running VM at the next instruction it executes (async-signal-safe, e.g. from a SIGINT handler).
+ *
+ * Every instruction is patched with BREAK, so no engine polls for the request. The patches are undone once the
+ * VM has stopped. Only core 0 is stopped - a requested core that reaches a BREAK raises INTERRUPT_BREAK instead.
+ *
+ * @param vm The VM being debugged (see set_VM_debugging) - nothing happens otherwise.
+ */
+void vm_break(VirtualMachine *vm) {
+
+    if(vm->debugOpcodes == NULL) {
+        return;
+    }
+
+    vm->breakRequested = 1;
+    for(size_t i = 0; i < vm->numInstructions; i++) {
+        patch_opcode(vm, i, BREAK);
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Execute the instruction at the program counter, even if it has a breakpoint.
+ *
+ * Multi-core programs wait for every requested core to stop after each step.
+ *
+ * @param vm The VM to run.
+ * @param debug If true, prints debugging information.
+ * @return true if the instruction completed (or the program had already ended), false if an interrupt was raised.
+ */
+bool vm_step(VirtualMachine *vm, bool debug) {
+
+    if(vm->instructionMemory == NULL) {
+        printf("[VM] No program loaded\n");
+        return false;
+    }
+
+    clear_break_request(vm);
+    vm->interrupt = INTERRUPT_NONE;
+    vm->triggeredWatch = SIZE_MAX;
+    size_t programCounter = vm->programCounter;
+    bool patched = (vm->debugOpcodes != NULL && vm->instructionMemory[programCounter].opcode == BREAK);
+    if(patched == true) {
+        patch_opcode(vm, programCounter, vm->debugOpcodes[programCounter]);
+    }
+
+    bool result = false;
+    if(setup_cores(vm) == false) {
+        printf("[VM] Failed to allocate %zu cores\n", vm->numCores);
+        vm->interrupt = INTERRUPT_CORE;
+    } else {
+        result = finish_cores(vm, execute_step(vm));
+    }
+    if(patched == true) {
+        patch_opcode(vm, programCounter, BREAK);
+    }
+    output_flush(vm);
+    input_release(vm);
+
+    if(result == false && debug == true) {
+        printf("[VM - DEBUG] Interrupt %d raised at instruction %zu\n",vm->interrupt, vm->programCounter);
+    }
+
+    return result;
+}
+
+
+/**
+ * @brief Print one instruction as IR - labels are shown as the label defined there, or @index if there is none.
+ *
+ * Superinstructions are shown as their first half, breakpoints as the instruction they replace.
+ *
+ * @param vm The VM holding the program.
+ * @param index The instruction.
+ */
+void print_VM_instruction(VirtualMachine *vm, size_t index) {
+
+    if(vm->instructionMemory == NULL || index > vm->numInstructions) {
+        printf("[VM] No instruction %zu\n", index);
+        return;
+    }
+
+    Instruction *instruction = &(vm->instructionMemory[index]);
+    uint16_t opcode = unfused_opcode(vm->debugOpcodes != NULL ? vm->debugOpcodes[index] : instruction->opcode);
+    switch(opcode) {
+        case STR_1: case STR_2: case STR_4:
+            opcode = STR;
+            break;
+        case LOD_1: case LOD_2: case LOD_4:
+            opcode = LOD;
+            break;
+        default:
+            break;
+    }
+
+    const OpcodeDefinition *definition = NULL;
+    for(size_t i = sizeof(opcodeDefinitions)/sizeof(opcodeDefinitions[0]); i > 0 && definition == NULL; i--) {
+        if(opcodeDefinitions[i - 1].opcode == opcode) { //Searched backwards so aliases (REA) lose to LOD
+            definition = &(opcodeDefinitions[i - 1]);
+        }
+    }
+    if(definition == NULL) {
+        printf("%6zu: HALT\n", index);
+        return;
+    }
+
+    //Label operands were resolved to instruction indices - show the label defined there
+    char label[32] = "";
+    if(definition->format == FORMAT_LABEL || definition->format == FORMAT_REG_REG_LABEL) {
+        snprintf(label, sizeof(label), "@%u", instruction->ARG3.label);
+        for(size_t i = 0; i < vm->numLabels; i++) {
+            if(vm->labels[i].address == instruction->ARG3.label) {
+                snprintf(label, sizeof(label), "%zu", vm->labels[i].labelID);
+                break;
+            }
+        }
+    }
+
+    printf("%6zu: %s|||", index, definition->name);
+    switch(definition->format) {
+        case FORMAT_NONE:
+            break;
+        case FORMAT_REG:
+        case FORMAT_ID:
+            printf("%u|||", instruction->ARG1);
+            break;
+        case FORMAT_LABEL:
+            printf("%s|||", label);
+            break;
+        case FORMAT_REG_REG:
+            printf("%u|||%u|||", instruction->ARG1, instruction->ARG2);
+            break;
+        case FORMAT_REG_REG_REG:
+            printf("%u|||%u|||%u|||", instruction->ARG1, instruction->ARG2, instruction->ARG3.reg);
+            break;
+        case FORMAT_REG_REG_INT:
+            printf("%u|||%u|||%d|||", instruction->ARG1, instruction->ARG2, instruction->ARG3.intImmediate);
+            break;
+        case FORMAT_REG_REG_FLOAT:
+            printf("%u|||%u|||%f|||", instruction->ARG1, instruction->ARG2, instruction->ARG3.floatImmediate);
+            break;
+        case FORMAT_REG_REG_ITEMS:
+            printf("%u|||%u|||%u|||", instruction->ARG1, instruction->ARG2, instruction->ARG3.items);
+            break;
+        case FORMAT_REG_REG_LABEL:
+            printf("%u|||%u|||%s|||", instruction->ARG1, instruction->ARG2, label);
+            break;
+    }
+    printf("%s\n", (vm->breakpoints != NULL && vm->breakpoints[index] == true ? "    <breakpoint>" : ""));
+
+    return;
+}
+
+
+/**
+ * @brief Execute the loaded program from the VM's program counter with the selected engine.
+ *
+ * @param vm The VM to run - its return stack must be initialised.
+ * @param debug If true, prints debugging information.
+ * @return true if the program ran to completion, false if an interrupt was raised.
+ */
+static bool execute_program(VirtualMachine *vm, bool debug) {
+
+    clear_break_request(vm);
+    vm->interrupt = INTERRUPT_NONE;
+    if(setup_cores(vm) == false) {
+        printf("[VM] Failed to allocate %zu cores\n", vm->numCores);
+        vm->returnStackDepth = 0;
+        return false;
+    }
+
+    bool result = false;
+    vm->triggeredWatch = SIZE_MAX;
+    if(vm->numWatches != 0) { //Watches need their own copy of the handlers
+        result = execute_watched(vm);
+    } else if(vm->collectStatistics == true) {
+        result = execute_statistics(vm);
+    } else if(vm->collectProfile == true) {
+        result = execute_profiled(vm);
+    } else if(vm->instructionsPerSecond != VM_UNTHROTTLED) { //Pacing always uses the switch dispatch
+        result = execute_paced(vm);
+    } else if(vm->engine == VM_ENGINE_SWITCH) {
+        result = execute_switch(vm);
+    } else if(vm->engine == VM_ENGINE_JIT && vm->debugOpcodes == NULL) { //Compiled blocks would run past a BREAK
+        result = execute_jit(vm);
+    } else if(vm->engine == VM_ENGINE_TRACE && vm->debugOpcodes == NULL) { //Superblocks are copies without BREAK
+        result = execute_traced(vm);
+    } else if(vm->guardPages == true) { //Guard pages replace the threaded engine's bounds checks
+        result = execute_guarded(vm);
+    } else {
+        result = execute_threaded(vm);
+    }
+    result = finish_cores(vm, result);
+    clear_break_request(vm);
+    if(vm->interrupt != INTERRUPT_BREAK) { //Kept so the program can continue from the break
+        vm->returnStackDepth = 0;
+    }
+    output_flush(vm);
+    input_release(vm);
+
+    if(result == false && debug == true) {
+        printf("[VM - DEBUG] Interrupt %d raised at instruction %zu\n",vm->interrupt, vm->programCounter);
+    }
+
+    return result;
+}
+
+
+/**
+ * @brief Run the program loaded on the virtual machine from its first instruction.
+ *
+ * Registers and RAM keep their values from any previous run. The debug flag can be used to print what the VM
+ * is doing. If an error occurs, such as an out-of-bounds access in the VM memory, the corresponding interrupt
+ * flag is set and the function returns false. If debug mode is enabled, error messages are printed.
+ *
+ * @param vm The VM to run.
+ * @param debug If true, prints debugging information.
+ * @return true if the program ran to completion, false if nothing is loaded or an interrupt was raised.
+ */
+bool vm_run(VirtualMachine *vm, bool debug) {
+
+    if(vm->instructionMemory == NULL) {
+        printf("[VM] No program loaded\n");
+        return false;
+    }
+
+    vm->programCounter = 0;
+    vm->returnStackDepth = 0; //Left by a run stopped at a breakpoint
+    return execute_program(vm, debug);
+}
+
+
+/**
+ * @brief Run the program loaded on the virtual machine from the state set by vm_restore, or from where a
+ * breakpoint stopped it.
+ *
+ * @param vm The VM to run.
+ * @param debug If true, prints debugging information.
+ * @return true if the program ran to completion, false if nothing is loaded or an interrupt was raised.
+ */
+bool vm_continue(VirtualMachine *vm, bool debug) {
+
+    if(vm->instructionMemory == NULL) {
+        printf("[VM] No program loaded\n");
+        return false;
+    }
+
+    //Stopped on a breakpoint - run the instruction under it before the BREAK can trap again
+    if(vm->debugOpcodes != NULL && vm->programCounter < vm->numInstructions
+    && vm->breakpoints[vm->programCounter] == true && vm_step(vm, debug) == false) {
+        return false;
+    }
+
+    return execute_program(vm, debug);
+}
+
+
+
+/**
+ * @brief Run the loaded program from its first instruction until it reaches a label, and capture the VM there.
+ *
+ * The instruction at the label is temporarily replaced by HALT (and a superinstruction ending on it is split
+ * back into its first half) so the warm-up runs at full speed with the switch engine. The snapshot holds the
+ * registers, program counter, return stack and RAM. RAM is written to a memfd once, restoring maps it
+ * MAP_PRIVATE so each restored VM only copies the pages it writes. The warm-up must not use PARALLEL_START.
+ *
+ * @param vm The VM holding the program - its registers and RAM are used as the starting state.
+ * @param labelID The label to stop at, as written in the IR file.
+ * @param debug If true, prints debugging information.
+ * @return The snapshot, or NULL if the label does not exist, was not reached or the snapshot could not be made.
+ */
+VMSnapshot *vm_snapshot(VirtualMachine *vm, size_t labelID, bool debug) {
+
+    if(vm->instructionMemory == NULL) {
+        printf("[VM] No program loaded\n");
+        return NULL;
+    }
+
+    size_t address = SIZE_MAX;
+    for(size_t i = 0; i < vm->numLabels; i++) {
+        if(vm->labels[i].labelID == labelID) {
+            address = vm->labels[i].address;
+            break;
+        }
+    }
+    if(address == SIZE_MAX) {
+        printf("[VM] UNRESOLVED snapshot label %zu\n", labelID);
+        return NULL;
+    }
+
+
+    //Stop at the label - a superinstruction ending on it would run straight past
+    Instruction *program = vm->instructionMemory;
+    Instruction saved = program[address];
+    uint16_t savedPrevious = (address > 0 ? program[address - 1].opcode : INVALID);
+    if(address > 0) {
+        program[address - 1].opcode = unfused_opcode(savedPrevious);
+    }
+    program[address].opcode = HALT;
+
+    vm->programCounter = 0;
+    vm->interrupt = INTERRUPT_NONE;
+    vm->returnStackDepth = 0;
+    bool reached = (execute_switch(vm) == true && vm->programCounter == address);
+    output_flush(vm);
+    input_release(vm);
+
+    program[address] = saved;
+    if(address > 0) {
+        program[address - 1].opcode = savedPrevious;
+    }
+
+    if(reached == false) {
+        printf("[VM] Program did not reach snapshot label %zu\n", labelID);
+        vm->returnStackDepth = 0;
+        return NULL;
+    }
+
+
+    VMSnapshot *snapshot = (VMSnapshot*)calloc(1, sizeof(VMSnapshot));
+    if(snapshot == NULL) {
+        vm->returnStackDepth = 0;
+        return NULL;
+    }
+    snapshot->ramFile = -1;
+    snapshot->RAMsize = vm->RAMsize;
+    snapshot->numRegisters = vm->numRegisters;
+    snapshot->programCounter = address;
+    snapshot->numInstructions = vm->numInstructions;
+
+    snapshot->returnStackDepth = vm->returnStackDepth;
+    snapshot->returnStack = (uint32_t*)malloc((vm->returnStackDepth == 0 ? 1 : vm->returnStackDepth) * sizeof(uint32_t));
+    if(snapshot->returnStack == NULL) {
+        vm->returnStackDepth = 0;
+        vm_snapshot_destroy(snapshot);
+        return NULL;
+    }
+    memcpy(snapshot->returnStack, vm->returnStack, vm->returnStackDepth * sizeof(uint32_t));
+    vm->returnStackDepth = 0;
+
+    size_t RAMbytes = vm->RAMsize;
+    size_t padding = RAM_padding(RAMbytes); //RAM is stored so it ends on a page boundary, like guarded RAM
+    snapshot->registerArray = (DataTypes*)malloc(vm->numRegisters * sizeof(DataTypes));
+    snapshot->ramFile = memfd_create("jankc-vm-snapshot", MFD_CLOEXEC);
+    if(snapshot->registerArray == NULL || snapshot->ramFile == -1 || ftruncate(snapshot->ramFile, (off_t)(padding + RAMbytes)) != 0) {
+        vm_snapshot_destroy(snapshot);
+        return NULL;
+    }
+    memcpy(snapshot->registerArray, vm->registerArray, vm->numRegisters * sizeof(DataTypes));
+
+    for(size_t written = 0; written < RAMbytes;) {
+        ssize_t result = pwrite(snapshot->ramFile, (char*)vm->ramArray + written, RAMbytes - written, (off_t)(padding + written));
+        if(result <= 0) {
+            vm_snapshot_destroy(snapshot);
+            return NULL;
+        }
+        written += (size_t)result;
+    }
+
+    if(debug == true) {
+        printf("[VM - DEBUG] Snapshot taken at label %zu (instruction %zu)\n", labelID, address);
+    }
+    return snapshot;
+}
+
+
+/**
+ * @brief Put a VM into the state captured by vm_snapshot, ready for vm_continue.
+ *
+ * The VM must have the same program loaded and the same number of registers and RAM size as the VM the snapshot
+ * was taken from. Its RAM becomes a private copy-on-write mapping of the snapshot.
+ *
+ * @param vm The VM to restore.
+ * @param snapshot The snapshot.
+ * @return true if the VM was restored, false if the snapshot does not fit the VM.
+ */
+bool vm_restore(VirtualMachine *vm, VMSnapshot *snapshot) {
+
+    if(vm->numRegisters != snapshot->numRegisters || vm->RAMsize != snapshot->RAMsize
+    || vm->numInstructions != snapshot->numInstructions || vm->returnStackLimit < snapshot->returnStackDepth) {
+        printf("[VM] Snapshot does not match the VM or its program\n");
+        return false;
+    }
+
+    size_t RAMbytes = vm->RAMsize;
+    size_t padding = RAM_padding(RAMbytes);
+    if(RAMbytes != 0 && vm->guardPages == true) { //Replace the RAM pages in front of the guard pages
+        if(mmap(vm->ramArray - padding, padding + RAMbytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, snapshot->ramFile, 0) == MAP_FAILED) {
+            return false;
+        }
+    } else if(RAMbytes != 0) {
+        void *mapping = mmap(NULL, padding + RAMbytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, snapshot->ramFile, 0);
+        if(mapping == MAP_FAILED) {
+            return false;
+        }
+        release_RAM(vm);
+        vm->ramArray = (uint8_t*)mapping + padding;
+        vm->ramMapping = mapping;
+        vm->ramMappingSize = padding + RAMbytes;
+    }
+
+    memcpy(vm->registerArray, snapshot->registerArray, vm->numRegisters * sizeof(DataTypes));
+    vm->programCounter = snapshot->programCounter;
+    vm->interrupt = INTERRUPT_NONE;
+    memcpy(vm->returnStack, snapshot->returnStack, snapshot->returnStackDepth * sizeof(uint32_t));
+    vm->returnStackDepth = snapshot->returnStackDepth;
+
+    return true;
+}
+
+
+/**
+ * @brief Free a snapshot. VMs restored from it keep their RAM.
+ *
+ * @param snapshot The snapshot to free (may be NULL).
+ */
+void vm_snapshot_destroy(VMSnapshot *snapshot) {
+
+    if(snapshot == NULL) {
+        return;
+    }
+
+    if(snapshot->ramFile != -1) {
+        close(snapshot->ramFile);
+    }
+    free(snapshot->registerArray);
+    free(snapshot->returnStack);
+    free(snapshot);
+
+    return;
+}
+
+
+/**
+ * @brief Clear the registers and RAM of a virtual machine, keeping its buffers and loaded program.
+ *
+ * @param vm The VM to clear.
+ */
+void vm_reset(VirtualMachine *vm) {
+
+    memset(vm->registerArray, 0, vm->numRegisters * sizeof(DataTypes));
+    memset(vm->ramArray, 0, vm->RAMsize);
+    vm->programCounter = 0;
+    vm->interrupt = INTERRUPT_NONE;
+
+    return;
+}
+
+
+/**
+ * @brief Get the interrupt raised by the last run.
+ *
+ * @param vm The VM that ran.
+ * @return The VM_INTERRUPT value (0 if the program ran to completion).
+ */
+int get_VM_interrupt(VirtualMachine *vm) {
+    return (int)vm->interrupt;
+}
+
+
+/**
+ * @brief Free a virtual machine, its program and everything collected while running it.
+ *
+ * @param vm The VM to free (may be NULL).
+ */
+void vm_destroy(VirtualMachine *vm) {
+
+    if(vm == NULL) {
+        return;
+    }
+
+    release_program(vm);
+    free(vm->registerArray);
+    free(vm->returnStack);
+    free(vm->outputBuffer);
+    free(vm->inputBuffer);
+    release_RAM(vm);
+    free(vm->statistics.registerCounts);
+    free(vm->statistics.ramTouched);
+    free(vm->profile.callStack);
+    free(vm->profile.samples);
+    free(vm->watches);
+    free(vm);
+
+    return;
+}
@@ -12,18 +12,81 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
-#include "stack.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 
 typedef struct VirtualMachine VirtualMachine;
+typedef struct VMSnapshot VMSnapshot;
 
 
+#define VM_UNTHROTTLED 0 //instructionsPerSecond value that runs the VM as fast as possible
 
-bool initialise_virtual_machine(size_t RAMsize, size_t numRegisters, size_t instructionsPerSecond);
-void print_VM_properties(void);
-bool run_VM(char *fileName, bool debug);
+
+typedef enum VM_ENGINE {
+    VM_ENGINE_SWITCH,   ///< One central switch - portable reference engine
+    VM_ENGINE_THREADED, ///< Direct threaded dispatch (computed goto on GCC/Clang, switch elsewhere)
+    VM_ENGINE_JIT,      ///< Switch engine that compiles hot blocks to native code (x86-64 Linux only)
+    VM_ENGINE_TRACE,    ///< Threaded engine that runs hot loops as straight line superblocks
+} VM_ENGINE;
+
+
+typedef enum VM_WATCH_COMPARISON {
+    VM_WATCH_GREATER,       ///< >
+    VM_WATCH_GREATER_EQUAL, ///< >=
+    VM_WATCH_LESS,          ///< <
+    VM_WATCH_LESS_EQUAL,    ///< <=
+    VM_WATCH_EQUAL,         ///< ==
+    VM_WATCH_NOT_EQUAL,     ///< !=
+} VM_WATCH_COMPARISON;
+
+
+
+VirtualMachine *vm_create(size_t RAMsize, size_t numRegisters, size_t instructionsPerSecond);
+bool vm_load(VirtualMachine *vm, char *fileName, bool debug);
+bool vm_run(VirtualMachine *vm, bool debug);
+void vm_reset(VirtualMachine *vm);
+VMSnapshot *vm_snapshot(VirtualMachine *vm, size_t labelID, bool debug);
+bool vm_restore(VirtualMachine *vm, VMSnapshot *snapshot);
+bool vm_continue(VirtualMachine *vm, bool debug);
+bool vm_step(VirtualMachine *vm, bool debug);
+void vm_break(VirtualMachine *vm);
+void vm_snapshot_destroy(VMSnapshot *snapshot);
+void vm_destroy(VirtualMachine *vm);
+int get_VM_interrupt(VirtualMachine *vm);
+
+void print_VM_properties(VirtualMachine *vm);
+bool set_VM_engine(VirtualMachine *vm, VM_ENGINE engine);
+void set_VM_load_threads(VirtualMachine *vm, size_t threads);
+void set_VM_streams(VirtualMachine *vm, FILE *input, FILE *output);
+void set_VM_line_buffered(VirtualMachine *vm, bool lineBuffered);
+bool set_VM_cores(VirtualMachine *vm, size_t numCores);
+bool set_VM_heap_start(VirtualMachine *vm, size_t heapStart);
+bool set_VM_call_depth(VirtualMachine *vm, size_t depth);
+bool set_VM_guard_pages(VirtualMachine *vm, bool guardPages);
+void print_VM_memory_statistics(VirtualMachine *vm);
+void set_VM_JIT_threshold(VirtualMachine *vm, uint32_t threshold);
+void set_VM_statistics(VirtualMachine *vm, bool collectStatistics);
+void print_VM_statistics(VirtualMachine *vm);
+bool write_VM_statistics_JSON(VirtualMachine *vm, char *fileName);
+void set_VM_profiling(VirtualMachine *vm, bool collectProfile);
+bool write_VM_profile(VirtualMachine *vm, char *fileName);
+bool set_VM_debugging(VirtualMachine *vm, bool debugging);
+bool set_VM_breakpoint(VirtualMachine *vm, size_t index, bool enabled);
+bool set_VM_watch(VirtualMachine *vm, size_t reg, VM_WATCH_COMPARISON comparison, bool isFloat, double value);
+void clear_VM_watches(VirtualMachine *vm, size_t reg);
+void print_VM_instruction(VirtualMachine *vm, size_t index);
+bool convert_IR_to_bytecode(VirtualMachine *vm, char *IRfileName, char *bytecodeFileName, bool debug);
 
 
 
@@ -63,6 +126,10 @@ Note:  Labels can ONLY be numbers
     - Compare R1 and R2 with an operation and jump to [LABEL] if the condition is true.
     - Operations: GRT (greater), GRE (greater or equal), LES (less), LEQ (less or equal), EQU (equal), NEQ (not equal).
 
+LABEL|||[LABEL]|||
+
+    - Define [LABEL] as the address of the next instruction. Not an instruction - takes up no instruction memory.
+
 GOTO|||[LABEL]|||[]|||[]|||
 
     - Unconditionally goto to [LABEL].
@@ -79,26 +146,47 @@ NOP|||[]|||[]|||[]|||
 
     - No operation. Used to consume some amount of instruction cycles to implement sleep based on the VM's clock cycle.
 
+[OPERATION]|||R|||
+
+    - Terminal I/O on register R.
+    - Operations: INPUT_I, INPUT_F, INPUT_C (read into R), OUTPUT_I, OUTPUT_F, OUTPUT_C (print R).
+
+ALLOCATE|||Rdest|||Rsize|||
+
+    - Allocate Rsize bytes of VM RAM and place the address in Rdest (0 if RAM is exhausted).
+    - The first 4 bytes of the block hold Rsize.
+
+FREE|||Rptr|||
+
+    - Free the block at Rptr (0 is ignored). Raises an interrupt if Rptr is not an allocated block.
+
+[OPERATION]|||Rdest|||Rsource|||Rcount|||
+
+    - Vector operations: VADD, VSUB, VMUL (_F variants for floats).
+    - Combine the Rcount 4 byte elements at address Rdest with the Rcount elements at address Rsource, in place at Rdest.
+    - Raises an interrupt if either range is not inside RAM.
+
 IMPORTANT NOTE:
     - FUNCTION ARGUMENTS ARE ALWAYS PASSED BY REFERENCE, NOT PLACED ON THE STACK.
     - NOP is used to implement sleep based on the VM's clock cycle.
-    - Read reads a character from the terminal (in the interpreter) using scanf.
+    - Read reads a value from the terminal through an input buffer owned by the VM (read with read(), parsed like scanf).
     - Allocate/free are done on the VM's memory, not using malloc/free in the interpreter.
-    - Print prints to the terminal using printf.
+    - Print prints to the terminal through an output buffer owned by the VM (written with write()).
 
 VM Notes:
     - The VM interprets the IR as its own assembly.
     - The VM has its own memory and registers.
     - Allocation and freeing of memory are done using VM-specific instructions, not malloc/free in the intepreter.
     - All VM items (variables, data) are stored in the VM's memory.
-    - Read reads from the interpreter terminal using scanf and moves the input to a dedicated input register (using scanf).
-    - Print prints a single character to the interpreter terminal (using printf).
+    - Read reads from the interpreter terminal (a block at a time, parsed by the VM with scanf's rules) and moves the input to a dedicated input register.
+    - Print prints a single value to the interpreter terminal (buffered by the VM, written before the program reads or ends).
     - The VM does not store anything other than function addresses on the stack. All function calls receive arguments by reference.
     - The stack starts at the end of the allocated heap (e.g., if memory is 64 bytes, then the stack starts at byte 64 and grows backwards).
     - Program counter indexes BITS not BYTES.
-    - Instruction size is 4x sizeof(long long int):
-        - 1: instruction
+    - Instructions are decoded once by the preprocessor into a packed record:
+        - 0: handler address (threaded engine only)
+        - 1: opcode (VALID_INSTRUCTIONS)
         - 2: R1
         - 3: R2
-        - 4: R3/Label
+        - 4: R3/Label (instruction index)/Immediate
 */
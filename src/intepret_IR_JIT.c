@@ -0,0 +1,715 @@
+#include "intepret_IR_JIT.h"
+
+
+
+#define JIT_CODE_SIZE (16 << 20)    //Executable buffer shared by all blocks
+#define MAX_BLOCK_INSTRUCTIONS 256  //Longest run of instructions compiled into one block
+#define MAX_INSTRUCTION_BYTES 64    //Upper bound on the native code emitted for one instruction
+
+
+/*
+ * Register conventions inside a compiled block (System V calling convention):
+ *
+ *   rdi - registerArray   (first argument, never modified)
+ *   rsi - ramArray        (second argument, never modified)
+ *   r8  - RAMsize         (third argument, moved out of rdx which idiv uses)
+ *   r9  - VirtualMachine  (fourth argument, moved out of rcx) - only the return stack is used
+ *   eax, ecx, edx, xmm0, xmm1 - scratch
+ *
+ * VM registers are not cached in host registers, so every instruction boundary is a valid place to enter or
+ * leave native code.
+ */
+
+
+typedef struct JITEmitter {
+    uint8_t *code;      ///< Start of the block being emitted.
+    size_t used;        ///< Bytes emitted so far.
+} JITEmitter;
+
+
+
+#if defined(__x86_64__) && defined(__linux__)
+
+
+
+static void emit_u8(JITEmitter *emitter, uint8_t byte) {
+    emitter->code[emitter->used] = byte;
+    emitter->used++;
+    return;
+}
+
+static void emit_u32(JITEmitter *emitter, uint32_t value) {
+    memcpy(emitter->code + emitter->used, &value, sizeof(value));
+    emitter->used += sizeof(value);
+    return;
+}
+
+static void emit_u64(JITEmitter *emitter, uint64_t value) {
+    memcpy(emitter->code + emitter->used, &value, sizeof(value));
+    emitter->used += sizeof(value);
+    return;
+}
+
+
+/**
+ * @brief Emit an instruction operating on VM register reg ([rdi + disp32]).
+ *
+ * @param emitter Where to emit.
+ * @param opcode Opcode bytes (up to three, prefixes included).
+ * @param opcodeLength Number of opcode bytes.
+ * @param hostRegister Host register in the ModRM reg field (0 = eax/xmm0, 1 = ecx/xmm1, 2 = edx).
+ * @param reg VM register index.
+ */
+static void emit_register_operand(JITEmitter *emitter, const uint8_t *opcode, size_t opcodeLength, uint8_t hostRegister, uint16_t reg) {
+
+    for(size_t i = 0; i < opcodeLength; i++) {
+        emit_u8(emitter, opcode[i]);
+    }
+    emit_u8(emitter, 0x87 | (uint8_t)(hostRegister << 3)); //mod = 10 (disp32), rm = rdi
+    emit_u32(emitter, (uint32_t)(reg * sizeof(DataTypes)));
+
+    return;
+}
+
+#define EMIT_REG(emitter, hostRegister, reg, ...) \
+    do { \
+        static const uint8_t opcodeBytes[] = {__VA_ARGS__}; \
+        emit_register_operand(emitter, opcodeBytes, sizeof(opcodeBytes), hostRegister, reg); \
+    } while(0)
+
+#define HOST_EAX 0
+#define HOST_ECX 1
+#define HOST_EDX 2
+
+
+/**
+ * @brief Emit a 64 bit instruction operating on a field of the VirtualMachine ([r9 + disp32]).
+ *
+ * @param emitter Where to emit.
+ * @param opcode Opcode byte.
+ * @param hostRegister Host register in the ModRM reg field (0 = rax, 2 = rdx).
+ * @param offset offsetof the field in VirtualMachine.
+ */
+static void emit_vm_operand(JITEmitter *emitter, uint8_t opcode, uint8_t hostRegister, size_t offset) {
+
+    emit_u8(emitter, 0x49); //REX.W + REX.B (r9)
+    emit_u8(emitter, opcode);
+    emit_u8(emitter, 0x81 | (uint8_t)(hostRegister << 3)); //mod = 10 (disp32), rm = r9
+    emit_u32(emitter, (uint32_t)offset);
+
+    return;
+}
+
+
+/**
+ * @brief Return from the block with the next instruction index.
+ *
+ * @param emitter Where to emit.
+ * @param programCounter Instruction to continue from.
+ * @param bailout true if the interpreter must execute that instruction, false if it is a jump target.
+ */
+static void emit_exit(JITEmitter *emitter, size_t programCounter, bool bailout) {
+
+    if(bailout == true) {
+        emit_u8(emitter, 0x48); //mov rax, imm64
+        emit_u8(emitter, 0xB8);
+        emit_u64(emitter, JIT_BAILOUT | (uint64_t)programCounter);
+    } else {
+        emit_u8(emitter, 0xB8); //mov eax, imm32 (clears the upper half)
+        emit_u32(emitter, (uint32_t)programCounter);
+    }
+    emit_u8(emitter, 0xC3); //ret
+
+    return;
+}
+
+#define BAILOUT_SIZE 11 //Bytes emitted by emit_exit with bailout == true
+
+
+/**
+ * @brief Emit a jump (jmp or jcc rel32) to code already emitted in this block.
+ *
+ * @param emitter Where to emit.
+ * @param condition Second byte of the jcc rel32 opcode, or 0 for an unconditional jmp.
+ * @param target Offset of the destination within the block.
+ */
+static void emit_jump_back(JITEmitter *emitter, uint8_t condition, size_t target) {
+
+    if(condition == 0) {
+        emit_u8(emitter, 0xE9);
+    } else {
+        emit_u8(emitter, 0x0F);
+        emit_u8(emitter, condition);
+    }
+    emit_u32(emitter, (uint32_t)((int64_t)target - (int64_t)(emitter->used + 4)));
+
+    return;
+}
+
+
+/**
+ * @brief Emit the comparison of a compare-branch and the jump or exit taken when it is true.
+ *
+ * @param emitter Where to emit.
+ * @param instruction The compare-branch.
+ * @param start Index of the first instruction in the block.
+ * @param current Index of the compare-branch.
+ * @param offsets Native offset of each instruction already emitted in this block.
+ */
+static void emit_branch(JITEmitter *emitter, Instruction *instruction, size_t start, size_t current, const size_t *offsets) {
+
+    uint8_t condition = 0; //jcc rel32 second byte, jcc rel8 is condition - 0x10
+    switch(instruction->opcode) {
+        case GRT: condition = 0x8F; break; //jg
+        case GRE: condition = 0x8D; break; //jge
+        case LTE: condition = 0x8E; break; //jle
+        case LES: condition = 0x8C; break; //jl
+        case EQU: condition = 0x84; break; //je
+        case NEQ: condition = 0x85; break; //jne
+        default: break;
+    }
+
+    EMIT_REG(emitter, HOST_EAX, instruction->ARG1, 0x8B); //mov eax, R1
+    EMIT_REG(emitter, HOST_EAX, instruction->ARG2, 0x3B); //cmp eax, R2
+
+    size_t target = instruction->ARG3.label;
+    if(target >= start && target <= current) { //Backward branch inside this block - stay in native code
+        emit_jump_back(emitter, condition, offsets[target - start]);
+    } else {
+        emit_u8(emitter, (uint8_t)((condition - 0x10) ^ 1)); //Inverted jcc rel8 over the exit
+        emit_u8(emitter, 6);
+        emit_exit(emitter, target, false);
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Emit DIV or MOD of eax by the divisor in ecx into eax.
+ *
+ * A zero divisor bails out to the interpreter, which raises the interrupt. A divisor of -1 negates (or gives 0
+ * for MOD) without idiv, since INT_MIN / -1 faults - the same wrap around result as the interpreter.
+ *
+ * @param emitter Where to emit.
+ * @param programCounter Index of the division.
+ * @param remainder true for MOD, false for DIV.
+ */
+static void emit_divide(JITEmitter *emitter, size_t programCounter, bool remainder) {
+
+    emit_u8(emitter, 0x85); //test ecx, ecx
+    emit_u8(emitter, 0xC9);
+    emit_u8(emitter, 0x75); //jnz over the bailout
+    emit_u8(emitter, BAILOUT_SIZE);
+    emit_exit(emitter, programCounter, true);
+
+    emit_u8(emitter, 0x83); //cmp ecx, -1
+    emit_u8(emitter, 0xF9);
+    emit_u8(emitter, 0xFF);
+    emit_u8(emitter, 0x75); //jne over the -1 case
+    emit_u8(emitter, 4);
+    emit_u8(emitter, (remainder == true ? 0x31 : 0xF7)); //xor eax, eax / neg eax
+    emit_u8(emitter, (remainder == true ? 0xC0 : 0xD8));
+    emit_u8(emitter, 0xEB); //jmp over the idiv
+    emit_u8(emitter, (remainder == true ? 5 : 3));
+
+    emit_u8(emitter, 0x99); //cdq
+    emit_u8(emitter, 0xF7); //idiv ecx
+    emit_u8(emitter, 0xF9);
+    if(remainder == true) {
+        emit_u8(emitter, 0x89); //mov eax, edx
+        emit_u8(emitter, 0xD0);
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Emit JAL - push the return address and leave for the call target (or loop back to it in this block).
+ *
+ * A full return stack bails out to the interpreter, which raises the interrupt.
+ *
+ * @param emitter Where to emit.
+ * @param instruction The JAL.
+ * @param start Index of the first instruction in the block.
+ * @param current Index of the JAL.
+ * @param offsets Native offset of each instruction already emitted in this block.
+ */
+static void emit_call(JITEmitter *emitter, Instruction *instruction, size_t start, size_t current, const size_t *offsets) {
+
+    emit_vm_operand(emitter, 0x8B, HOST_EAX, offsetof(VirtualMachine, returnStackDepth)); //mov rax, depth
+    emit_vm_operand(emitter, 0x3B, HOST_EAX, offsetof(VirtualMachine, returnStackLimit)); //cmp rax, limit
+    emit_u8(emitter, 0x72); //jb over the bailout
+    emit_u8(emitter, BAILOUT_SIZE);
+    emit_exit(emitter, current, true);
+
+    emit_vm_operand(emitter, 0x8B, HOST_EDX, offsetof(VirtualMachine, returnStack)); //mov rdx, returnStack
+    emit_u8(emitter, 0xC7); //mov dword [rdx + rax * 4], current + 1
+    emit_u8(emitter, 0x04);
+    emit_u8(emitter, 0x82);
+    emit_u32(emitter, (uint32_t)(current + 1));
+    emit_u8(emitter, 0x48); //inc rax
+    emit_u8(emitter, 0xFF);
+    emit_u8(emitter, 0xC0);
+    emit_vm_operand(emitter, 0x89, HOST_EAX, offsetof(VirtualMachine, returnStackDepth)); //mov depth, rax
+
+    size_t target = instruction->ARG3.label;
+    if(target >= start && target <= current) {
+        emit_jump_back(emitter, 0, offsets[target - start]);
+    } else {
+        emit_exit(emitter, target, false);
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Emit JRT - pop the return address and leave for it. An empty return stack bails out to the interpreter.
+ *
+ * @param emitter Where to emit.
+ * @param current Index of the JRT.
+ */
+static void emit_return(JITEmitter *emitter, size_t current) {
+
+    emit_vm_operand(emitter, 0x8B, HOST_EAX, offsetof(VirtualMachine, returnStackDepth)); //mov rax, depth
+    emit_u8(emitter, 0x48); //test rax, rax
+    emit_u8(emitter, 0x85);
+    emit_u8(emitter, 0xC0);
+    emit_u8(emitter, 0x75); //jnz over the bailout
+    emit_u8(emitter, BAILOUT_SIZE);
+    emit_exit(emitter, current, true);
+
+    emit_u8(emitter, 0x48); //dec rax
+    emit_u8(emitter, 0xFF);
+    emit_u8(emitter, 0xC8);
+    emit_vm_operand(emitter, 0x89, HOST_EAX, offsetof(VirtualMachine, returnStackDepth)); //mov depth, rax
+    emit_vm_operand(emitter, 0x8B, HOST_EDX, offsetof(VirtualMachine, returnStack)); //mov rdx, returnStack
+    emit_u8(emitter, 0x8B); //mov eax, [rdx + rax * 4] (clears the upper half - not a bailout)
+    emit_u8(emitter, 0x04);
+    emit_u8(emitter, 0x82);
+    emit_u8(emitter, 0xC3); //ret
+
+    return;
+}
+
+
+/**
+ * @brief Emit the bounds check of a RAM access - bails out to the interpreter (which raises the interrupt) if
+ * any of the bytes starting at the address in rax is outside RAM.
+ *
+ * @param emitter Where to emit.
+ * @param programCounter Index of the memory instruction.
+ * @param width Number of bytes accessed.
+ */
+static void emit_bounds_check(JITEmitter *emitter, size_t programCounter, uint8_t width) {
+
+    emit_u8(emitter, 0x48); //lea rdx, [rax + width]
+    emit_u8(emitter, 0x8D);
+    emit_u8(emitter, 0x50);
+    emit_u8(emitter, width);
+    emit_u8(emitter, 0x4C); //cmp rdx, r8
+    emit_u8(emitter, 0x39);
+    emit_u8(emitter, 0xC2);
+    emit_u8(emitter, 0x76); //jbe over the bailout
+    emit_u8(emitter, BAILOUT_SIZE);
+    emit_exit(emitter, programCounter, true);
+
+    return;
+}
+
+
+/**
+ * @brief Emit native code for one instruction.
+ *
+ * @param emitter Where to emit.
+ * @param program The decoded program.
+ * @param start Index of the first instruction in the block.
+ * @param current Index of the instruction to compile.
+ * @param offsets Native offset of each instruction already emitted in this block.
+ * @return true if the block continues with the next instruction, false if the block ends here.
+ */
+static bool emit_instruction(JITEmitter *emitter, Instruction *program, size_t start, size_t current, const size_t *offsets) {
+
+    Instruction *instruction = &(program[current]);
+    uint16_t opcode = instruction->opcode;
+
+    //Superinstructions are compiled as their first half - the second instruction follows in the program
+    switch(opcode) {
+        case ADI_GRT: case ADI_GRE: case ADI_LTE: case ADI_LES: case ADI_EQU: case ADI_NEQ:
+            opcode = ADI;
+            break;
+        case MUL_ADD:
+            opcode = MUL;
+            break;
+        case MUL_ADD_F:
+            opcode = MUL_F;
+            break;
+        default:
+            break;
+    }
+
+    uint16_t destination = instruction->ARG1;
+    uint16_t source = instruction->ARG2;
+    uint16_t source2 = (uint16_t)instruction->ARG3.reg;
+    uint32_t immediate = instruction->ARG3.reg; //Raw bits of the integer or float immediate
+
+    switch(opcode) {
+
+        case ADD:
+        case SUB:
+        case MUL:
+            EMIT_REG(emitter, HOST_EAX, source, 0x8B); //mov eax, Rsource
+            if(opcode == ADD) {
+                EMIT_REG(emitter, HOST_EAX, source2, 0x03); //add eax, Rsource2
+            } else if(opcode == SUB) {
+                EMIT_REG(emitter, HOST_EAX, source2, 0x2B); //sub eax, Rsource2
+            } else {
+                EMIT_REG(emitter, HOST_EAX, source2, 0x0F, 0xAF); //imul eax, Rsource2
+            }
+            EMIT_REG(emitter, HOST_EAX, destination, 0x89); //mov Rdest, eax
+            return true;
+
+        case DIV:
+        case MOD:
+            EMIT_REG(emitter, HOST_ECX, source2, 0x8B); //mov ecx, Rsource2
+            EMIT_REG(emitter, HOST_EAX, source, 0x8B); //mov eax, Rsource
+            emit_divide(emitter, current, (opcode == MOD));
+            EMIT_REG(emitter, HOST_EAX, destination, 0x89); //mov Rdest, eax
+            return true;
+
+        case ADD_F:
+        case SUB_F:
+        case MUL_F:
+        case DIV_F:
+            EMIT_REG(emitter, HOST_EAX, source, 0xF3, 0x0F, 0x10); //movss xmm0, Rsource
+            if(opcode == ADD_F) {
+                EMIT_REG(emitter, HOST_EAX, source2, 0xF3, 0x0F, 0x58); //addss xmm0, Rsource2
+            } else if(opcode == SUB_F) {
+                EMIT_REG(emitter, HOST_EAX, source2, 0xF3, 0x0F, 0x5C); //subss xmm0, Rsource2
+            } else if(opcode == MUL_F) {
+                EMIT_REG(emitter, HOST_EAX, source2, 0xF3, 0x0F, 0x59); //mulss xmm0, Rsource2
+            } else {
+                EMIT_REG(emitter, HOST_EAX, source2, 0xF3, 0x0F, 0x5E); //divss xmm0, Rsource2
+            }
+            EMIT_REG(emitter, HOST_EAX, destination, 0xF3, 0x0F, 0x11); //movss Rdest, xmm0
+            return true;
+
+
+        case ADI:
+        case SUI:
+        case MUI:
+            EMIT_REG(emitter, HOST_EAX, source, 0x8B); //mov eax, Rsource
+            if(opcode == ADI) {
+                emit_u8(emitter, 0x05); //add eax, imm32
+            } else if(opcode == SUI) {
+                emit_u8(emitter, 0x2D); //sub eax, imm32
+            } else {
+                emit_u8(emitter, 0x69); //imul eax, eax, imm32
+                emit_u8(emitter, 0xC0);
+            }
+            emit_u32(emitter, immediate);
+            EMIT_REG(emitter, HOST_EAX, destination, 0x89); //mov Rdest, eax
+            return true;
+
+        case DII:
+            if(instruction->ARG3.intImmediate == 0) {
+                emit_exit(emitter, current, true); //The interpreter raises the interrupt
+                return false;
+            }
+            EMIT_REG(emitter, HOST_EAX, source, 0x8B); //mov eax, Rsource
+            if(instruction->ARG3.intImmediate == -1) { //INT_MIN / -1 faults in idiv - negate with wrap around
+                emit_u8(emitter, 0xF7); //neg eax
+                emit_u8(emitter, 0xD8);
+                EMIT_REG(emitter, HOST_EAX, destination, 0x89); //mov Rdest, eax
+                return true;
+            }
+            emit_u8(emitter, 0x99); //cdq
+            emit_u8(emitter, 0xB9); //mov ecx, imm32
+            emit_u32(emitter, immediate);
+            emit_u8(emitter, 0xF7); //idiv ecx
+            emit_u8(emitter, 0xF9);
+            EMIT_REG(emitter, HOST_EAX, destination, 0x89); //mov Rdest, eax
+            return true;
+
+        case ADI_F:
+        case SUI_F:
+        case MUI_F:
+        case DII_F:
+            EMIT_REG(emitter, HOST_EAX, source, 0xF3, 0x0F, 0x10); //movss xmm0, Rsource
+            emit_u8(emitter, 0xB8); //mov eax, imm32
+            emit_u32(emitter, immediate);
+            emit_u8(emitter, 0x66); //movd xmm1, eax
+            emit_u8(emitter, 0x0F);
+            emit_u8(emitter, 0x6E);
+            emit_u8(emitter, 0xC8);
+            emit_u8(emitter, 0xF3); //op xmm0, xmm1
+            emit_u8(emitter, 0x0F);
+            emit_u8(emitter, (opcode == ADI_F ? 0x58 : opcode == SUI_F ? 0x5C : opcode == MUI_F ? 0x59 : 0x5E));
+            emit_u8(emitter, 0xC1);
+            EMIT_REG(emitter, HOST_EAX, destination, 0xF3, 0x0F, 0x11); //movss Rdest, xmm0
+            return true;
+
+
+        case STR_1:
+        case STR_2:
+        case STR_4:
+            EMIT_REG(emitter, HOST_EAX, destination, 0x8B); //mov eax, Rptr (zero extends into rax)
+            emit_bounds_check(emitter, current, (opcode == STR_1 ? 1 : opcode == STR_2 ? 2 : 4));
+            EMIT_REG(emitter, HOST_ECX, source, 0x8B); //mov ecx, Rsource
+            if(opcode == STR_1) {
+                emit_u8(emitter, 0x88); //mov [rsi + rax], cl
+            } else {
+                if(opcode == STR_2) {
+                    emit_u8(emitter, 0x66); //mov [rsi + rax], cx
+                }
+                emit_u8(emitter, 0x89); //mov [rsi + rax], ecx
+            }
+            emit_u8(emitter, 0x0C);
+            emit_u8(emitter, 0x06);
+            return true;
+
+        case LOD_1:
+        case LOD_2:
+        case LOD_4:
+            EMIT_REG(emitter, HOST_EAX, destination, 0x8B); //mov eax, Rptr (zero extends into rax)
+            emit_bounds_check(emitter, current, (opcode == LOD_1 ? 1 : opcode == LOD_2 ? 2 : 4));
+            if(opcode == LOD_4) {
+                emit_u8(emitter, 0x8B); //mov ecx, [rsi + rax]
+            } else {
+                emit_u8(emitter, 0x0F); //movzx ecx, byte/word [rsi + rax]
+                emit_u8(emitter, (opcode == LOD_1 ? 0xB6 : 0xB7));
+            }
+            emit_u8(emitter, 0x0C);
+            emit_u8(emitter, 0x06);
+            EMIT_REG(emitter, HOST_ECX, source, 0x89); //mov Rdest, ecx
+            return true;
+
+
+        case GRT:
+        case GRE:
+        case LTE:
+        case LES:
+        case EQU:
+        case NEQ:
+            emit_branch(emitter, instruction, start, current, offsets);
+            return true;
+
+        case JMP:
+            if(instruction->ARG3.label >= start && instruction->ARG3.label <= current) {
+                emit_jump_back(emitter, 0, offsets[instruction->ARG3.label - start]);
+            } else {
+                emit_exit(emitter, instruction->ARG3.label, false);
+            }
+            return false;
+
+        case JAL:
+            emit_call(emitter, instruction, start, current, offsets);
+            return false;
+
+        case JRT:
+            emit_return(emitter, current);
+            return false;
+
+        case NOP:
+            return true;
+
+
+        default: //I/O, vector instructions, 3 byte STR/LOD, heap, multi-core, HALT - left to the interpreter
+            emit_exit(emitter, current, true);
+            return false;
+    }
+}
+
+
+/**
+ * @brief Compile the block starting at an instruction into the executable buffer.
+ *
+ * The block runs straight through the program from its first instruction. Compare-branches leave the block when
+ * taken (or loop back natively if the target is earlier in the same block) and fall through otherwise. The block
+ * ends at an unconditional jump, a call or return, at anything the JIT does not handle, or after
+ * MAX_BLOCK_INSTRUCTIONS. Calls and returns leave for their target without going back to the interpreter.
+ *
+ * @param vm The VM holding the program.
+ * @param start Index of the first instruction.
+ * @return The compiled block, or NULL if nothing useful could be compiled or the buffer is full.
+ */
+static JITFunction compile_block(VirtualMachine *vm, size_t start) {
+
+    JITState *jit = &(vm->jit);
+    size_t offsets[MAX_BLOCK_INSTRUCTIONS];
+
+    if(jit->codeUsed + (MAX_BLOCK_INSTRUCTIONS + 2) * MAX_INSTRUCTION_BYTES > JIT_CODE_SIZE) {
+        return NULL; //Buffer full - everything else stays interpreted
+    }
+    if(mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        return NULL;
+    }
+
+    JITEmitter emitter;
+    emitter.code = jit->code + jit->codeUsed;
+    emitter.used = 0;
+
+    emit_u8(&emitter, 0x49); //mov r8, rdx
+    emit_u8(&emitter, 0x89);
+    emit_u8(&emitter, 0xD0);
+    emit_u8(&emitter, 0x49); //mov r9, rcx
+    emit_u8(&emitter, 0x89);
+    emit_u8(&emitter, 0xC9);
+
+    size_t compiled = 0;
+    size_t current = start;
+    bool continues = true;
+    while(continues == true) {
+
+        if(compiled == MAX_BLOCK_INSTRUCTIONS) {
+            emit_exit(&emitter, current, true);
+            break;
+        }
+
+        offsets[compiled] = emitter.used;
+        continues = emit_instruction(&emitter, vm->instructionMemory, start, current, offsets);
+        compiled++;
+        current++;
+    }
+
+    mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+
+    uint16_t first = vm->instructionMemory[start].opcode;
+    if(compiled == 1 && first != JMP && first != JAL && first != JRT) { //First instruction is not supported
+        return NULL;
+    }
+
+    JITFunction block = (JITFunction)(void*)emitter.code;
+    jit->codeUsed += (emitter.used + 15) & ~(size_t)15; //Keep blocks 16 byte aligned
+    return block;
+}
+
+
+/**
+ * @brief Allocate the JIT tables and executable buffer for the loaded program.
+ *
+ * @param vm The VM holding the program.
+ * @return true if the JIT is ready, false if it could not be set up (the interpreter should be used alone).
+ */
+bool JIT_initialise(VirtualMachine *vm) {
+
+    if(vm->jit.blocks != NULL) { //Already set up for this program
+        return true;
+    }
+
+    vm->jit.blocks = (JITFunction*)calloc(vm->numInstructions + 1, sizeof(JITFunction));
+    vm->jit.counters = (uint32_t*)calloc(vm->numInstructions + 1, sizeof(uint32_t));
+    vm->jit.code = (uint8_t*)mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    vm->jit.codeUsed = 0;
+
+    if(vm->jit.blocks == NULL || vm->jit.counters == NULL || vm->jit.code == MAP_FAILED) {
+        if(vm->jit.code == MAP_FAILED) {
+            vm->jit.code = NULL;
+        }
+        JIT_destroy(vm);
+        return false;
+    }
+
+    return true;
+}
+
+
+#else //Not x86-64 Linux - nothing is compiled
+
+
+static JITFunction compile_block(VirtualMachine *vm, size_t start) {
+    (void)vm;
+    (void)start;
+    return NULL;
+}
+
+bool JIT_initialise(VirtualMachine *vm) {
+
+    if(vm->jit.blocks != NULL) {
+        return true;
+    }
+
+    vm->jit.blocks = (JITFunction*)calloc(vm->numInstructions + 1, sizeof(JITFunction));
+    vm->jit.counters = (uint32_t*)calloc(vm->numInstructions + 1, sizeof(uint32_t));
+    vm->jit.code = NULL;
+    vm->jit.codeUsed = 0;
+
+    if(vm->jit.blocks == NULL || vm->jit.counters == NULL) {
+        JIT_destroy(vm);
+        return false;
+    }
+
+    return true;
+}
+
+
+#endif
+
+
+
+/**
+ * @brief Free the JIT tables and executable buffer.
+ *
+ * @param vm The VM to free the JIT state of.
+ */
+void JIT_destroy(VirtualMachine *vm) {
+
+    free(vm->jit.blocks);
+    free(vm->jit.counters);
+    if(vm->jit.code != NULL) {
+        munmap(vm->jit.code, JIT_CODE_SIZE);
+    }
+
+    vm->jit.blocks = NULL;
+    vm->jit.counters = NULL;
+    vm->jit.code = NULL;
+    vm->jit.codeUsed = 0;
+
+    return;
+}
+
+
+/**
+ * @brief Run compiled blocks starting from an instruction that was just jumped to.
+ *
+ * Counts the jump, compiles the block once it reaches the threshold, and keeps running compiled blocks while
+ * they exit to other compiled blocks.
+ *
+ * @param vm The VM being run.
+ * @param programCounter The instruction that was jumped to.
+ * @return The instruction the interpreter should continue from.
+ */
+size_t JIT_run(VirtualMachine *vm, size_t programCounter) {
+
+    JITState *jit = &(vm->jit);
+
+    for(;;) {
+
+        JITFunction block = jit->blocks[programCounter];
+        if(block == NULL) {
+
+            if(jit->counters[programCounter] == JIT_NEVER) {
+                return programCounter;
+            }
+            jit->counters[programCounter]++;
+            if(jit->counters[programCounter] < vm->jitThreshold) {
+                return programCounter;
+            }
+
+            block = compile_block(vm, programCounter);
+            if(block == NULL) {
+                jit->counters[programCounter] = JIT_NEVER;
+                return programCounter;
+            }
+            jit->blocks[programCounter] = block;
+        }
+
+        uint64_t result = block(vm->registerArray, vm->ramArray, vm->RAMsize, vm);
+        programCounter = (size_t)(uint32_t)result;
+        if((result & JIT_BAILOUT) != 0) {
+            return programCounter;
+        }
+    }
+}
@@ -0,0 +1,36 @@
+/*
+ * intepret_IR_JIT.h
+ *
+ * Description:
+ * Optional just in time compiler for the IR virtual machine. Blocks of decoded instructions that are jumped to
+ * often are translated into native x86-64 code using a fixed template per opcode. Compiled blocks read and write
+ * the VM's registers and RAM directly, and return to the interpreter for anything they do not handle.
+ *
+ * Data Structure:
+ * - JITState (intepret_IR_structs.h): One entry per instruction holding the compiled block starting there and a
+ *   counter of how many times it has been jumped to. All blocks share one executable buffer.
+ *
+ * Usage:
+ * - `JIT_initialise` before running a program with the JIT engine, `JIT_destroy` when the program is unloaded.
+ * - `JIT_run` is called by the engine whenever the interpreter jumps - it runs compiled blocks for as long as
+ *   possible and returns the instruction the interpreter should continue from.
+ *
+ * Note:
+ * On hosts other than x86-64 Linux nothing is ever compiled and the JIT engine behaves like the switch engine.
+ */
+#ifndef INTEPRET_IR_JIT_H
+#define INTEPRET_IR_JIT_H
+#include "intepret_IR_structs.h"
+
+
+#define JIT_BAILOUT ((uint64_t)1 << 32) //Set in a block's return value when the next instruction must be interpreted
+#define JIT_NEVER UINT32_MAX             //Counter value of an instruction whose block could not be compiled
+#define JIT_DEFAULT_THRESHOLD 64
+
+
+bool JIT_initialise(VirtualMachine *vm);
+void JIT_destroy(VirtualMachine *vm);
+size_t JIT_run(VirtualMachine *vm, size_t programCounter);
+
+
+#endif
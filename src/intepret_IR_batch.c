@@ -0,0 +1,475 @@
+#include "intepret_IR_batch.h"
+
+
+
+typedef enum BATCH_STATUS {
+    BATCH_OK,           ///< Program ran to completion
+    BATCH_INTERRUPT,    ///< Program raised an interrupt
+    BATCH_LOAD_FAILED,  ///< Program could not be loaded
+    BATCH_IO_FAILED,    ///< Input or output file could not be opened
+} BATCH_STATUS;
+
+static const char *const batchStatusNames[] = {"ok", "interrupt", "load_failed", "io_failed"};
+
+
+typedef struct BatchJob {
+    char *program;      ///< IR or bytecode file.
+    char *input;        ///< File read by INPUT_x (NULL for none).
+    char *output;       ///< File written by OUTPUT_x (NULL to discard).
+
+    size_t snapshot;    ///< Index of the program's snapshot (only if useSnapshots).
+
+    BATCH_STATUS status;
+    int interrupt;
+    double seconds;
+} BatchJob;
+
+
+typedef enum SNAPSHOT_STATE {
+    SNAPSHOT_NONE,      ///< No worker has run the prologue yet
+    SNAPSHOT_TAKING,    ///< A worker is running the prologue
+    SNAPSHOT_TAKEN,     ///< The prologue has run - snapshot is final
+} SNAPSHOT_STATE;
+
+
+typedef struct BatchSnapshot {
+    char *program;              ///< Program the snapshot was taken of.
+    VMSnapshot *snapshot;       ///< NULL if the prologue could not be snapshotted.
+    SNAPSHOT_STATE state;
+    pthread_mutex_t lock;       ///< Protects state and snapshot, never held while the prologue runs.
+} BatchSnapshot;
+
+
+typedef struct BatchContext {
+    BatchJob *jobs;
+    size_t numJobs;
+    size_t nextJob;             ///< Next job to hand out.
+    BatchSnapshot *snapshots;   ///< One per distinct program (only if useSnapshots).
+    size_t numSnapshots;
+    pthread_mutex_t lock;       ///< Protects nextJob.
+    VMBatchSettings settings;
+} BatchContext;
+
+
+typedef struct BatchWorker {
+    BatchContext *context;
+    VirtualMachine *vm;         ///< Reused for every job the worker runs.
+    char *loadedProgram;        ///< Program currently loaded on vm (only if useSnapshots).
+    pthread_t thread;
+} BatchWorker;
+
+
+
+/**
+ * @brief Read a manifest into an array of jobs.
+ *
+ * @param fileName The manifest to read.
+ * @param numJobs Where the number of jobs is placed.
+ * @return The jobs, or NULL if the manifest could not be read or a line is invalid.
+ */
+static BatchJob *read_manifest(char *fileName, size_t *numJobs) {
+
+    FILE *fptr = fopen(fileName, "r");
+    if(fptr == NULL) {
+        printf("[VM] Failed to open manifest '%s'\n", fileName);
+        return NULL;
+    }
+
+    BatchJob *jobs = NULL;
+    size_t capacity = 0;
+    size_t count = 0;
+    size_t lineNumber = 0;
+    bool success = true;
+
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    while(getline(&line, &lineCapacity, fptr) != -1) {
+        lineNumber++;
+
+        char *fields[4] = {NULL, NULL, NULL, NULL};
+        size_t numFields = 0;
+        for(char *field = strtok(line, " \t\r\n"); field != NULL; field = strtok(NULL, " \t\r\n")) {
+            if(numFields == 4) {
+                break;
+            }
+            fields[numFields] = field;
+            numFields++;
+        }
+
+        if(numFields == 0 || fields[0][0] == '#') {
+            continue;
+        }
+        if(numFields > 3) {
+            printf("[VM] INVALID manifest line %zu - expected: program [input] [output]\n", lineNumber);
+            success = false;
+            break;
+        }
+
+        if(count == capacity) {
+            capacity = (capacity == 0 ? 64 : capacity * 2);
+            BatchJob *newJobs = (BatchJob*)realloc(jobs, capacity * sizeof(BatchJob));
+            if(newJobs == NULL) {
+                success = false;
+                break;
+            }
+            jobs = newJobs;
+        }
+
+        BatchJob *job = &(jobs[count]);
+        memset(job, 0, sizeof(*job));
+        count++; //Counted before copying so a partly copied job is freed below
+        job->program = strdup(fields[0]);
+        if(job->program == NULL) {
+            success = false;
+            break;
+        }
+        if(fields[1] != NULL && strcmp(fields[1], "-") != 0) {
+            job->input = strdup(fields[1]);
+            if(job->input == NULL) {
+                success = false;
+                break;
+            }
+        }
+        if(fields[2] != NULL && strcmp(fields[2], "-") != 0) {
+            job->output = strdup(fields[2]);
+            if(job->output == NULL) {
+                success = false;
+                break;
+            }
+        }
+    }
+
+    free(line);
+    fclose(fptr);
+
+    if(success == false) {
+        for(size_t i = 0; i < count; i++) {
+            free(jobs[i].program);
+            free(jobs[i].input);
+            free(jobs[i].output);
+        }
+        free(jobs);
+        return NULL;
+    }
+
+    *numJobs = count;
+    return jobs;
+}
+
+
+/**
+ * @brief Find the snapshot of a job's program, taking it on the worker's VM if this is the program's first job.
+ *
+ * Snapshots are shared by every worker - restored VMs map the same RAM copy-on-write. Each program's prologue runs
+ * once, on the first worker to ask for it, without holding any lock. Workers asking while it runs get NULL and run
+ * their job from the start rather than wait, so a prologue that never reaches the label only holds up one worker.
+ *
+ * @param worker The worker - its VM must have the program loaded.
+ * @param job The job.
+ * @return The snapshot, or NULL if the program's prologue could not be snapshotted or is still running.
+ */
+static VMSnapshot *find_snapshot(BatchWorker *worker, BatchJob *job) {
+
+    BatchContext *context = worker->context;
+    BatchSnapshot *entry = &(context->snapshots[job->snapshot]);
+    VMSnapshot *snapshot = NULL;
+
+    pthread_mutex_lock(&(entry->lock));
+    SNAPSHOT_STATE state = entry->state;
+    if(state == SNAPSHOT_NONE) {
+        entry->state = SNAPSHOT_TAKING;
+    } else if(state == SNAPSHOT_TAKEN) {
+        snapshot = entry->snapshot;
+    }
+    pthread_mutex_unlock(&(entry->lock));
+
+    if(state != SNAPSHOT_NONE) {
+        return snapshot;
+    }
+
+    FILE *input = fopen("/dev/null", "r");
+    FILE *output = fopen("/dev/null", "w");
+    if(input != NULL && output != NULL) {
+        set_VM_streams(worker->vm, input, output);
+        vm_reset(worker->vm);
+        snapshot = vm_snapshot(worker->vm, context->settings.snapshotLabel, false);
+    }
+    if(input != NULL) {
+        fclose(input);
+    }
+    if(output != NULL) {
+        fclose(output);
+    }
+
+    pthread_mutex_lock(&(entry->lock));
+    entry->snapshot = snapshot;
+    entry->state = SNAPSHOT_TAKEN;
+    pthread_mutex_unlock(&(entry->lock));
+
+    return snapshot;
+}
+
+
+/**
+ * @brief Give every job the index of its program's snapshot, one snapshot per distinct program.
+ *
+ * Done before the workers start so they never search or grow the table.
+ *
+ * @param context The batch - snapshots has room for one per job.
+ */
+static void assign_snapshots(BatchContext *context) {
+
+    for(size_t i = 0; i < context->numJobs; i++) {
+        BatchJob *job = &(context->jobs[i]);
+
+        //Jobs of one program are usually listed together
+        size_t found = context->numSnapshots;
+        if(i > 0 && strcmp(context->jobs[i - 1].program, job->program) == 0) {
+            found = context->jobs[i - 1].snapshot;
+        } else {
+            for(size_t k = 0; k < context->numSnapshots; k++) {
+                if(strcmp(context->snapshots[k].program, job->program) == 0) {
+                    found = k;
+                    break;
+                }
+            }
+        }
+
+        if(found == context->numSnapshots) {
+            BatchSnapshot *entry = &(context->snapshots[found]);
+            entry->program = job->program;
+            entry->snapshot = NULL;
+            entry->state = SNAPSHOT_NONE;
+            pthread_mutex_init(&(entry->lock), NULL);
+            context->numSnapshots++;
+        }
+        job->snapshot = found;
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Load and run one job on a worker's VM.
+ *
+ * @param worker The worker running the job.
+ * @param job The job to run - its results are filled in.
+ */
+static void run_job(BatchWorker *worker, BatchJob *job) {
+
+    VirtualMachine *vm = worker->vm;
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    FILE *input = fopen((job->input == NULL ? "/dev/null" : job->input), "r");
+    FILE *output = fopen((job->output == NULL ? "/dev/null" : job->output), "w");
+
+    if(input == NULL || output == NULL) {
+        job->status = BATCH_IO_FAILED;
+        goto done;
+    }
+
+    VMSnapshot *snapshot = NULL;
+    if(worker->context->settings.useSnapshots == true) {
+        //Programs stay loaded between jobs so they can be restored from their snapshot
+        if(worker->loadedProgram == NULL || strcmp(worker->loadedProgram, job->program) != 0) {
+            worker->loadedProgram = NULL;
+            if(vm_load(vm, job->program, false) == false) {
+                job->status = BATCH_LOAD_FAILED;
+                goto done;
+            }
+            worker->loadedProgram = job->program;
+        }
+        snapshot = find_snapshot(worker, job);
+
+    } else if(vm_load(vm, job->program, false) == false) {
+        job->status = BATCH_LOAD_FAILED;
+        goto done;
+    }
+
+    set_VM_streams(vm, input, output);
+    bool result = false;
+    if(snapshot != NULL && vm_restore(vm, snapshot) == true) {
+        result = vm_continue(vm, false);
+    } else {
+        vm_reset(vm);
+        result = vm_run(vm, false);
+    }
+    job->status = (result == true ? BATCH_OK : BATCH_INTERRUPT);
+    job->interrupt = get_VM_interrupt(vm);
+
+done:
+    if(input != NULL) {
+        fclose(input);
+    }
+    if(output != NULL) {
+        fclose(output);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return;
+}
+
+
+/**
+ * @brief Worker thread - runs jobs until none are left.
+ *
+ * @param argument The worker's BatchWorker.
+ * @return NULL.
+ */
+static void *batch_worker(void *argument) {
+
+    BatchWorker *worker = (BatchWorker*)argument;
+    BatchContext *context = worker->context;
+
+    for(;;) {
+        pthread_mutex_lock(&(context->lock));
+        size_t index = context->nextJob;
+        context->nextJob++;
+        pthread_mutex_unlock(&(context->lock));
+
+        if(index >= context->numJobs) {
+            break;
+        }
+        run_job(worker, &(context->jobs[index]));
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Write the results of every job in manifest order.
+ *
+ * @param fileName The results file.
+ * @param context The finished batch.
+ * @return true if the file was written, false otherwise.
+ */
+static bool write_results(char *fileName, BatchContext *context) {
+
+    FILE *fptr = fopen(fileName, "w");
+    if(fptr == NULL) {
+        printf("[VM] Failed to open results file '%s'\n", fileName);
+        return false;
+    }
+
+    fprintf(fptr, "job\tprogram\tstatus\tinterrupt\tseconds\n");
+    for(size_t i = 0; i < context->numJobs; i++) {
+        BatchJob *job = &(context->jobs[i]);
+        fprintf(fptr, "%zu\t%s\t%s\t%d\t%f\n", i, job->program, batchStatusNames[job->status], job->interrupt, job->seconds);
+    }
+
+    bool success = (ferror(fptr) == 0);
+    if(fclose(fptr) != 0) {
+        success = false;
+    }
+    return success;
+}
+
+
+/**
+ * @brief Run every job in a manifest on a pool of worker threads and write the results.
+ *
+ * Each worker creates its VM once, before the first job. Jobs that fail to load or raise an interrupt are
+ * reported in the results and do not stop the batch.
+ *
+ * @param manifestFileName The manifest listing the jobs.
+ * @param resultsFileName The results file to write.
+ * @param settings VM and pool settings.
+ * @return true if the batch ran and the results were written (even if some jobs failed), false otherwise.
+ */
+bool run_VM_batch(char *manifestFileName, char *resultsFileName, VMBatchSettings settings) {
+
+    BatchContext context;
+    context.jobs = read_manifest(manifestFileName, &(context.numJobs));
+    if(context.jobs == NULL) {
+        return false;
+    }
+    context.nextJob = 0;
+    context.numSnapshots = 0;
+    context.snapshots = NULL;
+    context.settings = settings;
+    if(settings.useSnapshots == true) {
+        context.snapshots = (BatchSnapshot*)calloc(context.numJobs + 1, sizeof(BatchSnapshot));
+        if(context.snapshots == NULL) {
+            free(context.jobs);
+            return false;
+        }
+        assign_snapshots(&context);
+    }
+    pthread_mutex_init(&(context.lock), NULL);
+
+    size_t numWorkers = settings.numWorkers;
+    if(numWorkers == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numWorkers = (cores > 0 ? (size_t)cores : 1);
+    }
+    if(numWorkers > context.numJobs) {
+        numWorkers = (context.numJobs == 0 ? 1 : context.numJobs);
+    }
+
+    bool success = true;
+    size_t started = 0;
+    BatchWorker *workers = (BatchWorker*)calloc(numWorkers, sizeof(BatchWorker));
+    if(workers == NULL) {
+        success = false;
+    }
+
+    for(size_t i = 0; i < numWorkers && success == true; i++) {
+        workers[i].context = &context;
+        workers[i].vm = vm_create(settings.RAMsize, settings.numRegisters, VM_UNTHROTTLED);
+        if(workers[i].vm == NULL) {
+            success = false;
+            break;
+        }
+        set_VM_engine(workers[i].vm, settings.engine);
+        set_VM_heap_start(workers[i].vm, settings.heapStart);
+        if(settings.guardPages == true) {
+            set_VM_guard_pages(workers[i].vm, true); //Falls back to checked RAM if the region can not be reserved
+        }
+        set_VM_load_threads(workers[i].vm, 1); //Jobs already run in parallel
+
+        if(pthread_create(&(workers[i].thread), NULL, batch_worker, &(workers[i])) != 0) {
+            vm_destroy(workers[i].vm);
+            workers[i].vm = NULL;
+            success = false;
+            break;
+        }
+        started++;
+    }
+
+    if(success == false && started != 0) { //Let the workers that did start finish the batch
+        success = true;
+    }
+
+    for(size_t i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        vm_destroy(workers[i].vm);
+    }
+
+    if(success == true) {
+        success = write_results(resultsFileName, &context);
+    } else {
+        printf("[VM] Failed to start batch workers\n");
+    }
+
+    pthread_mutex_destroy(&(context.lock));
+    for(size_t i = 0; i < context.numSnapshots; i++) {
+        vm_snapshot_destroy(context.snapshots[i].snapshot);
+        pthread_mutex_destroy(&(context.snapshots[i].lock));
+    }
+    free(context.snapshots);
+    for(size_t i = 0; i < context.numJobs; i++) {
+        free(context.jobs[i].program);
+        free(context.jobs[i].input);
+        free(context.jobs[i].output);
+    }
+    free(context.jobs);
+    free(workers);
+
+    return success;
+}
@@ -0,0 +1,43 @@
+/*
+ * intepret_IR_batch.h
+ *
+ * Description:
+ * Batch runner for the IR virtual machine. Runs every job listed in a manifest on a fixed pool of worker threads
+ * inside one process, instead of starting the VM once per program.
+ *
+ * Data Structure:
+ * - Each worker owns one VirtualMachine for the whole batch - its registers and RAM are cleared between jobs
+ *   rather than reallocated.
+ * - Jobs are handed out in manifest order from a shared counter, results are written in manifest order.
+ *
+ * Usage:
+ * - Manifest: one job per line, `program [input] [output]`. The input file is read by INPUT_x (no input if
+ *   omitted or "-"), the output file receives OUTPUT_x (discarded if omitted or "-"). Blank lines and lines
+ *   starting with '#' are ignored. Paths may not contain spaces.
+ * - Results: tab separated, one line per job - job number, program, status (ok, interrupt, load_failed or
+ *   io_failed), interrupt number and seconds spent loading and running.
+ * - Snapshots: with useSnapshots, each distinct program runs up to snapshotLabel once (with no input and its
+ *   output discarded) and every job of that program is restored from the snapshot. If the label is not reached
+ *   the program's jobs run from the start instead, as do jobs handed out while the prologue is still running.
+ */
+#ifndef INTEPRET_IR_BATCH_H
+#define INTEPRET_IR_BATCH_H
+#include "intepret_IR.h"
+
+
+typedef struct VMBatchSettings {
+    size_t RAMsize;             ///< RAM of each worker's VM.
+    size_t heapStart;           ///< First RAM address used by ALLOCATE.
+    bool guardPages;            ///< Bounds check RAM with guard pages (see set_VM_guard_pages).
+    size_t numRegisters;        ///< Registers of each worker's VM.
+    VM_ENGINE engine;           ///< Engine every job runs on.
+    size_t numWorkers;          ///< Worker threads (0 for one per core).
+    bool useSnapshots;          ///< Run each program's prologue once and start every job from a snapshot.
+    size_t snapshotLabel;       ///< Label ending the prologue (only if useSnapshots).
+} VMBatchSettings;
+
+
+bool run_VM_batch(char *manifestFileName, char *resultsFileName, VMBatchSettings settings);
+
+
+#endif
@@ -0,0 +1,299 @@
+#include "intepret_IR_debug.h"
+#include "intepret_IR_structs.h"
+
+
+#define DEBUG_LINE_SIZE 256
+#define RAMDUMP_ROW 16 //Bytes per ramdump line
+
+
+static VirtualMachine *volatile debuggedVM = NULL; //VM stopped by SIGINT while it runs
+
+//Indexed by VM_WATCH_COMPARISON
+static const char *const watchComparisons[] = {">", ">=", "<", "<=", "==", "!="};
+
+
+static void debug_signal_handler(int signal) {
+
+    (void)signal;
+    if(debuggedVM != NULL) {
+        vm_break(debuggedVM);
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Continue the program until it ends, reaches a breakpoint or SIGINT is received.
+ *
+ * @param vm The VM being debugged.
+ * @return true if the program stopped at a breakpoint (it can continue), false if it ended.
+ */
+static bool debug_continue(VirtualMachine *vm) {
+
+    struct sigaction action;
+    struct sigaction oldAction;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = debug_signal_handler;
+    sigemptyset(&(action.sa_mask));
+
+    debuggedVM = vm;
+    sigaction(SIGINT, &action, &oldAction);
+    vm_continue(vm, false);
+    sigaction(SIGINT, &oldAction, NULL);
+    debuggedVM = NULL;
+
+    return (get_VM_interrupt(vm) == INTERRUPT_BREAK);
+}
+
+
+/**
+ * @brief Report where the program stopped.
+ *
+ * @param vm The VM being debugged.
+ * @return true if the program can continue, false if it has ended.
+ */
+static bool report_stop(VirtualMachine *vm) {
+
+    VM_INTERRUPT interrupt = (VM_INTERRUPT)get_VM_interrupt(vm);
+    if(interrupt == INTERRUPT_BREAK && vm->triggeredWatch != SIZE_MAX) {
+        VMWatch *watch = &(vm->watches[vm->triggeredWatch]);
+        DataTypes value = vm->registerArray[watch->reg];
+        if(watch->isFloat == true) {
+            printf("[VM - DEBUG] Watch R%u %s %g hit (R%u = %g), stopped at instruction %zu\n", watch->reg,
+            watchComparisons[watch->comparison], watch->operand.floatVal, watch->reg, value.floatVal, vm->programCounter);
+        } else {
+            printf("[VM - DEBUG] Watch R%u %s %d hit (R%u = %d), stopped at instruction %zu\n", watch->reg,
+            watchComparisons[watch->comparison], watch->operand.intVal, watch->reg, value.intVal, vm->programCounter);
+        }
+        print_VM_instruction(vm, vm->programCounter);
+        return true;
+    }
+    if(interrupt == INTERRUPT_BREAK) {
+        printf("[VM - DEBUG] Stopped at instruction %zu\n", vm->programCounter);
+        print_VM_instruction(vm, vm->programCounter);
+        return true;
+    }
+    if(interrupt != INTERRUPT_NONE) {
+        printf("[VM - DEBUG] Interrupt %d raised at instruction %zu\n", interrupt, vm->programCounter);
+        return false;
+    }
+    if(vm->programCounter >= vm->numInstructions) {
+        printf("[VM - DEBUG] Program finished\n");
+        return false;
+    }
+
+    print_VM_instruction(vm, vm->programCounter);
+    return true;
+}
+
+
+/**
+ * @brief Parse a register or RAM value - a float if it contains '.', otherwise an integer.
+ *
+ * @param text The value.
+ * @param value Where the value is placed.
+ * @return true if the whole of text is a number, false otherwise.
+ */
+static bool parse_value(const char *text, DataTypes *value) {
+
+    char *end = NULL;
+    if(strchr(text, '.') != NULL) {
+        value->floatVal = strtof(text, &end);
+    } else {
+        value->intVal = (INT_TYPE)strtol(text, &end, 10);
+    }
+
+    return (end != text && *end == '\0');
+}
+
+
+static void print_registers(VirtualMachine *vm) {
+
+    for(size_t i = 0; i < vm->numRegisters; i++) {
+        printf("R%-4zu %12d    %g\n", i, vm->registerArray[i].intVal, vm->registerArray[i].floatVal);
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Print RAM as hex, RAMDUMP_ROW bytes per line - runs of zero lines are shown as a single '*'.
+ *
+ * @param vm The VM being debugged.
+ */
+static void print_RAM(VirtualMachine *vm) {
+
+    bool skipping = false;
+    for(size_t row = 0; row < vm->RAMsize; row += RAMDUMP_ROW) {
+        size_t length = (vm->RAMsize - row < RAMDUMP_ROW ? vm->RAMsize - row : RAMDUMP_ROW);
+        bool zero = true;
+        for(size_t i = 0; i < length; i++) {
+            zero = (zero == true && vm->ramArray[row + i] == 0);
+        }
+        if(zero == true) {
+            if(skipping == false) {
+                printf("*\n");
+            }
+            skipping = true;
+            continue;
+        }
+        skipping = false;
+
+        printf("%08zx ", row);
+        for(size_t i = 0; i < length; i++) {
+            printf(" %02x", vm->ramArray[row + i]);
+        }
+        printf("\n");
+    }
+
+    return;
+}
+
+
+static void print_debug_help(void) {
+
+    printf("instructions [N]  - show the next N instructions (default 1)\n");
+    printf("step [N]          - execute N instructions (default 1)\n");
+    printf("breakpoint X      - stop before instruction X\n");
+    printf("delete X          - remove the breakpoint at instruction X\n");
+    printf("watch X Y Z       - stop once register X is written and is Y (>, >=, <, <=, ==, !=) than Z\n");
+    printf("unwatch X         - remove the watches on register X\n");
+    printf("continue          - run until a breakpoint, a watch, the end of the program or Ctrl-C\n");
+    printf("setreg X Y        - set register X to Y (float if Y contains '.')\n");
+    printf("setram X Y        - set the 4 bytes at address X to Y (float if Y contains '.')\n");
+    printf("regdump           - print every register\n");
+    printf("ramdump           - print RAM\n");
+    printf("memstats          - print heap usage\n");
+    printf("quit              - stop debugging\n");
+
+    return;
+}
+
+
+
+/**
+ * @brief Debug the program loaded on a VM from its first instruction.
+ *
+ * The program runs on the VM's engine (threaded instead of JIT) and only stops at breakpoints, watches or on
+ * SIGINT.
+ *
+ * @param vm The VM with the program loaded.
+ * @return true if the program ran to completion, false if it raised an interrupt, was not finished or debugging
+ * could not start.
+ */
+bool run_VM_debugger(VirtualMachine *vm) {
+
+    if(set_VM_debugging(vm, true) == false) {
+        printf("[VM] Failed to start the debugger\n");
+        return false;
+    }
+
+    vm->programCounter = 0;
+    vm->interrupt = INTERRUPT_NONE;
+    bool running = true;
+    printf("[VM - DEBUG] Debugging %zu instructions - \"help\" lists the commands\n", vm->numInstructions);
+    print_VM_instruction(vm, 0);
+
+    char line[DEBUG_LINE_SIZE];
+    for(;;) {
+        printf("(debug) ");
+        fflush(stdout);
+        if(fgets(line, sizeof(line), stdin) == NULL) {
+            break;
+        }
+
+        char command[DEBUG_LINE_SIZE] = "";
+        char first[DEBUG_LINE_SIZE] = "";
+        char second[DEBUG_LINE_SIZE] = "";
+        char third[DEBUG_LINE_SIZE] = "";
+        int fields = sscanf(line, "%255s %255s %255s %255s", command, first, second, third);
+        if(fields <= 0) {
+            continue;
+        }
+        size_t number = (fields >= 2 ? (size_t)strtoull(first, NULL, 10) : 1);
+
+        if(strcmp(command, "quit") == 0) {
+            break;
+
+        } else if(strcmp(command, "help") == 0) {
+            print_debug_help();
+
+        } else if(strcmp(command, "instructions") == 0) {
+            for(size_t i = vm->programCounter; i <= vm->numInstructions && i < vm->programCounter + number; i++) {
+                print_VM_instruction(vm, i);
+            }
+
+        } else if(strcmp(command, "step") == 0 || strcmp(command, "continue") == 0) {
+            if(running == false) {
+                printf("[VM - DEBUG] The program has ended\n");
+                continue;
+            }
+            if(command[0] == 's') {
+                for(size_t i = 0; i < number && vm->programCounter < vm->numInstructions; i++) {
+                    if(vm_step(vm, false) == false) {
+                        break;
+                    }
+                }
+            } else {
+                debug_continue(vm);
+            }
+            running = report_stop(vm);
+
+        } else if((strcmp(command, "breakpoint") == 0 || strcmp(command, "delete") == 0) && fields >= 2) {
+            if(set_VM_breakpoint(vm, number, command[0] == 'b') == false) {
+                printf("[VM - DEBUG] No instruction %zu\n", number);
+            }
+
+        } else if(strcmp(command, "watch") == 0 && fields == 4) {
+            size_t comparison = 0;
+            while(comparison < sizeof(watchComparisons)/sizeof(watchComparisons[0])
+            && strcmp(watchComparisons[comparison], second) != 0) {
+                comparison++;
+            }
+            DataTypes value;
+            if(parse_value(third, &value) == false
+            || set_VM_watch(vm, number, (VM_WATCH_COMPARISON)comparison, strchr(third, '.') != NULL,
+            (strchr(third, '.') != NULL ? (double)value.floatVal : (double)value.intVal)) == false) {
+                printf("[VM - DEBUG] Expected watch <register> <>, >=, <, <=, == or !=> <value>\n");
+            }
+
+        } else if(strcmp(command, "unwatch") == 0 && fields >= 2) {
+            clear_VM_watches(vm, number);
+
+        } else if(strcmp(command, "setreg") == 0 && fields == 3) {
+            DataTypes value;
+            if(number >= vm->numRegisters || parse_value(second, &value) == false) {
+                printf("[VM - DEBUG] Expected setreg <register> <value>\n");
+                continue;
+            }
+            vm->registerArray[number] = value;
+
+        } else if(strcmp(command, "setram") == 0 && fields == 3) {
+            DataTypes value;
+            if(number + sizeof(DataTypes) > vm->RAMsize || parse_value(second, &value) == false) {
+                printf("[VM - DEBUG] Expected setram <address> <value> with the address inside RAM\n");
+                continue;
+            }
+            memcpy(vm->ramArray + number, &value, sizeof(DataTypes));
+
+        } else if(strcmp(command, "regdump") == 0) {
+            print_registers(vm);
+
+        } else if(strcmp(command, "ramdump") == 0) {
+            print_RAM(vm);
+
+        } else if(strcmp(command, "memstats") == 0) {
+            print_VM_memory_statistics(vm);
+
+        } else {
+            printf("[VM - DEBUG] Unknown command - \"help\" lists the commands\n");
+        }
+    }
+
+    bool finished = (running == false && get_VM_interrupt(vm) == INTERRUPT_NONE);
+    set_VM_debugging(vm, false);
+
+    return finished;
+}
@@ -0,0 +1,28 @@
+/*
+ * intepret_IR_debug.h
+ *
+ * Description:
+ * Interactive debugger for the IR virtual machine ("-d"). Commands are read from stdin between runs, the program
+ * itself runs on the normal engines at full speed.
+ *
+ * Data Structure:
+ * - Breakpoints are not a list checked by the engines - set_VM_breakpoint patches the instruction with BREAK,
+ *   which stops the engine when it is reached. Continuing runs the real instruction once and patches it again.
+ * - SIGINT while the program runs calls vm_break, which patches every instruction so the VM stops wherever it is
+ *   and the prompt returns (the debugger attaches to the running program).
+ *
+ * Usage:
+ * - `run_VM_debugger` takes a VM with a program loaded and starts at the prompt before the first instruction.
+ * - Commands: instructions [N], step [N], breakpoint X, delete X, continue, setreg X Y, setram X Y, regdump,
+ *   ramdump, memstats, help, quit. Instruction numbers are indices into the decoded program (LABEL lines take
+ *   no space), as shown by "instructions".
+ */
+#ifndef INTEPRET_IR_DEBUG_H
+#define INTEPRET_IR_DEBUG_H
+#include "intepret_IR.h"
+
+
+bool run_VM_debugger(VirtualMachine *vm);
+
+
+#endif
@@ -0,0 +1,354 @@
+/*
+ * intepret_IR_dispatch.h
+ *
+ * Description:
+ * Instruction semantics for the IR virtual machine. This file has NO include guard - it is included once inside
+ * each execution engine in intepret_IR.c, after the engine has defined how it moves between instructions:
+ *
+ * - VM_CASE(op)        - start of the handler for opcode op (a case label or a computed goto label)
+ * - VM_NEXT()          - continue with the next instruction
+ * - VM_JUMP(target)    - continue with the instruction at index target
+ * - VM_TRAP(interrupt) - raise an interrupt and stop execution
+ *
+ * The engine provides the locals used here: vm, program, ip, R (registers), RAM and address.
+ * Operands were validated by the preprocessor so handlers only check RAM accesses and division. Integer arithmetic
+ * wraps around on overflow, and INT_MIN / -1 gives INT_MIN (remainder 0).
+ *
+ * An engine that defines VM_UNCHECKED_RAM runs on guarded RAM - accesses are not bounds checked, the instruction
+ * is recorded instead so the engine can raise INTERRUPT_OOB at it when the access faults on a guard page.
+ * Vector instructions check their ranges in every engine.
+ */
+
+
+
+#ifdef VM_UNCHECKED_RAM //The empty asm reads the store and rewrites address, so the access can not move above it
+#define VM_CHECK_RAM(width) \
+    vm->guardInstruction = ip; \
+    __asm__("" : "+r"(address) : "m"(vm->guardInstruction));
+#else
+#define VM_CHECK_RAM(width) \
+    if(address + (width) > vm->RAMsize) { \
+        VM_TRAP(INTERRUPT_OOB); \
+    }
+#endif
+
+//Integer arithmetic is done on uint32_t so overflow wraps (two's complement) instead of being undefined
+#define VM_WRAP(left, operator, right) ((INT_TYPE)((uint32_t)(left) operator (uint32_t)(right)))
+
+//INT_MIN / -1 overflows (and faults in idiv), so a divisor of -1 negates with wrap around and leaves no remainder
+#define VM_QUOTIENT(left, right) ((right) == -1 ? VM_WRAP(0, -, left) : (left) / (right))
+#define VM_REMAINDER(left, right) ((right) == -1 ? 0 : (left) % (right))
+
+//Vector instruction on the RAM ranges at R(ARG1) and R(ARG2), R(ARG3) elements long
+#define VM_VECTOR(operation) \
+    if(vector_execute(vm, operation, (uint32_t)R[ip->ARG1].intVal, (uint32_t)R[ip->ARG2].intVal, \
+    (uint32_t)R[ip->ARG3.reg].intVal) == false) { \
+        VM_TRAP(INTERRUPT_OOB); \
+    } \
+    VM_NEXT();
+
+
+
+VM_CASE(ADD)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, +, R[ip->ARG3.reg].intVal);
+    VM_NEXT();
+VM_CASE(SUB)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, -, R[ip->ARG3.reg].intVal);
+    VM_NEXT();
+VM_CASE(MUL)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, *, R[ip->ARG3.reg].intVal);
+    VM_NEXT();
+VM_CASE(DIV)
+    if(R[ip->ARG3.reg].intVal == 0) {
+        VM_TRAP(INTERRUPT_DIVIDE_BY_ZERO);
+    }
+    R[ip->ARG1].intVal = VM_QUOTIENT(R[ip->ARG2].intVal, R[ip->ARG3.reg].intVal);
+    VM_NEXT();
+VM_CASE(MOD)
+    if(R[ip->ARG3.reg].intVal == 0) {
+        VM_TRAP(INTERRUPT_DIVIDE_BY_ZERO);
+    }
+    R[ip->ARG1].intVal = VM_REMAINDER(R[ip->ARG2].intVal, R[ip->ARG3.reg].intVal);
+    VM_NEXT();
+VM_CASE(ADD_F)
+    R[ip->ARG1].floatVal = R[ip->ARG2].floatVal + R[ip->ARG3.reg].floatVal;
+    VM_NEXT();
+VM_CASE(SUB_F)
+    R[ip->ARG1].floatVal = R[ip->ARG2].floatVal - R[ip->ARG3.reg].floatVal;
+    VM_NEXT();
+VM_CASE(MUL_F)
+    R[ip->ARG1].floatVal = R[ip->ARG2].floatVal * R[ip->ARG3.reg].floatVal;
+    VM_NEXT();
+VM_CASE(DIV_F)
+    R[ip->ARG1].floatVal = R[ip->ARG2].floatVal / R[ip->ARG3.reg].floatVal;
+    VM_NEXT();
+
+
+VM_CASE(ADI)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, +, ip->ARG3.intImmediate);
+    VM_NEXT();
+VM_CASE(SUI)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, -, ip->ARG3.intImmediate);
+    VM_NEXT();
+VM_CASE(MUI)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, *, ip->ARG3.intImmediate);
+    VM_NEXT();
+VM_CASE(DII)
+    if(ip->ARG3.intImmediate == 0) {
+        VM_TRAP(INTERRUPT_DIVIDE_BY_ZERO);
+    }
+    R[ip->ARG1].intVal = VM_QUOTIENT(R[ip->ARG2].intVal, ip->ARG3.intImmediate);
+    VM_NEXT();
+VM_CASE(ADI_F)
+    R[ip->ARG1].floatVal = R[ip->ARG2].floatVal + ip->ARG3.floatImmediate;
+    VM_NEXT();
+VM_CASE(SUI_F)
+    R[ip->ARG1].floatVal = R[ip->ARG2].floatVal - ip->ARG3.floatImmediate;
+    VM_NEXT();
+VM_CASE(MUI_F)
+    R[ip->ARG1].floatVal = R[ip->ARG2].floatVal * ip->ARG3.floatImmediate;
+    VM_NEXT();
+VM_CASE(DII_F)
+    R[ip->ARG1].floatVal = R[ip->ARG2].floatVal / ip->ARG3.floatImmediate;
+    VM_NEXT();
+
+
+VM_CASE(STR) //Widths without their own handler (3 bytes), least significant byte first
+    address = (size_t)(unsigned INT_TYPE)R[ip->ARG1].intVal;
+    VM_CHECK_RAM(ip->ARG3.items)
+    for(uint32_t i = 0; i < ip->ARG3.items; i++) {
+        RAM[address + i] = (uint8_t)((unsigned INT_TYPE)R[ip->ARG2].intVal >> (8 * i));
+    }
+    VM_NEXT();
+VM_CASE(LOD)
+    address = (size_t)(unsigned INT_TYPE)R[ip->ARG1].intVal;
+    VM_CHECK_RAM(ip->ARG3.items)
+    R[ip->ARG2].intVal = 0;
+    for(uint32_t i = 0; i < ip->ARG3.items; i++) {
+        R[ip->ARG2].intVal |= (INT_TYPE)((unsigned INT_TYPE)RAM[address + i] << (8 * i));
+    }
+    VM_NEXT();
+VM_CASE(STR_1)
+    address = (size_t)(unsigned INT_TYPE)R[ip->ARG1].intVal;
+    VM_CHECK_RAM(1)
+    RAM[address] = (uint8_t)R[ip->ARG2].intVal;
+    VM_NEXT();
+VM_CASE(STR_2)
+    address = (size_t)(unsigned INT_TYPE)R[ip->ARG1].intVal;
+    VM_CHECK_RAM(2)
+    {
+        uint16_t value = (uint16_t)R[ip->ARG2].intVal;
+        memcpy(RAM + address, &value, sizeof(value));
+    }
+    VM_NEXT();
+VM_CASE(STR_4)
+    address = (size_t)(unsigned INT_TYPE)R[ip->ARG1].intVal;
+    VM_CHECK_RAM(sizeof(DataTypes))
+    memcpy(RAM + address, &(R[ip->ARG2]), sizeof(DataTypes));
+    VM_NEXT();
+VM_CASE(LOD_1)
+    address = (size_t)(unsigned INT_TYPE)R[ip->ARG1].intVal;
+    VM_CHECK_RAM(1)
+    R[ip->ARG2].intVal = RAM[address];
+    VM_NEXT();
+VM_CASE(LOD_2)
+    address = (size_t)(unsigned INT_TYPE)R[ip->ARG1].intVal;
+    VM_CHECK_RAM(2)
+    {
+        uint16_t value = 0;
+        memcpy(&value, RAM + address, sizeof(value));
+        R[ip->ARG2].intVal = value;
+    }
+    VM_NEXT();
+VM_CASE(LOD_4)
+    address = (size_t)(unsigned INT_TYPE)R[ip->ARG1].intVal;
+    VM_CHECK_RAM(sizeof(DataTypes))
+    memcpy(&(R[ip->ARG2]), RAM + address, sizeof(DataTypes));
+    VM_NEXT();
+
+
+VM_CASE(GRT)
+    if(R[ip->ARG1].intVal > R[ip->ARG2].intVal) {
+        VM_JUMP(ip->ARG3.label);
+    }
+    VM_NEXT();
+VM_CASE(GRE)
+    if(R[ip->ARG1].intVal >= R[ip->ARG2].intVal) {
+        VM_JUMP(ip->ARG3.label);
+    }
+    VM_NEXT();
+VM_CASE(LTE)
+    if(R[ip->ARG1].intVal <= R[ip->ARG2].intVal) {
+        VM_JUMP(ip->ARG3.label);
+    }
+    VM_NEXT();
+VM_CASE(LES)
+    if(R[ip->ARG1].intVal < R[ip->ARG2].intVal) {
+        VM_JUMP(ip->ARG3.label);
+    }
+    VM_NEXT();
+VM_CASE(EQU)
+    if(R[ip->ARG1].intVal == R[ip->ARG2].intVal) {
+        VM_JUMP(ip->ARG3.label);
+    }
+    VM_NEXT();
+VM_CASE(NEQ)
+    if(R[ip->ARG1].intVal != R[ip->ARG2].intVal) {
+        VM_JUMP(ip->ARG3.label);
+    }
+    VM_NEXT();
+VM_CASE(JMP)
+    VM_JUMP(ip->ARG3.label);
+VM_CASE(JAL)
+    if(vm->returnStackDepth == vm->returnStackLimit) {
+        VM_TRAP(INTERRUPT_STACK);
+    }
+    vm->returnStack[vm->returnStackDepth] = (uint32_t)(ip - program) + 1;
+    vm->returnStackDepth++;
+    VM_JUMP(ip->ARG3.label);
+VM_CASE(JRT)
+    if(vm->returnStackDepth == 0) {
+        VM_TRAP(INTERRUPT_STACK);
+    }
+    vm->returnStackDepth--;
+    VM_JUMP(vm->returnStack[vm->returnStackDepth]);
+VM_CASE(NOP)
+    VM_NEXT();
+
+
+VM_CASE(INPUT_I)
+    if(input_integer(vm, &(R[ip->ARG1].intVal)) == false) {
+        VM_TRAP(INTERRUPT_INPUT);
+    }
+    VM_NEXT();
+VM_CASE(INPUT_F)
+    if(input_float(vm, &(R[ip->ARG1].floatVal)) == false) {
+        VM_TRAP(INTERRUPT_INPUT);
+    }
+    VM_NEXT();
+VM_CASE(INPUT_C)
+    if(input_character(vm, &(R[ip->ARG1].intVal)) == false) {
+        VM_TRAP(INTERRUPT_INPUT);
+    }
+    VM_NEXT();
+VM_CASE(OUTPUT_I)
+    output_integer(vm, R[ip->ARG1].intVal);
+    VM_NEXT();
+VM_CASE(OUTPUT_F)
+    output_float(vm, R[ip->ARG1].floatVal);
+    VM_NEXT();
+VM_CASE(OUTPUT_C)
+    output_character(vm, R[ip->ARG1].intVal);
+    VM_NEXT();
+
+
+
+VM_CASE(PARALLEL_START)
+    if(start_core(vm, ip->ARG1, (size_t)(ip - program) + 1) == false) {
+        VM_TRAP(INTERRUPT_CORE);
+    }
+    VM_JUMP(ip->ARG3.label);
+VM_CASE(PARALLEL_STOP)
+    VM_TRAP(INTERRUPT_NONE);
+VM_CASE(SYNC)
+    sync_cores(vm, ip->ARG1);
+    VM_NEXT();
+
+
+VM_CASE(ALLOCATE)
+    {
+        uint32_t address = 0;
+        if(heap_allocate(vm, (uint32_t)R[ip->ARG2].intVal, &address) == false) {
+            VM_TRAP(INTERRUPT_HEAP);
+        }
+        R[ip->ARG1].intVal = (INT_TYPE)address;
+    }
+    VM_NEXT();
+VM_CASE(FREE)
+    if(heap_free(vm, (uint32_t)R[ip->ARG1].intVal) == false) {
+        VM_TRAP(INTERRUPT_HEAP);
+    }
+    VM_NEXT();
+
+
+VM_CASE(VADD)
+    VM_VECTOR(VECTOR_ADD)
+VM_CASE(VSUB)
+    VM_VECTOR(VECTOR_SUB)
+VM_CASE(VMUL)
+    VM_VECTOR(VECTOR_MUL)
+VM_CASE(VADD_F)
+    VM_VECTOR(VECTOR_ADD_F)
+VM_CASE(VSUB_F)
+    VM_VECTOR(VECTOR_SUB_F)
+VM_CASE(VMUL_F)
+    VM_VECTOR(VECTOR_MUL_F)
+
+
+//Superinstructions - ip[1] is the second instruction of the pair, skipped with an extra ip++
+VM_CASE(ADI_GRT)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, +, ip->ARG3.intImmediate);
+    if(R[ip[1].ARG1].intVal > R[ip[1].ARG2].intVal) {
+        VM_JUMP(ip[1].ARG3.label);
+    }
+    ip++;
+    VM_NEXT();
+VM_CASE(ADI_GRE)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, +, ip->ARG3.intImmediate);
+    if(R[ip[1].ARG1].intVal >= R[ip[1].ARG2].intVal) {
+        VM_JUMP(ip[1].ARG3.label);
+    }
+    ip++;
+    VM_NEXT();
+VM_CASE(ADI_LTE)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, +, ip->ARG3.intImmediate);
+    if(R[ip[1].ARG1].intVal <= R[ip[1].ARG2].intVal) {
+        VM_JUMP(ip[1].ARG3.label);
+    }
+    ip++;
+    VM_NEXT();
+VM_CASE(ADI_LES)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, +, ip->ARG3.intImmediate);
+    if(R[ip[1].ARG1].intVal < R[ip[1].ARG2].intVal) {
+        VM_JUMP(ip[1].ARG3.label);
+    }
+    ip++;
+    VM_NEXT();
+VM_CASE(ADI_EQU)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, +, ip->ARG3.intImmediate);
+    if(R[ip[1].ARG1].intVal == R[ip[1].ARG2].intVal) {
+        VM_JUMP(ip[1].ARG3.label);
+    }
+    ip++;
+    VM_NEXT();
+VM_CASE(ADI_NEQ)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, +, ip->ARG3.intImmediate);
+    if(R[ip[1].ARG1].intVal != R[ip[1].ARG2].intVal) {
+        VM_JUMP(ip[1].ARG3.label);
+    }
+    ip++;
+    VM_NEXT();
+VM_CASE(MUL_ADD)
+    R[ip->ARG1].intVal = VM_WRAP(R[ip->ARG2].intVal, *, R[ip->ARG3.reg].intVal);
+    R[ip[1].ARG1].intVal = VM_WRAP(R[ip[1].ARG2].intVal, +, R[ip[1].ARG3.reg].intVal);
+    ip++;
+    VM_NEXT();
+VM_CASE(MUL_ADD_F)
+    R[ip->ARG1].floatVal = R[ip->ARG2].floatVal * R[ip->ARG3.reg].floatVal;
+    R[ip[1].ARG1].floatVal = R[ip[1].ARG2].floatVal + R[ip[1].ARG3.reg].floatVal;
+    ip++;
+    VM_NEXT();
+
+
+VM_CASE(BREAK) //Only present while debugging - the debugger puts the original instruction back to continue
+    VM_TRAP(INTERRUPT_BREAK);
+VM_CASE(INVALID) //Should never be executed - preprocessor only emits valid opcodes
+VM_CASE(HALT)
+    VM_TRAP(INTERRUPT_NONE);
+
+
+#undef VM_CHECK_RAM
+#undef VM_WRAP
+#undef VM_QUOTIENT
+#undef VM_REMAINDER
+#undef VM_VECTOR
@@ -0,0 +1,492 @@
+#include "intepret_IR_heap.h"
+
+
+
+#define HEAP_MAGIC 0x4A48454Du  //"JHEM" - marks RAM at heapStart as an initialised heap
+#define HEAP_USED 1u            //Set in a tag while the block is allocated
+#define HEAP_TAG_SIZE 4         //Bytes of each boundary tag
+#define HEAP_MIN_BLOCK 16       //Two tags plus the free list links
+#define HEAP_SMALL_BINS (HEAP_SMALL_LIMIT / HEAP_ALIGNMENT - 1) //Exact classes 16, 24, ... HEAP_SMALL_LIMIT
+#define HEAP_BINS (HEAP_SMALL_BINS + 24) //Power of two classes up to 4GB
+
+
+//Lives in VM RAM at the (aligned) heapStart - only ever accessed through offsetof, never through a pointer
+typedef struct HeapHeader {
+    uint32_t magic;
+    uint32_t usedBytes;
+    uint32_t peakUsedBytes;
+    uint32_t allocations;
+    uint32_t frees;
+    uint32_t failedAllocations;
+    uint64_t nonEmpty;              //Bit per size class with a non empty free list
+    uint32_t bins[HEAP_BINS];       //First free block of each size class (0 for none)
+} HeapHeader;
+
+
+/*
+ * Heap layout in VM RAM:
+ *
+ * | below heapStart | HeapHeader | prologue tag | block | block | ... | epilogue tag | end of RAM |
+ *
+ * Every block starts 4 bytes before an 8 byte boundary, so payloads (block + 4) are 8 byte aligned. The prologue
+ * and epilogue are used tags of size 0, so merging never has to check for the ends of the heap. A free block is
+ *
+ * | tag (size) | next free block | previous free block | ... | tag (size) |
+ */
+typedef struct HeapLayout {
+    size_t header;      ///< Address of the HeapHeader.
+    size_t first;       ///< Address of the first block.
+    size_t end;         ///< Address of the epilogue tag (one past the last block).
+} HeapLayout;
+
+#define HEAP_FIELD(layout, field) ((layout)->header + offsetof(HeapHeader, field))
+
+
+
+static inline uint32_t load32(uint8_t *RAM, size_t address) {
+    uint32_t value = 0;
+    memcpy(&value, RAM + address, sizeof(value));
+    return value;
+}
+
+static inline void store32(uint8_t *RAM, size_t address, uint32_t value) {
+    memcpy(RAM + address, &value, sizeof(value));
+    return;
+}
+
+static inline uint64_t load64(uint8_t *RAM, size_t address) {
+    uint64_t value = 0;
+    memcpy(&value, RAM + address, sizeof(value));
+    return value;
+}
+
+static inline void store64(uint8_t *RAM, size_t address, uint64_t value) {
+    memcpy(RAM + address, &value, sizeof(value));
+    return;
+}
+
+
+/**
+ * @brief Work out where the heap lives in a VM's RAM.
+ *
+ * @param vm The VM.
+ * @param layout Where the layout is placed.
+ * @return false if RAM above heapStart is too small to hold a heap with one minimum block.
+ */
+static bool heap_layout(VirtualMachine *vm, HeapLayout *layout) {
+
+    //RAM addresses are 32 bit, anything above can not be reached by a program
+    size_t limit = (vm->RAMsize > UINT32_MAX ? UINT32_MAX : vm->RAMsize);
+
+    layout->header = (vm->heapStart + HEAP_ALIGNMENT - 1) & ~(size_t)(HEAP_ALIGNMENT - 1);
+    size_t prologue = (layout->header + sizeof(HeapHeader) + HEAP_ALIGNMENT - 1) & ~(size_t)(HEAP_ALIGNMENT - 1);
+    layout->first = prologue + HEAP_TAG_SIZE;
+
+    if(layout->header < vm->heapStart || limit < layout->first + HEAP_MIN_BLOCK + HEAP_TAG_SIZE) {
+        return false;
+    }
+    layout->end = ((limit - 2 * HEAP_TAG_SIZE) & ~(size_t)(HEAP_ALIGNMENT - 1)) + HEAP_TAG_SIZE;
+
+    return (layout->end >= layout->first + HEAP_MIN_BLOCK);
+}
+
+
+/**
+ * @brief Size class of a block.
+ *
+ * @param size Block size (multiple of HEAP_ALIGNMENT, at least HEAP_MIN_BLOCK).
+ * @return Index of the free list the block belongs on.
+ */
+static inline size_t bin_index(uint32_t size) {
+
+    if(size <= HEAP_SMALL_LIMIT) {
+        return size / HEAP_ALIGNMENT - HEAP_MIN_BLOCK / HEAP_ALIGNMENT;
+    }
+
+    //(HEAP_SMALL_LIMIT, 2 * HEAP_SMALL_LIMIT] is the first power of two class
+    size_t log2 = 31 - (size_t)__builtin_clz(size - 1);
+    return HEAP_SMALL_BINS + log2 - 8;
+}
+
+
+/**
+ * @brief Check that a block address read from RAM (a list link or a neighbour) is a free block of the heap.
+ *
+ * Everything in the heap is program RAM that STR can overwrite, so no address or size read from it is used
+ * before it passes this check - every later access then stays inside [first, end).
+ *
+ * @param RAM The VM's RAM.
+ * @param layout The heap's layout.
+ * @param block Address of the block's first tag.
+ * @param size Where the block's size is placed.
+ * @return false if the block is outside the heap, misaligned, or its tags are not a matching free pair.
+ */
+static bool free_block(uint8_t *RAM, HeapLayout *layout, size_t block, uint32_t *size) {
+
+    if(block < layout->first || block >= layout->end || block % HEAP_ALIGNMENT != HEAP_TAG_SIZE) {
+        return false;
+    }
+    uint32_t tag = load32(RAM, block);
+    if((tag & HEAP_USED) != 0 || tag < HEAP_MIN_BLOCK || tag % HEAP_ALIGNMENT != 0 || tag > layout->end - block
+    || load32(RAM, block + tag - HEAP_TAG_SIZE) != tag) {
+        return false;
+    }
+    *size = tag;
+
+    return true;
+}
+
+
+/**
+ * @brief Check a free list link - 0 (end of the list) or a free block of the size class the list holds.
+ */
+static inline bool free_link(uint8_t *RAM, HeapLayout *layout, uint32_t block, size_t bin) {
+
+    uint32_t size = 0;
+    return (block == 0 || (free_block(RAM, layout, block, &size) == true && bin_index(size) == bin));
+}
+
+
+/**
+ * @brief Push a free block (tags already written) onto the head of its size class.
+ *
+ * @return false if the current head is not a valid free block.
+ */
+static bool heap_insert(uint8_t *RAM, HeapLayout *layout, uint32_t block, uint32_t size) {
+
+    size_t bin = bin_index(size);
+    size_t head = HEAP_FIELD(layout, bins) + bin * sizeof(uint32_t);
+    uint32_t next = load32(RAM, head);
+    if(free_link(RAM, layout, next, bin) == false || (next != 0 && load32(RAM, next + 8) != 0)) {
+        return false;
+    }
+
+    store32(RAM, block + 4, next);
+    store32(RAM, block + 8, 0);
+    if(next != 0) {
+        store32(RAM, next + 8, block);
+    }
+    store32(RAM, head, block);
+    store64(RAM, HEAP_FIELD(layout, nonEmpty), load64(RAM, HEAP_FIELD(layout, nonEmpty)) | ((uint64_t)1 << bin));
+
+    return true;
+}
+
+
+/**
+ * @brief Unlink a free block (checked with free_block) from its size class.
+ *
+ * @return false if its links do not point at valid neighbours that point back at it.
+ */
+static bool heap_remove(uint8_t *RAM, HeapLayout *layout, uint32_t block, uint32_t size) {
+
+    size_t bin = bin_index(size);
+    size_t head = HEAP_FIELD(layout, bins) + bin * sizeof(uint32_t);
+    uint32_t next = load32(RAM, block + 4);
+    uint32_t previous = load32(RAM, block + 8);
+    if(free_link(RAM, layout, next, bin) == false || free_link(RAM, layout, previous, bin) == false
+    || (next != 0 && load32(RAM, next + 8) != block)
+    || (previous != 0 ? load32(RAM, previous + 4) : load32(RAM, head)) != block) {
+        return false;
+    }
+
+    if(previous != 0) {
+        store32(RAM, previous + 4, next);
+    } else {
+        store32(RAM, head, next);
+        if(next == 0) {
+            store64(RAM, HEAP_FIELD(layout, nonEmpty), load64(RAM, HEAP_FIELD(layout, nonEmpty)) & ~((uint64_t)1 << bin));
+        }
+    }
+    if(next != 0) {
+        store32(RAM, next + 8, previous);
+    }
+
+    return true;
+}
+
+
+static inline void write_tags(uint8_t *RAM, uint32_t block, uint32_t size, uint32_t used) {
+    store32(RAM, block, size | used);
+    store32(RAM, block + size - HEAP_TAG_SIZE, size | used);
+    return;
+}
+
+
+/**
+ * @brief Find the heap, setting it up if RAM at heapStart does not hold one yet.
+ *
+ * @param vm The VM.
+ * @param layout Where the layout is placed.
+ * @return false if the heap does not fit in RAM.
+ */
+static bool heap_open(VirtualMachine *vm, HeapLayout *layout) {
+
+    if(heap_layout(vm, layout) == false) {
+        return false;
+    }
+
+    uint8_t *RAM = vm->ramArray;
+    if(load32(RAM, HEAP_FIELD(layout, magic)) == HEAP_MAGIC) {
+        return true;
+    }
+
+    memset(RAM + layout->header, 0, sizeof(HeapHeader));
+    store32(RAM, HEAP_FIELD(layout, magic), HEAP_MAGIC);
+    store32(RAM, layout->first - HEAP_TAG_SIZE, HEAP_USED); //Prologue
+    store32(RAM, layout->end, HEAP_USED);                  //Epilogue
+
+    uint32_t size = (uint32_t)(layout->end - layout->first);
+    write_tags(RAM, (uint32_t)layout->first, size, 0);
+
+    return heap_insert(RAM, layout, (uint32_t)layout->first, size);
+}
+
+
+/**
+ * @brief Allocate a block of VM RAM (ALLOCATE).
+ *
+ * @param vm The VM (or core) executing the ALLOCATE.
+ * @param size Requested bytes - the first 4 are set to size.
+ * @param address Where the address of the block is placed, 0 if there is no free block large enough.
+ * @return false if the heap's tags or free lists were overwritten by the program (nothing is allocated).
+ */
+bool heap_allocate(VirtualMachine *vm, uint32_t size, uint32_t *address) {
+
+    if(vm->cores != NULL) {
+        pthread_mutex_lock(&(vm->cores->heapLock));
+    }
+
+    uint8_t *RAM = vm->ramArray;
+    HeapLayout layout;
+    bool success = false;
+    *address = 0;
+    if(heap_open(vm, &layout) == false) { //Too little RAM above heapStart - every ALLOCATE fails
+        success = true;
+        goto done;
+    }
+
+    //Payload holds at least the size, plus a tag at each end, rounded up to the alignment
+    uint64_t needed = ((uint64_t)(size < 4 ? 4 : size) + 2 * HEAP_TAG_SIZE + HEAP_ALIGNMENT - 1) & ~(uint64_t)(HEAP_ALIGNMENT - 1);
+    uint32_t block = 0;
+    uint32_t blockSize = 0;
+
+    if(needed <= layout.end - layout.first) {
+        size_t bin = bin_index((uint32_t)needed);
+
+        //Small classes hold one size so their head always fits - larger ones are searched first fit
+        if(needed > HEAP_SMALL_LIMIT) {
+            uint32_t previous = 0;
+            uint32_t candidate = load32(RAM, HEAP_FIELD(&layout, bins) + bin * sizeof(uint32_t));
+            while(candidate != 0) {
+                //Every block must link back to the one before it, which also rules out cycles
+                if(free_link(RAM, &layout, candidate, bin) == false || load32(RAM, candidate + 8) != previous) {
+                    goto done;
+                }
+                if(load32(RAM, candidate) >= needed) {
+                    block = candidate;
+                    break;
+                }
+                previous = candidate;
+                candidate = load32(RAM, candidate + 4);
+            }
+            bin++;
+        }
+
+        uint64_t larger = load64(RAM, HEAP_FIELD(&layout, nonEmpty)) & (bin < 64 ? ~(uint64_t)0 << bin : 0);
+        if(block == 0 && larger != 0) {
+            bin = (size_t)__builtin_ctzll(larger);
+            if(bin >= HEAP_BINS) {
+                goto done;
+            }
+            block = load32(RAM, HEAP_FIELD(&layout, bins) + bin * sizeof(uint32_t));
+            if(block == 0 || free_link(RAM, &layout, block, bin) == false) {
+                goto done;
+            }
+        }
+    }
+
+    if(block == 0) {
+        store32(RAM, HEAP_FIELD(&layout, failedAllocations), load32(RAM, HEAP_FIELD(&layout, failedAllocations)) + 1);
+        success = true;
+        goto done;
+    }
+
+    blockSize = load32(RAM, block);
+    if(blockSize < needed || heap_remove(RAM, &layout, block, blockSize) == false) {
+        goto done;
+    }
+    if(blockSize - needed >= HEAP_MIN_BLOCK) {
+        uint32_t rest = block + (uint32_t)needed;
+        write_tags(RAM, rest, blockSize - (uint32_t)needed, 0);
+        if(heap_insert(RAM, &layout, rest, blockSize - (uint32_t)needed) == false) {
+            goto done;
+        }
+        blockSize = (uint32_t)needed;
+    }
+    write_tags(RAM, block, blockSize, HEAP_USED);
+
+    uint32_t used = load32(RAM, HEAP_FIELD(&layout, usedBytes)) + blockSize;
+    store32(RAM, HEAP_FIELD(&layout, usedBytes), used);
+    if(used > load32(RAM, HEAP_FIELD(&layout, peakUsedBytes))) {
+        store32(RAM, HEAP_FIELD(&layout, peakUsedBytes), used);
+    }
+    store32(RAM, HEAP_FIELD(&layout, allocations), load32(RAM, HEAP_FIELD(&layout, allocations)) + 1);
+
+    *address = block + HEAP_TAG_SIZE;
+    store32(RAM, *address, size);
+    success = true;
+
+done:
+    if(vm->cores != NULL) {
+        pthread_mutex_unlock(&(vm->cores->heapLock));
+    }
+    return success;
+}
+
+
+/**
+ * @brief Free a block returned by heap_allocate (FREE), merging it with free neighbours.
+ *
+ * @param vm The VM (or core) executing the FREE.
+ * @param address Address returned by ALLOCATE - 0 is ignored.
+ * @return false if the address is not an allocated block (never allocated or already freed), or the heap's tags
+ * or free lists were overwritten by the program.
+ */
+bool heap_free(VirtualMachine *vm, uint32_t address) {
+
+    if(address == 0) {
+        return true;
+    }
+
+    if(vm->cores != NULL) {
+        pthread_mutex_lock(&(vm->cores->heapLock));
+    }
+
+    uint8_t *RAM = vm->ramArray;
+    HeapLayout layout;
+    bool success = false;
+    if(heap_layout(vm, &layout) == false || load32(RAM, HEAP_FIELD(&layout, magic)) != HEAP_MAGIC) {
+        goto done;
+    }
+
+    uint32_t block = address - HEAP_TAG_SIZE;
+    if(address % HEAP_ALIGNMENT != 0 || address < layout.first + HEAP_TAG_SIZE || (size_t)block + HEAP_MIN_BLOCK > layout.end) {
+        goto done;
+    }
+    uint32_t tag = load32(RAM, block);
+    uint32_t size = tag & ~HEAP_USED;
+    if((tag & HEAP_USED) == 0 || size < HEAP_MIN_BLOCK || size % HEAP_ALIGNMENT != 0 || size > layout.end - block
+    || load32(RAM, block + size - HEAP_TAG_SIZE) != tag) {
+        goto done;
+    }
+
+    //Neighbours are only merged once they check out as free blocks - the prologue and epilogue are used tags
+    uint32_t previousTag = load32(RAM, block - HEAP_TAG_SIZE);
+    uint32_t previousSize = 0;
+    if((previousTag & HEAP_USED) == 0) {
+        if(previousTag > block - layout.first || free_block(RAM, &layout, block - previousTag, &previousSize) == false
+        || previousSize != previousTag) {
+            goto done;
+        }
+    }
+    uint32_t nextTag = load32(RAM, block + size);
+    uint32_t nextSize = 0;
+    if((nextTag & HEAP_USED) == 0 && free_block(RAM, &layout, block + size, &nextSize) == false) {
+        goto done;
+    }
+
+    if(previousSize != 0) {
+        if(heap_remove(RAM, &layout, block - previousSize, previousSize) == false) {
+            goto done;
+        }
+        block -= previousSize;
+        size += previousSize;
+    }
+    if(nextSize != 0) {
+        if(heap_remove(RAM, &layout, block + size, nextSize) == false) {
+            goto done;
+        }
+        size += nextSize;
+    }
+
+    store32(RAM, HEAP_FIELD(&layout, usedBytes), load32(RAM, HEAP_FIELD(&layout, usedBytes)) - (tag & ~HEAP_USED));
+    store32(RAM, HEAP_FIELD(&layout, frees), load32(RAM, HEAP_FIELD(&layout, frees)) + 1);
+    write_tags(RAM, block, size, 0);
+    success = heap_insert(RAM, &layout, block, size);
+
+done:
+    if(vm->cores != NULL) {
+        pthread_mutex_unlock(&(vm->cores->heapLock));
+    }
+    return success;
+}
+
+
+/**
+ * @brief Bytes currently in allocated blocks, read from the heap header without walking the blocks.
+ *
+ * @param vm The VM.
+ * @return The live heap bytes (tags included), 0 if the program has not allocated anything.
+ */
+size_t heap_used_bytes(VirtualMachine *vm) {
+
+    HeapLayout layout;
+    if(heap_layout(vm, &layout) == false || load32(vm->ramArray, HEAP_FIELD(&layout, magic)) != HEAP_MAGIC) {
+        return 0;
+    }
+    return load32(vm->ramArray, HEAP_FIELD(&layout, usedBytes));
+}
+
+
+/**
+ * @brief Summarise the heap by walking every block.
+ *
+ * @param vm The VM.
+ * @param statistics Where the statistics are placed (zeroed if the program has not allocated anything).
+ * @return false if the heap's tags are corrupt (the program wrote over them), true otherwise.
+ */
+bool heap_statistics(VirtualMachine *vm, VMHeapStatistics *statistics) {
+
+    memset(statistics, 0, sizeof(*statistics));
+
+    uint8_t *RAM = vm->ramArray;
+    HeapLayout layout;
+    if(heap_layout(vm, &layout) == false || load32(RAM, HEAP_FIELD(&layout, magic)) != HEAP_MAGIC) {
+        return true;
+    }
+
+    statistics->initialised = true;
+    statistics->heapBytes = layout.end - layout.first;
+    statistics->peakUsedBytes = load32(RAM, HEAP_FIELD(&layout, peakUsedBytes));
+    statistics->allocations = load32(RAM, HEAP_FIELD(&layout, allocations));
+    statistics->frees = load32(RAM, HEAP_FIELD(&layout, frees));
+    statistics->failedAllocations = load32(RAM, HEAP_FIELD(&layout, failedAllocations));
+
+    size_t block = layout.first;
+    while(block < layout.end) {
+        uint32_t tag = load32(RAM, block);
+        size_t size = tag & ~HEAP_USED;
+        if(size < HEAP_MIN_BLOCK || size > layout.end - block) {
+            return false;
+        }
+
+        if((tag & HEAP_USED) != 0) {
+            statistics->usedBytes += size;
+            statistics->usedBlocks++;
+        } else {
+            statistics->freeBytes += size;
+            statistics->freeBlocks++;
+            if(size > statistics->largestFreeBlock) {
+                statistics->largestFreeBlock = size;
+            }
+        }
+        block += size;
+    }
+
+    if(statistics->freeBytes != 0) {
+        statistics->fragmentation = 1.0 - (double)statistics->largestFreeBlock / (double)statistics->freeBytes;
+    }
+
+    return true;
+}
@@ -0,0 +1,56 @@
+/*
+ * intepret_IR_heap.h
+ *
+ * Description:
+ * Allocator behind the ALLOCATE and FREE instructions. Blocks are carved out of the VM's own RAM (from heapStart
+ * to the end of RAM) and every piece of allocator state is kept in that RAM too, so resetting, snapshotting and
+ * restoring a VM needs no extra work.
+ *
+ * Data Structure:
+ * - Heap header at heapStart: free list heads for each size class and a bitmap of which lists are non empty.
+ * - Blocks: a 4 byte tag before and after every block (size | used bit), so the neighbours of a freed block are
+ *   found without searching and merged immediately. Free blocks hold their list links after the first tag.
+ * - Size classes: one exact class per 8 bytes up to HEAP_SMALL_LIMIT, then one class per power of two. Small
+ *   requests are served from the head of their own list or the first non empty larger list (one bit scan).
+ *
+ * Usage:
+ * - `heap_allocate` places the address of a block of at least the requested bytes, or 0 if RAM is exhausted.
+ *   The first 4 bytes of the block hold the requested size.
+ * - `heap_free` returns false if the address is not an allocated block (the caller raises INTERRUPT_HEAP).
+ * - Tags and list links are program RAM, so every size and address read from the heap is checked (inside the
+ *   heap, aligned, matching tags, links pointing back) before it is followed. Both functions return false if the
+ *   program has overwritten them (the caller raises INTERRUPT_HEAP).
+ * - The heap is set up by the first ALLOCATE after RAM was cleared - RAM below heapStart is never touched.
+ */
+#ifndef INTEPRET_IR_HEAP_H
+#define INTEPRET_IR_HEAP_H
+#include "intepret_IR_structs.h"
+
+
+#define HEAP_ALIGNMENT 8        //Block payloads start on 8 byte boundaries
+#define HEAP_SMALL_LIMIT 256    //Largest block with an exact size class
+
+
+typedef struct VMHeapStatistics {
+    bool initialised;           ///< false if the program has not allocated anything yet.
+    size_t heapBytes;           ///< Bytes of RAM managed by the allocator (header excluded).
+    size_t usedBytes;           ///< Bytes in allocated blocks (tags included).
+    size_t peakUsedBytes;       ///< Highest usedBytes so far.
+    size_t freeBytes;           ///< Bytes in free blocks (tags included).
+    size_t usedBlocks;
+    size_t freeBlocks;
+    size_t largestFreeBlock;    ///< Largest allocation that can currently succeed is 8 bytes less.
+    size_t allocations;         ///< Successful ALLOCATEs.
+    size_t frees;               ///< Successful FREEs.
+    size_t failedAllocations;   ///< ALLOCATEs that returned 0.
+    double fragmentation;       ///< 1 - largestFreeBlock / freeBytes (0 when all free memory is one block).
+} VMHeapStatistics;
+
+
+bool heap_allocate(VirtualMachine *vm, uint32_t size, uint32_t *address);
+bool heap_free(VirtualMachine *vm, uint32_t address);
+size_t heap_used_bytes(VirtualMachine *vm);
+bool heap_statistics(VirtualMachine *vm, VMHeapStatistics *statistics);
+
+
+#endif
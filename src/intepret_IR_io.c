@@ -0,0 +1,597 @@
+#include "intepret_IR_io.h"
+#include <errno.h>
+#include <float.h>
+
+
+
+#define MAX_NUMBER_LENGTH 64 //Longest OUTPUT_I/OUTPUT_F text ("%f" of -FLT_MAX is 47 characters)
+
+
+/**
+ * @brief Write all of a block of output to a stream's file descriptor.
+ *
+ * Streams without a file descriptor (fmemopen, fopencookie) are written through stdio instead.
+ *
+ * @param stream The output stream.
+ * @param data The output.
+ * @param length Bytes of output.
+ * @return true if everything was written, false on an I/O error.
+ */
+static bool write_all(FILE *stream, const char *data, size_t length) {
+
+    int file = fileno(stream);
+    if(file < 0) {
+        return (fwrite(data, 1, length, stream) == length);
+    }
+
+    fflush(stream); //Anything the embedder printed to the stream goes first
+    while(length > 0) {
+        ssize_t written = write(file, data, length);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Write out the VM's pending output.
+ *
+ * @param vm The VM (or core) whose output is written.
+ * @return true if the output was written, false on an I/O error (the output is dropped).
+ */
+bool output_flush(VirtualMachine *vm) {
+
+    if(vm->outputUsed == 0) {
+        return true;
+    }
+
+    VMCores *cores = vm->cores;
+    if(cores != NULL) {
+        pthread_mutex_lock(&(cores->outputLock));
+    }
+    bool success = write_all(vm->output, vm->outputBuffer, vm->outputUsed);
+    if(cores != NULL) {
+        pthread_mutex_unlock(&(cores->outputLock));
+    }
+    vm->outputUsed = 0;
+
+    return success;
+}
+
+
+/**
+ * @brief Make room for a number in the output buffer.
+ *
+ * @param vm The VM being run.
+ * @return Where the number is written.
+ */
+static inline char *reserve_number(VirtualMachine *vm) {
+
+    if(vm->outputUsed + MAX_NUMBER_LENGTH > VM_OUTPUT_BUFFER_SIZE) {
+        output_flush(vm);
+    }
+
+    return vm->outputBuffer + vm->outputUsed;
+}
+
+
+/**
+ * @brief Write a number in decimal, ending just before end.
+ *
+ * @param end One past the last digit.
+ * @param value The number.
+ * @param minimumDigits Leading zeros are added up to this many digits.
+ * @return The first digit.
+ */
+static inline char *write_digits(char *end, uint64_t value, int minimumDigits) {
+
+    char *first = end;
+    do {
+        first--;
+        *first = (char)('0' + value % 10);
+        value /= 10;
+        minimumDigits--;
+    } while(value != 0 || minimumDigits > 0);
+
+    return first;
+}
+
+
+/**
+ * @brief Append an integer in decimal (OUTPUT_I) - the same text as printf("%d").
+ *
+ * @param vm The VM being run.
+ * @param value The integer.
+ */
+void output_integer(VirtualMachine *vm, INT_TYPE value) {
+
+    char digits[MAX_NUMBER_LENGTH];
+    uint32_t magnitude = (value < 0 ? 0u - (uint32_t)value : (uint32_t)value); //INT_MIN has no positive INT_TYPE
+    char *first = write_digits(digits + sizeof(digits), magnitude, 1);
+    if(value < 0) {
+        first--;
+        *first = '-';
+    }
+
+    size_t length = (size_t)(digits + sizeof(digits) - first);
+    memcpy(reserve_number(vm), first, length);
+    vm->outputUsed += length;
+
+    return;
+}
+
+
+/**
+ * @brief Append a float (OUTPUT_F) - the same text as printf("%f").
+ *
+ * A float is mantissa * 2^exponent with a 24 bit mantissa, so while it is below 2^39 its value in millionths is
+ * found exactly with 64 bit integers and rounded half to even like printf. Larger values, infinities and NaN are
+ * left to snprintf.
+ *
+ * @param vm The VM being run.
+ * @param value The float.
+ */
+void output_float(VirtualMachine *vm, float value) {
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t biasedExponent = (bits >> 23) & 0xFF;
+    uint64_t mantissa = bits & 0x7FFFFF;
+    int exponent = (biasedExponent == 0 ? -149 : (int)biasedExponent - 150); //Subnormals have no implicit bit
+    if(biasedExponent != 0) {
+        mantissa |= 0x800000;
+    }
+
+    if(biasedExponent == 0xFF || exponent > 39 - 24) {
+        int length = snprintf(reserve_number(vm), MAX_NUMBER_LENGTH, "%f", value);
+        if(length > 0) {
+            vm->outputUsed += (size_t)length;
+        }
+        return;
+    }
+
+    uint64_t millionths = 0;
+    if(exponent >= 0) {
+        millionths = (mantissa << exponent) * 1000000;
+    } else if(exponent > -64) {
+        uint64_t scaled = mantissa * 1000000; //Below 2^44
+        uint64_t remainder = scaled & ((1ull << -exponent) - 1);
+        uint64_t half = 1ull << (-exponent - 1);
+        millionths = scaled >> -exponent;
+        if(remainder > half || (remainder == half && (millionths & 1) == 1)) {
+            millionths++;
+        }
+    } //Otherwise below 2^-40 - rounds to 0
+
+    char digits[MAX_NUMBER_LENGTH];
+    char *first = write_digits(digits + sizeof(digits), millionths % 1000000, 6);
+    first--;
+    *first = '.';
+    first = write_digits(first, millionths / 1000000, 1);
+    if((bits >> 31) != 0) {
+        first--;
+        *first = '-';
+    }
+
+    size_t length = (size_t)(digits + sizeof(digits) - first);
+    memcpy(reserve_number(vm), first, length);
+    vm->outputUsed += length;
+
+    return;
+}
+
+
+/**
+ * @brief Append a character (OUTPUT_C) - the low byte of the register, like putc.
+ *
+ * A newline flushes the output if it is line buffered.
+ *
+ * @param vm The VM being run.
+ * @param value The register value.
+ */
+void output_character(VirtualMachine *vm, INT_TYPE value) {
+
+    if(vm->outputUsed == VM_OUTPUT_BUFFER_SIZE) {
+        output_flush(vm);
+    }
+
+    vm->outputBuffer[vm->outputUsed] = (char)value;
+    vm->outputUsed++;
+    if((char)value == '\n' && vm->flushLines == true) {
+        output_flush(vm);
+    }
+
+    return;
+}
+
+
+
+/**
+ * @brief Read more input once every byte read so far has been parsed.
+ *
+ * Pending output is written first, since the program may now wait for input. Reads a whole block from the input
+ * stream's file descriptor, or a single character through stdio while debugging (the debugger reads its commands
+ * from the same stream) or if the stream has no file descriptor.
+ *
+ * @param vm The VM being run.
+ * @return true if input was read, false at the end of the input or on an I/O error.
+ */
+static bool refill_input(VirtualMachine *vm) {
+
+    VMInputBuffer *buffer = vm->inputBuffer;
+    output_flush(vm);
+    buffer->start = 0;
+    buffer->end = 0;
+
+    int file = fileno(vm->input);
+    if(file < 0 || vm->debugOpcodes != NULL) {
+        int character = getc(vm->input);
+        if(character == EOF) {
+            return false;
+        }
+        buffer->data[0] = (char)character;
+        buffer->end = 1;
+        return true;
+    }
+
+    for(;;) {
+        ssize_t bytes = read(file, buffer->data, VM_INPUT_BUFFER_SIZE);
+        if(bytes > 0) {
+            buffer->end = (size_t)bytes;
+            return true;
+        }
+        if(bytes == 0 || errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+
+/**
+ * @brief Next byte of input, without consuming it.
+ *
+ * @param vm The VM being run.
+ * @return The byte, or EOF.
+ */
+static inline int peek_input(VirtualMachine *vm) {
+
+    VMInputBuffer *buffer = vm->inputBuffer;
+    if(buffer->start == buffer->end && refill_input(vm) == false) {
+        return EOF;
+    }
+
+    return (unsigned char)buffer->data[buffer->start];
+}
+
+
+/**
+ * @brief Consume the byte returned by peek_input and return the one after it.
+ */
+static inline int next_input(VirtualMachine *vm) {
+
+    vm->inputBuffer->start++;
+
+    return peek_input(vm);
+}
+
+
+/**
+ * @brief Skip whitespace like the scanf conversions other than %c (" \t\n\v\f\r").
+ *
+ * @param vm The VM being run.
+ * @return The first byte that is not whitespace (not consumed), or EOF.
+ */
+static int skip_whitespace(VirtualMachine *vm) {
+
+    int character = peek_input(vm);
+    while(character == ' ' || (character >= '\t' && character <= '\r')) {
+        character = next_input(vm);
+    }
+
+    return character;
+}
+
+
+static void lock_input(VirtualMachine *vm) {
+
+    if(vm->cores != NULL) {
+        pthread_mutex_lock(&(vm->cores->inputLock));
+    }
+
+    return;
+}
+
+
+static void unlock_input(VirtualMachine *vm) {
+
+    if(vm->cores != NULL) {
+        pthread_mutex_unlock(&(vm->cores->inputLock));
+    }
+
+    return;
+}
+
+
+/**
+ * @brief Read an integer (INPUT_I) - the same as scanf("%d").
+ *
+ * Values outside the range of a long are clamped to it and then truncated to INT_TYPE, as glibc does.
+ *
+ * @param vm The VM being run.
+ * @param value Where the integer is placed (left unchanged on failure).
+ * @return true if an integer was read, false at the end of the input or if the input is not an integer.
+ */
+bool input_integer(VirtualMachine *vm, INT_TYPE *value) {
+
+    lock_input(vm);
+    int character = skip_whitespace(vm);
+    bool negative = (character == '-');
+    if(character == '-' || character == '+') {
+        character = next_input(vm);
+    }
+    if(character < '0' || character > '9') {
+        unlock_input(vm);
+        return false;
+    }
+
+    uint64_t magnitude = 0;
+    bool overflow = false;
+    while(character >= '0' && character <= '9') {
+        if(magnitude > (UINT64_MAX - 9) / 10) {
+            overflow = true;
+        } else {
+            magnitude = magnitude * 10 + (uint64_t)(character - '0');
+        }
+        character = next_input(vm);
+    }
+    unlock_input(vm);
+
+    int64_t result = 0;
+    if(negative == true) {
+        result = (overflow == true || magnitude > (uint64_t)INT64_MAX + 1 ? INT64_MIN : (int64_t)(0 - magnitude));
+    } else {
+        result = (overflow == true || magnitude > (uint64_t)INT64_MAX ? INT64_MAX : (int64_t)magnitude);
+    }
+    *value = (INT_TYPE)(uint32_t)(uint64_t)result;
+
+    return true;
+}
+
+
+//Text of a float being read - on the stack unless it is very long
+typedef struct FloatText {
+    char *text;
+    size_t length;
+    size_t capacity;
+    char local[MAX_NUMBER_LENGTH * 4];
+} FloatText;
+
+
+/**
+ * @brief Keep the current byte of input as part of the float and move on to the next.
+ *
+ * @return The next byte, or EOF.
+ */
+static int keep_input(VirtualMachine *vm, FloatText *text, int character) {
+
+    if(text->length + 1 == text->capacity) {
+        size_t capacity = text->capacity * 2;
+        char *grown = (char*)malloc(capacity);
+        if(grown != NULL) { //Otherwise the digits past the end are dropped
+            memcpy(grown, text->text, text->length);
+            if(text->text != text->local) {
+                free(text->text);
+            }
+            text->text = grown;
+            text->capacity = capacity;
+        }
+    }
+    if(text->length + 1 < text->capacity) {
+        text->text[text->length] = (char)character;
+        text->length++;
+    }
+
+    return next_input(vm);
+}
+
+
+/**
+ * @brief Consume a word (case insensitive) as part of the float.
+ *
+ * @return true if the whole word was there, false if the input stopped matching it (the matching part is consumed).
+ */
+static bool keep_word(VirtualMachine *vm, FloatText *text, int *character, const char *word) {
+
+    for(; *word != '\0'; word++) {
+        if(tolower(*character) != *word) {
+            return false;
+        }
+        *character = keep_input(vm, text, *character);
+    }
+
+    return true;
+}
+
+
+static bool is_hex_digit(int character) {
+    return ((character >= '0' && character <= '9') || (tolower(character) >= 'a' && tolower(character) <= 'f'));
+}
+
+
+/**
+ * @brief Read a float (INPUT_F) - the same as scanf("%f").
+ *
+ * The input is consumed exactly as glibc's scanf does, including infinity, NaN and hexadecimal floats. A decimal
+ * with at most 7 significant digits and an exponent of at most 10 is one correctly rounded float multiply or
+ * divide, as 10^10 is still exact in a float. Anything else is converted with strtof.
+ *
+ * @param vm The VM being run.
+ * @param value Where the float is placed (left unchanged on failure).
+ * @return true if a float was read, false at the end of the input or if the input is not a float.
+ */
+bool input_float(VirtualMachine *vm, float *value) {
+
+    static const float powersOfTen[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+    FloatText text;
+    text.text = text.local;
+    text.length = 0;
+    text.capacity = sizeof(text.local);
+
+    lock_input(vm);
+    int character = skip_whitespace(vm);
+    bool negative = (character == '-');
+    if(character == '-' || character == '+') {
+        character = keep_input(vm, &text, character);
+    }
+
+    bool valid = true;
+    bool simple = false;        //Plain decimal, so mantissa and exponent below hold its value
+    uint64_t mantissa = 0;
+    int significantDigits = 0;
+    int exponent = 0;
+    if(tolower(character) == 'i') {
+        valid = keep_word(vm, &text, &character, "inf");
+        if(valid == true && tolower(character) == 'i') {
+            valid = keep_word(vm, &text, &character, "inity");
+        }
+
+    } else if(tolower(character) == 'n') {
+        valid = keep_word(vm, &text, &character, "nan");
+
+    } else if(character == '0' && (character = keep_input(vm, &text, character), tolower(character) == 'x')) {
+        character = keep_input(vm, &text, character);
+        valid = (is_hex_digit(character) == true || character == '.');
+        while(valid == true && is_hex_digit(character) == true) {
+            character = keep_input(vm, &text, character);
+        }
+        if(valid == true && character == '.') {
+            character = keep_input(vm, &text, character);
+            while(is_hex_digit(character) == true) {
+                character = keep_input(vm, &text, character);
+            }
+        }
+        if(valid == true && tolower(character) == 'p') {
+            character = keep_input(vm, &text, character);
+            if(character == '-' || character == '+') {
+                character = keep_input(vm, &text, character);
+            }
+            while(character >= '0' && character <= '9') {
+                character = keep_input(vm, &text, character);
+            }
+        }
+
+    } else {
+        bool digits = (text.length > 0 && text.text[text.length - 1] == '0'); //A leading 0 already kept
+        simple = true;
+        for(bool fraction = false;; character = keep_input(vm, &text, character)) {
+            if(character == '.' && fraction == false) {
+                fraction = true;
+                continue;
+            }
+            if(character < '0' || character > '9') {
+                break;
+            }
+            digits = true;
+            if(significantDigits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(character - '0');
+                significantDigits += (mantissa != 0);
+                exponent -= (fraction == true);
+            } else {
+                exponent += (fraction == false);
+            }
+        }
+        valid = digits;
+
+        if(valid == true && tolower(character) == 'e') {
+            character = keep_input(vm, &text, character);
+            bool negativeExponent = (character == '-');
+            if(character == '-' || character == '+') {
+                character = keep_input(vm, &text, character);
+            }
+            int written = 0;
+            for(; character >= '0' && character <= '9'; character = keep_input(vm, &text, character)) {
+                written = (written < 100000 ? written * 10 + (character - '0') : written);
+            }
+            exponent += (negativeExponent == true ? -written : written);
+        }
+    }
+    unlock_input(vm);
+
+    if(valid == true) {
+#if FLT_EVAL_METHOD == 0 //Float operations are rounded to float, not to a wider type
+        if(simple == true && mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10) {
+            float result = (exponent < 0 ? (float)mantissa / powersOfTen[-exponent] : (float)mantissa * powersOfTen[exponent]);
+            *value = (negative == true ? -result : result);
+        } else
+#endif
+        {
+            text.text[text.length] = '\0';
+            *value = strtof(text.text, NULL);
+        }
+    }
+
+    if(text.text != text.local) {
+        free(text.text);
+    }
+    return valid;
+}
+
+
+/**
+ * @brief Read one byte (INPUT_C) - the same as scanf("%c"), whitespace included.
+ *
+ * @param vm The VM being run.
+ * @param value Where the byte is placed, zero extended (left unchanged on failure).
+ * @return true if a byte was read, false at the end of the input.
+ */
+bool input_character(VirtualMachine *vm, INT_TYPE *value) {
+
+    lock_input(vm);
+    int character = peek_input(vm);
+    if(character != EOF) {
+        vm->inputBuffer->start++;
+        *value = (INT_TYPE)character;
+    }
+    unlock_input(vm);
+
+    return (character != EOF);
+}
+
+
+/**
+ * @brief Hand input read ahead but not parsed back to the input stream, once a run ends.
+ *
+ * Seekable input is rewound to the first byte not parsed, and a single character read while debugging is pushed
+ * back with ungetc, so whatever reads the stream next sees it. Input read ahead from a pipe or terminal can not
+ * be given back - it stays in the buffer for the next run on the same stream.
+ *
+ * @param vm The VM that finished running.
+ */
+void input_release(VirtualMachine *vm) {
+
+    VMInputBuffer *buffer = vm->inputBuffer;
+    size_t unread = buffer->end - buffer->start;
+    if(unread == 0) {
+        return;
+    }
+
+    int file = fileno(vm->input);
+    if(file < 0 || vm->debugOpcodes != NULL) {
+        if(unread == 1 && ungetc((unsigned char)buffer->data[buffer->start], vm->input) != EOF) {
+            buffer->start = buffer->end;
+        }
+    } else if(lseek(file, -(off_t)unread, SEEK_CUR) != -1) {
+        buffer->start = buffer->end;
+    }
+
+    return;
+}
@@ -0,0 +1,56 @@
+/*
+ * intepret_IR_io.h
+ *
+ * Description:
+ * Terminal I/O behind the INPUT_x and OUTPUT_x instructions. Neither goes through stdio's formatted I/O.
+ *
+ * OUTPUT_x formats values straight into a buffer owned by the VM, which is handed to the output stream's file
+ * descriptor with one write once it fills up or the program has to wait for something:
+ *
+ * - INPUT_x has run out of input and is about to read more (so prompts are shown first)
+ * - A paced VM is about to sleep
+ * - The run ends (program finished, interrupt, breakpoint or snapshot label)
+ * - Multi-core - the core reaches PARALLEL_START or SYNC, or stops, so output keeps the order the cores are
+ *   synchronised in
+ * - With line buffering (set_VM_line_buffered, or the output is a terminal) - every newline
+ *
+ * INPUT_x reads the input stream's file descriptor a block at a time and parses the buffered bytes itself. Numbers
+ * are read exactly as scanf("%d") and scanf("%f") read them (leading whitespace skipped, the same bytes consumed,
+ * the same values) and INPUT_C as scanf("%c"). Input is read a character at a time through stdio instead while
+ * debugging, since the debugger reads its commands from the same stream.
+ *
+ * Data Structure:
+ * - outputBuffer (VirtualMachine): VM_OUTPUT_BUFFER_SIZE bytes, outputUsed of them pending. Every core has its own,
+ *   writes of different cores are serialised by the cores' outputLock.
+ * - VMInputBuffer (intepret_IR_structs.h): VM_INPUT_BUFFER_SIZE bytes read ahead, shared by every core and
+ *   serialised by the cores' inputLock.
+ *
+ * Usage:
+ * - `output_integer`, `output_float` and `output_character` append one value.
+ * - `output_flush` writes out whatever is pending. Anything already written to the output stream through stdio
+ *   is flushed first, so the two never overtake each other.
+ * - `input_integer`, `input_float` and `input_character` read one value, false at the end of the input or if it
+ *   does not hold a value of that type (the caller raises INTERRUPT_INPUT).
+ * - `input_release` once a run ends - input read ahead is handed back to the stream where possible. Do not read
+ *   the input stream through stdio while a VM is reading it.
+ */
+#ifndef INTEPRET_IR_IO_H
+#define INTEPRET_IR_IO_H
+#include "intepret_IR_structs.h"
+
+
+#define VM_OUTPUT_BUFFER_SIZE 65536 //Bytes of output collected before a write
+#define VM_INPUT_BUFFER_SIZE 65536  //Bytes of input read at a time
+
+
+void output_integer(VirtualMachine *vm, INT_TYPE value);
+void output_float(VirtualMachine *vm, float value);
+void output_character(VirtualMachine *vm, INT_TYPE value);
+bool output_flush(VirtualMachine *vm);
+bool input_integer(VirtualMachine *vm, INT_TYPE *value);
+bool input_float(VirtualMachine *vm, float *value);
+bool input_character(VirtualMachine *vm, INT_TYPE *value);
+void input_release(VirtualMachine *vm);
+
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * intepret_IR_structs.h
+ *
+ * Description:
+ * Defines the data structures shared by the parts of the IR virtual machine - the decoded instruction format,
+ * the opcodes it uses and the state of the VM itself. Only the VM's own source files include this header,
+ * everything else uses the interface in intepret_IR.h.
+ *
+ * Key Components:
+ * - VALID_INSTRUCTIONS: Every opcode the interpreter executes, including interpreter only opcodes.
+ * - Instruction: A decoded IR line - registers, immediates and label targets are already resolved.
+ * - VirtualMachine: Registers, RAM, the loaded program and execution settings.
+ */
+#ifndef INTEPRET_IR_STRUCTS_H
+#define INTEPRET_IR_STRUCTS_H
+#include "intepret_IR.h"
+
+
+#define INT_TYPE int
+#define FLOAT_TYPE float
+
+
+typedef union DataTypes {
+
+    INT_TYPE intVal;
+    FLOAT_TYPE floatVal;
+
+} DataTypes;
+
+
+
+typedef enum VALID_INSTRUCTIONS {
+    INVALID,  ///< Interpreter use only - not part of instruction set
+
+    ADD,      ///< Add instruction
+    SUB,      ///< Subtract instruction
+    MUL,      ///< Multiply instruction
+    DIV,      ///< Divide instruction
+    MOD,      ///< Mod instruction
+    ADD_F,    ///< Floating point add instruction
+    SUB_F,    ///< Floating point subtract instruction
+    MUL_F,    ///< Floating point multiply instruction
+    DIV_F,    ///< Floating point divide instruction
+
+    ADI,      ///< Add immediate instruction
+    SUI,      ///< Subtract immediate instruction
+    MUI,      ///< Multiply immediate instruction
+    DII,      ///< Divide immediate instruction
+    ADI_F,    ///< Floating point add immediate instruction
+    SUI_F,    ///< Floating point subtract immediate instruction
+    MUI_F,    ///< Floating point multiply immediate instruction
+    DII_F,    ///< Floating point divide immediate instruction
+
+    STR,      ///< Store instruction (ARG3.items bytes)
+    LOD,      ///< Load instruction (ARG3.items bytes)
+    GRT,      ///< Greater than instruction
+    GRE,      ///< Greater than or equal instruction
+    LTE,      ///< Less than or equal instruction
+    LES,      ///< Less than instruction
+    EQU,      ///< Equal instruction
+    NEQ,      ///< Not equal instruction
+    JMP,      ///< Jump instruction
+    JAL,      ///< Jump and link instruction
+    JRT,      ///< Jump return instruction
+    NOP,      ///< No operation instruction
+
+    INPUT_I,  ///< Read an integer from the terminal
+    INPUT_F,  ///< Read a float from the terminal
+    INPUT_C,  ///< Read a character from the terminal
+    OUTPUT_I, ///< Print an integer to the terminal
+    OUTPUT_F, ///< Print a float to the terminal
+    OUTPUT_C, ///< Print a character to the terminal
+
+    PARALLEL_START, ///< Start core ARG1 on the following block, continue after its PARALLEL_STOP (ARG3)
+    PARALLEL_STOP,  ///< End of a parallel block - the core executing it stops
+    SYNC,           ///< Wait for every running core to reach a SYNC with the same ID (ARG1)
+    ALLOCATE, ///< Allocate ARG2 bytes of RAM and place the address in ARG1 (0 if RAM is exhausted)
+    FREE,     ///< Free the block at the address in ARG1
+    VADD,     ///< Add ARG3 integers at the address in ARG2 to the ARG3 integers at the address in ARG1
+    VSUB,     ///< Subtract ARG3 integers at the address in ARG2 from the ARG3 integers at the address in ARG1
+    VMUL,     ///< Multiply ARG3 integers at the address in ARG1 by the ARG3 integers at the address in ARG2
+    VADD_F,   ///< VADD on floats
+    VSUB_F,   ///< VSUB on floats
+    VMUL_F,   ///< VMUL on floats
+
+    //Width specific STR/LOD - interpreter use only, chosen by the preprocessor from Xitems
+    STR_1,    ///< Store the low byte of a register
+    STR_2,    ///< Store the low two bytes of a register
+    STR_4,    ///< Store a whole register
+    LOD_1,    ///< Load one byte, zero extended
+    LOD_2,    ///< Load two bytes, zero extended
+    LOD_4,    ///< Load a whole register
+
+    //Superinstructions - interpreter use only, created by fuse_instructions from the pair they replace
+    ADI_GRT,  ///< ADI followed by GRT on its destination register
+    ADI_GRE,  ///< ADI followed by GRE on its destination register
+    ADI_LTE,  ///< ADI followed by LEQ on its destination register
+    ADI_LES,  ///< ADI followed by LES on its destination register
+    ADI_EQU,  ///< ADI followed by EQU on its destination register
+    ADI_NEQ,  ///< ADI followed by NEQ on its destination register
+    MUL_ADD,  ///< MUL followed by ADD reading its destination register
+    MUL_ADD_F, ///< MUL_F followed by ADD_F reading its destination register
+
+    BREAK,    ///< Interpreter use only - patched over an instruction by the debugger to stop before it
+    HALT,     ///< Interpreter use only - placed after the last instruction to end execution
+
+    NUM_INSTRUCTIONS, ///< Interpreter use only - number of opcodes
+} VALID_INSTRUCTIONS;
+
+
+
+typedef struct Instruction {
+
+    const void *handler; //Threaded engine only - address of the handler for this opcode
+    uint16_t opcode; //VALID_INSTRUCTIONS - decoded once by the preprocessor
+    uint16_t ARG1;   //Register
+    uint16_t ARG2;   //Register
+
+    union ARG3 {
+        uint32_t reg;               //Register
+        uint32_t label;             //Label - index into instruction memory once resolved
+        uint32_t items;             //Number of bytes moved by STR/LOD
+        INT_TYPE intImmediate;
+        FLOAT_TYPE floatImmediate;
+    } ARG3;
+
+} Instruction;
+
+
+typedef struct Label {
+    size_t labelID;  ///< Label number as written in the IR file
+    size_t address;  ///< Index of the instruction following the label definition
+} Label;
+
+
+typedef enum VM_INTERRUPT {
+    INTERRUPT_NONE,             ///< Program ran to completion
+    INTERRUPT_OOB,              ///< Out of bounds RAM access
+    INTERRUPT_DIVIDE_BY_ZERO,   ///< Integer division or mod by zero
+    INTERRUPT_STACK,            ///< JRT with nothing on the return stack or JAL past the return stack limit
+    INTERRUPT_INPUT,            ///< INPUT_x could not read a value
+    INTERRUPT_CORE,             ///< PARALLEL_START with an invalid core ID or the core could not be started
+    INTERRUPT_HEAP,             ///< FREE of an address that is not an allocated block, or the heap's tags were overwritten
+    INTERRUPT_BREAK,            ///< Debugger breakpoint or attach - not an error, execution can continue
+} VM_INTERRUPT;
+
+
+//Compiled block - returns the next instruction index, with JIT_BAILOUT set if that instruction must be interpreted
+//The VM is passed for the return stack used by JAL/JRT
+typedef uint64_t (*JITFunction)(DataTypes *registerArray, uint8_t *ramArray, uint64_t RAMsize, struct VirtualMachine *vm);
+
+typedef struct JITState {
+    JITFunction *blocks;   ///< Compiled block starting at each instruction (NULL if not compiled).
+    uint32_t *counters;    ///< Times each instruction was jumped to while not compiled (JIT_NEVER if it can not be compiled).
+    uint8_t *code;         ///< Executable buffer holding every compiled block.
+    size_t codeUsed;       ///< Bytes of the buffer in use.
+} JITState;
+
+typedef struct TraceState {
+    Instruction *program;    ///< Copy of the program (HALT included) followed by the superblocks, run by the trace engine.
+    size_t programSize;      ///< Instructions before the first superblock (numInstructions + 1).
+    size_t used;             ///< Instructions of program in use, superblocks included.
+    size_t capacity;         ///< Instructions program can hold.
+    uint32_t *origins;       ///< Program instruction each superblock instruction was copied from (from programSize).
+    uint32_t *counters;      ///< Arrivals at each loop head (TRACE_NOT_HEAD if the instruction is not a loop head).
+    uint32_t *entries;       ///< Superblock of each loop head (0 if it has none).
+    uint32_t *recorded;      ///< Instructions executed since recording started, in order.
+    size_t numRecorded;
+    size_t recordingHead;    ///< Loop head being recorded (SIZE_MAX if not recording).
+    const void *const *handlerTable; ///< Trace engine handlers - superblocks are threaded with them.
+    const void *countHandler; ///< Trace engine label counting arrivals at a loop head.
+    const void *enterHandler; ///< Trace engine label jumping from a loop head into its superblock.
+    size_t numTraces;        ///< Superblocks built.
+} TraceState;
+
+
+typedef struct SyncPoint {
+    uint16_t syncID;            ///< ID given to SYNC.
+    size_t arrived;             ///< Cores waiting at this sync.
+    size_t generation;          ///< Incremented every time the waiting cores are released.
+} SyncPoint;
+
+typedef struct VMInputBuffer {
+    size_t start;               ///< Next byte to parse.
+    size_t end;                 ///< One past the last byte read.
+    char data[];                ///< VM_INPUT_BUFFER_SIZE bytes read ahead from the input stream.
+} VMInputBuffer;
+
+typedef struct VMCores {
+    pthread_mutex_t lock;               ///< Protects everything below.
+    pthread_cond_t changed;             ///< Signalled when a core stops or a sync point is released.
+    pthread_mutex_t heapLock;           ///< Serialises ALLOCATE/FREE across cores.
+    pthread_mutex_t outputLock;         ///< Serialises writes of each core's output buffer.
+    pthread_mutex_t inputLock;          ///< Serialises INPUT_x across cores (they share one input buffer).
+    size_t numCores;                    ///< Core IDs are 0 (the core vm_run starts on) to numCores - 1.
+    VirtualMachine *cores;              ///< State of each requested core (index 0 unused).
+    pthread_t *threads;
+    bool *running;                      ///< Core is executing a parallel block.
+    bool *joinable;                     ///< Core's thread has been started and not joined yet.
+    size_t activeCores;                 ///< Cores taking part in syncs, core 0 included while it runs.
+    SyncPoint *syncPoints;
+    size_t numSyncPoints;
+    size_t syncPointsCapacity;
+    VM_INTERRUPT interrupt;             ///< First interrupt raised by a requested core.
+    size_t interruptCounter;            ///< Instruction that raised it.
+} VMCores;
+
+
+typedef struct VMStatistics {
+    uint64_t instructions;                      ///< Instructions executed (superinstructions count as two).
+    uint64_t branches;                          ///< Compare-branches, GOTO, JAL and JRT executed.
+    uint64_t branchesTaken;                     ///< Branches that jumped.
+    uint64_t opcodeCounts[NUM_INSTRUCTIONS];    ///< Times each opcode was executed (superinstructions are split).
+    uint64_t *registerCounts;                   ///< Times each register was used as an operand.
+    uint8_t *ramTouched;                        ///< Bitmap of RAM bytes written so far.
+    size_t ramBytesUsed;                        ///< RAM bytes written so far.
+    size_t stackDepth;                          ///< Current return stack depth.
+    size_t heapBytesUsed;                       ///< Live heap bytes after the last ALLOCATE or FREE.
+    bool heapChanged;                           ///< The last instruction was an ALLOCATE or FREE.
+    size_t peakMemory;                          ///< Highest memory in use (bytes).
+    size_t minimumMemory;                       ///< Lowest return stack plus live heap bytes once either was used.
+    bool memoryUsed;                            ///< minimumMemory has been set.
+    double seconds;                             ///< Wall clock time to run the program.
+} VMStatistics;
+
+
+typedef struct VMProfile {
+    uint32_t *callStack;        ///< Index of every JAL currently on the return stack, outermost first.
+    size_t depth;
+    size_t callStackCapacity;
+    uint32_t *samples;          ///< Samples packed as [number of frames][JAL indices...][program counter].
+    size_t samplesUsed;
+    size_t samplesCapacity;
+    size_t numSamples;
+} VMProfile;
+
+
+typedef bool (*WatchPredicate)(DataTypes value, DataTypes operand);
+
+typedef struct VMWatch {
+    uint16_t reg;               ///< Register watched.
+    WatchPredicate predicate;   ///< Compares the register with operand - chosen when the watch is set.
+    DataTypes operand;
+    VM_WATCH_COMPARISON comparison;
+    bool isFloat;
+} VMWatch;
+
+
+struct VMSnapshot {
+    int ramFile;                ///< memfd holding RAM - restored VMs map it MAP_PRIVATE.
+    size_t RAMsize;
+    DataTypes *registerArray;
+    size_t numRegisters;
+    size_t programCounter;
+    uint32_t *returnStack;      ///< Return addresses, bottom of the stack first.
+    size_t returnStackDepth;
+    size_t numInstructions;     ///< Size of the program the snapshot was taken from.
+};
+
+
+struct VirtualMachine {
+    size_t instructionsPerSecond;  ///< The number of instructions the VM can execute per second.
+    DataTypes *registerArray;      ///< Pointer to the array of registers.
+    size_t numRegisters;           ///< Number of registers in the register array.
+
+    uint8_t *ramArray;             ///< Pointer to the array representing the VM's RAM (byte addressed).
+    void *ramMapping;              ///< mmap region holding ramArray (NULL if ramArray is on the heap).
+    size_t ramMappingSize;
+    bool guardPages;               ///< RAM is followed by PROT_NONE pages, so out of bounds accesses fault.
+    Instruction *guardInstruction; ///< Guarded engine only - last memory instruction started.
+    size_t RAMsize;                ///< Size of the RAM array (NUMBER OF BYTES).
+    size_t heapStart;              ///< First RAM address used by ALLOCATE (RAM below is left to the program).
+
+    size_t programCounter;         ///< Index of the current instruction in the instruction set (COUNT BITS NOT BYTES).
+
+    Instruction *instructionMemory; ///< Decoded program, terminated by a HALT instruction.
+    size_t numInstructions;         ///< Number of decoded instructions (excluding the HALT).
+
+    uint32_t *returnStack;          ///< Return addresses pushed by JAL, bottom first (returnStackLimit entries).
+    size_t returnStackDepth;        ///< Return addresses currently on the stack.
+    size_t returnStackLimit;        ///< Calls that can be nested before JAL raises INTERRUPT_STACK.
+    VM_INTERRUPT interrupt;         ///< Set when execution stops because of an error.
+
+    Label *labels;                  ///< Label definitions sorted by address.
+    size_t numLabels;
+    void *programMapping;           ///< Bytecode file mapping holding instructionMemory (NULL if on the heap).
+    size_t programMappingSize;
+
+    VM_ENGINE engine;               ///< Engine used to execute the program.
+    size_t loadThreads;             ///< Threads used to decode large IR files (0 for one per core).
+    const void *const *handlerTable; ///< Handler table the instructions were threaded with (NULL if not threaded).
+    JITState jit;                   ///< Compiled blocks for the JIT engine (empty until the JIT engine runs).
+    TraceState trace;               ///< Superblocks for the trace engine (empty until the trace engine runs).
+    uint32_t jitThreshold;          ///< Jumps to an instruction before the block starting there is compiled (or the loop starting there is traced).
+    bool collectStatistics;         ///< Run with the instrumented engine and fill statistics.
+    VMStatistics statistics;        ///< Statistics of the last run (only if collectStatistics).
+    FILE *input;                    ///< Stream read by INPUT_x (stdin unless set_VM_streams is used).
+    FILE *output;                   ///< Stream written by OUTPUT_x (stdout unless set_VM_streams is used).
+    VMInputBuffer *inputBuffer;     ///< Input read but not parsed by INPUT_x yet, shared by every core (see intepret_IR_io.h).
+    char *outputBuffer;             ///< OUTPUT_x text not written to output yet (see intepret_IR_io.h).
+    size_t outputUsed;
+    bool lineBuffered;              ///< Output is written at every newline (set_VM_line_buffered).
+    bool flushLines;                ///< lineBuffered, or output is a terminal.
+    size_t numCores;                ///< Cores available to PARALLEL_START, including core 0.
+    size_t coreID;                  ///< Core this state belongs to (0 for the VM itself).
+    VMCores *cores;                 ///< Shared multi-core state (NULL if the program is single core).
+    bool collectProfile;            ///< Run with the sampling profiler engine and fill profile.
+    VMProfile profile;              ///< Samples of the last run (only if collectProfile).
+    uint16_t *debugOpcodes;         ///< Debugger only - opcode of every instruction without BREAK (NULL if not debugging).
+    bool *breakpoints;              ///< Debugger only - instructions patched with BREAK between runs.
+    volatile sig_atomic_t breakRequested; ///< vm_break patched every instruction - undone once the VM stops.
+    VMWatch *watches;               ///< Conditions that stop the VM when a register is written (see set_VM_watch).
+    size_t numWatches;
+    size_t triggeredWatch;          ///< Watch that stopped the last run (SIZE_MAX if none).
+
+};
+
+
+
+
+#endif
@@ -0,0 +1,298 @@
+#include "intepret_IR_trace.h"
+
+
+
+#define TRACE_AREA_SIZE 65536      //Superblock instructions shared by every loop of the program
+#define MAX_TRACE_INSTRUCTIONS 256 //Longest path recorded before a loop is given up on
+
+
+static bool is_superinstruction(uint16_t opcode) {
+    return (opcode >= ADI_GRT && opcode <= MUL_ADD_F);
+}
+
+
+/**
+ * @brief Opcode of the branch taken exactly when the given branch is not.
+ *
+ * Branches compare integers, so every condition has an exact inverse.
+ *
+ * @param opcode Any opcode.
+ * @return The inverted branch, or INVALID if opcode is not a conditional branch.
+ */
+static uint16_t inverted_branch(uint16_t opcode) {
+
+    switch(opcode) {
+        case GRT: return LTE;
+        case GRE: return LES;
+        case LTE: return GRT;
+        case LES: return GRE;
+        case EQU: return NEQ;
+        case NEQ: return EQU;
+        case ADI_GRT: return ADI_LTE;
+        case ADI_GRE: return ADI_LES;
+        case ADI_LTE: return ADI_GRT;
+        case ADI_LES: return ADI_GRE;
+        case ADI_EQU: return ADI_NEQ;
+        case ADI_NEQ: return ADI_EQU;
+        default: return INVALID;
+    }
+}
+
+
+/**
+ * @brief Stop recording without building a superblock - the loop head goes back to its plain handler for good.
+ *
+ * @param trace The trace state.
+ */
+static void abandon_trace(TraceState *trace) {
+
+    Instruction *head = &(trace->program[trace->recordingHead]);
+    head->handler = trace->handlerTable[head->opcode];
+    trace->recordingHead = SIZE_MAX;
+
+    return;
+}
+
+
+/**
+ * @brief Append one instruction to the superblock being built.
+ *
+ * @param trace The trace state.
+ * @param instruction The instruction to copy.
+ * @param origin Program instruction it stands for.
+ */
+static void emit_trace_instruction(TraceState *trace, Instruction instruction, size_t origin) {
+
+    instruction.handler = trace->handlerTable[instruction.opcode];
+    trace->program[trace->used] = instruction;
+    trace->origins[trace->used - trace->programSize] = (uint32_t)origin;
+    trace->used++;
+
+    return;
+}
+
+
+/**
+ * @brief Build the superblock for the recorded path and make its loop head enter it.
+ *
+ * @param trace The trace state, with a complete path recorded.
+ * @param end Instruction reached after the path - the loop head itself, or another loop head or superblock to exit to.
+ * @return true if the superblock was built, false if there is no room left for it.
+ */
+static bool build_superblock(TraceState *trace, size_t end) {
+
+    if(trace->used + 2 * trace->numRecorded + 2 > trace->capacity) { //At most two instructions per recorded one plus the exit
+        return false;
+    }
+
+    Instruction *program = trace->program;
+    size_t head = trace->recordingHead;
+    size_t start = trace->used;
+    size_t loopTarget = (end == head ? start : end);
+    bool closed = false;
+
+    for(size_t i = 0; i < trace->numRecorded; i++) {
+        size_t current = trace->recorded[i];
+        size_t next = (i + 1 < trace->numRecorded ? trace->recorded[i + 1] : end);
+        uint16_t opcode = program[current].opcode;
+        if(opcode == JMP) { //The path continues at its target
+            continue;
+        }
+
+        size_t size = (is_superinstruction(opcode) == true ? 2 : 1);
+        for(size_t j = 0; j < size; j++) {
+            emit_trace_instruction(trace, program[current + j], current + j);
+        }
+
+        uint16_t inverted = inverted_branch(opcode);
+        if(inverted == INVALID || next == current + size) { //Not a branch, or not taken - taking it is a side exit
+            continue;
+        }
+
+        Instruction *branch = &(program[trace->used - 1]);
+        if(i + 1 == trace->numRecorded && end == head) { //Loop back edge - stays a branch, falling through exits
+            branch->ARG3.label = (uint32_t)start;
+            Instruction exit = {.opcode = JMP, .ARG3.label = (uint32_t)(current + size)};
+            emit_trace_instruction(trace, exit, current);
+            closed = true;
+        } else { //Taken - falls through along the path, the way not recorded is the side exit
+            Instruction *first = &(program[trace->used - size]);
+            first->opcode = inverted;
+            first->handler = trace->handlerTable[inverted];
+            if(size == 2) { //Second half of a superinstruction keeps the plain branch
+                branch->opcode = inverted_branch(branch->opcode);
+            }
+            branch->ARG3.label = (uint32_t)(current + size);
+        }
+    }
+
+    if(closed == false) {
+        Instruction exit = {.opcode = JMP, .ARG3.label = (uint32_t)loopTarget};
+        emit_trace_instruction(trace, exit, trace->recorded[trace->numRecorded - 1]);
+    }
+
+    //Link - every jump to the loop head now lands in the superblock, only falling into the head goes through it
+    for(size_t i = 0; i < trace->used; i++) {
+        if(program[i].opcode >= GRT && program[i].opcode <= JMP && program[i].ARG3.label == head) {
+            program[i].ARG3.label = (uint32_t)start;
+        }
+    }
+    trace->entries[head] = (uint32_t)start;
+    program[head].handler = trace->enterHandler;
+    trace->numTraces++;
+
+    return true;
+}
+
+
+/**
+ * @brief Copy the loaded program for the trace engine and find its loop heads.
+ *
+ * A loop head is the target of a branch or JMP at or after it. The copy is threaded with handlerTable, loop heads
+ * with countHandler. Does nothing but abandon an unfinished recording if the program was already set up.
+ *
+ * @param vm The VM holding the program.
+ * @param handlerTable The trace engine's handlers, indexed by opcode.
+ * @param countHandler The trace engine's handler counting arrivals at a loop head.
+ * @param enterHandler The trace engine's handler entering a loop head's superblock.
+ * @return true if the trace engine can run, false if the copy could not be allocated.
+ */
+bool trace_initialise(VirtualMachine *vm, const void *const *handlerTable, const void *countHandler, const void *enterHandler) {
+
+    TraceState *trace = &(vm->trace);
+    if(trace->program != NULL) { //Already set up for this program - superblocks are kept between runs
+        if(trace->recordingHead != SIZE_MAX) { //Last run stopped while recording
+            abandon_trace(trace);
+        }
+        return true;
+    }
+
+    size_t programSize = vm->numInstructions + 1;
+    trace->program = (Instruction*)malloc((programSize + TRACE_AREA_SIZE) * sizeof(Instruction));
+    trace->origins = (uint32_t*)malloc(TRACE_AREA_SIZE * sizeof(uint32_t));
+    trace->counters = (uint32_t*)malloc(programSize * sizeof(uint32_t));
+    trace->entries = (uint32_t*)calloc(programSize, sizeof(uint32_t));
+    trace->recorded = (uint32_t*)malloc(MAX_TRACE_INSTRUCTIONS * sizeof(uint32_t));
+    if(trace->program == NULL || trace->origins == NULL || trace->counters == NULL || trace->entries == NULL
+    || trace->recorded == NULL) {
+        trace_destroy(vm);
+        return false;
+    }
+
+    trace->programSize = programSize;
+    trace->used = programSize;
+    trace->capacity = programSize + TRACE_AREA_SIZE;
+    trace->numRecorded = 0;
+    trace->recordingHead = SIZE_MAX;
+    trace->handlerTable = handlerTable;
+    trace->countHandler = countHandler;
+    trace->enterHandler = enterHandler;
+    trace->numTraces = 0;
+
+    Instruction *program = trace->program;
+    memcpy(program, vm->instructionMemory, programSize * sizeof(Instruction));
+    for(size_t i = 0; i < programSize; i++) {
+        program[i].handler = handlerTable[program[i].opcode];
+        trace->counters[i] = TRACE_NOT_HEAD;
+    }
+    for(size_t i = 0; i < vm->numInstructions; i++) {
+        if(program[i].opcode >= GRT && program[i].opcode <= JMP && program[i].ARG3.label <= i) {
+            trace->counters[program[i].ARG3.label] = 0;
+            program[program[i].ARG3.label].handler = countHandler;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Free the program copy and superblocks of the trace engine.
+ *
+ * @param vm The VM to free the trace state of.
+ */
+void trace_destroy(VirtualMachine *vm) {
+
+    TraceState *trace = &(vm->trace);
+    free(trace->program);
+    free(trace->origins);
+    free(trace->counters);
+    free(trace->entries);
+    free(trace->recorded);
+    memset(trace, 0, sizeof(TraceState));
+
+    return;
+}
+
+
+/**
+ * @brief Start recording the path taken from a loop head.
+ *
+ * @param vm The VM being run.
+ * @param head The loop head that passed the threshold.
+ */
+void trace_begin(VirtualMachine *vm, size_t head) {
+
+    vm->trace.recordingHead = head;
+    vm->trace.numRecorded = 0;
+
+    return;
+}
+
+
+/**
+ * @brief Record the instruction about to be executed.
+ *
+ * Recording ends at the loop head (the path is a loop) or at another loop head or superblock (the path exits to it). It is
+ * abandoned at anything a straight line can not hold - calls, returns, core control, the end of the program - or
+ * once the path gets too long.
+ *
+ * @param vm The VM being run.
+ * @param programCounter The instruction about to be executed (an index into the copy of the program).
+ * @return true if recording continues, false if it has ended and the instruction should run normally.
+ */
+bool trace_record(VirtualMachine *vm, size_t programCounter) {
+
+    TraceState *trace = &(vm->trace);
+
+    if(programCounter >= trace->programSize //Jumped into another loop's superblock
+    || (trace->numRecorded > 0 && trace->counters[programCounter] != TRACE_NOT_HEAD)) {
+        if(build_superblock(trace, programCounter) == false) {
+            abandon_trace(trace);
+        }
+        trace->recordingHead = SIZE_MAX;
+        return false;
+    }
+
+    switch(trace->program[programCounter].opcode) {
+        case JAL: case JRT: case PARALLEL_START: case PARALLEL_STOP: case SYNC: case BREAK: case HALT: case INVALID:
+            abandon_trace(trace);
+            return false;
+        default:
+            break;
+    }
+    if(trace->numRecorded == MAX_TRACE_INSTRUCTIONS) {
+        abandon_trace(trace);
+        return false;
+    }
+
+    trace->recorded[trace->numRecorded] = (uint32_t)programCounter;
+    trace->numRecorded++;
+    return true;
+}
+
+
+/**
+ * @brief Program instruction an instruction of the trace engine's copy stands for.
+ *
+ * @param vm The VM being run.
+ * @param programCounter Index into the copy of the program.
+ * @return Index into the program.
+ */
+size_t trace_program_counter(VirtualMachine *vm, size_t programCounter) {
+
+    if(programCounter < vm->trace.programSize) {
+        return programCounter;
+    }
+    return vm->trace.origins[programCounter - vm->trace.programSize];
+}
@@ -0,0 +1,42 @@
+/*
+ * intepret_IR_trace.h
+ *
+ * Description:
+ * Trace tier for the IR virtual machine. Loop heads (targets of backward branches) count how often they are
+ * reached. Once one passes the threshold, the instructions the next iteration executes are recorded and copied
+ * into a superblock - one straight line of instructions from the loop head back to it:
+ *
+ * - JMP is dropped, the recorded path simply continues at its target
+ * - A branch that was taken is inverted, so the recorded path falls through and the other path is a side exit
+ * - A branch that was not taken is copied as it is - taking it is the side exit
+ * - The branch closing the loop jumps to the start of the superblock, so the loop never leaves it
+ *
+ * Side exits are ordinary jumps back into the program, whose loop heads enter their own superblocks.
+ *
+ * Data Structure:
+ * - TraceState (intepret_IR_structs.h): The trace engine runs on its own copy of the program, with superblocks
+ *   stored after the HALT. Superblock instructions are plain instructions, so label operands index the copy and
+ *   every engine handler runs them unchanged.
+ *
+ * Usage:
+ * - `trace_initialise` before running a program with the trace engine, `trace_destroy` when it is unloaded.
+ * - `trace_begin` once a loop head passes the threshold, then `trace_record` before every instruction the engine
+ *   executes until it returns false - the superblock is then built (or recording was abandoned).
+ * - `trace_program_counter` maps an instruction of the copy back to the program.
+ */
+#ifndef INTEPRET_IR_TRACE_H
+#define INTEPRET_IR_TRACE_H
+#include "intepret_IR_structs.h"
+
+
+#define TRACE_NOT_HEAD UINT32_MAX //Counter value of an instruction that is not a loop head
+
+
+bool trace_initialise(VirtualMachine *vm, const void *const *handlerTable, const void *countHandler, const void *enterHandler);
+void trace_destroy(VirtualMachine *vm);
+void trace_begin(VirtualMachine *vm, size_t head);
+bool trace_record(VirtualMachine *vm, size_t programCounter);
+size_t trace_program_counter(VirtualMachine *vm, size_t programCounter);
+
+
+#endif
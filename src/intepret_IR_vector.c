@@ -0,0 +1,179 @@
+#include "intepret_IR_vector.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_X86
+#include <immintrin.h>
+#endif
+
+
+
+//Combines count elements at source into the count elements at destination, in place
+typedef void (*VectorKernel)(uint8_t *destination, const uint8_t *source, size_t count);
+
+
+static VectorKernel vectorKernels[NUM_VECTOR_OPERATIONS];
+static const char *vectorInstructionSet = "scalar";
+static pthread_once_t vectorKernelsOnce = PTHREAD_ONCE_INIT;
+
+
+
+//Scalar kernels - one element at a time through memcpy, so neither range has to be aligned
+#define SCALAR_KERNEL(name, type, operator) \
+static void name(uint8_t *destination, const uint8_t *source, size_t count) { \
+    for(size_t i = 0; i < count; i++) { \
+        type left; \
+        type right; \
+        memcpy(&left, destination + i * VECTOR_ELEMENT_SIZE, VECTOR_ELEMENT_SIZE); \
+        memcpy(&right, source + i * VECTOR_ELEMENT_SIZE, VECTOR_ELEMENT_SIZE); \
+        left = left operator right; \
+        memcpy(destination + i * VECTOR_ELEMENT_SIZE, &left, VECTOR_ELEMENT_SIZE); \
+    } \
+}
+
+SCALAR_KERNEL(scalar_add, uint32_t, +) //Unsigned so integer overflow wraps like the scalar instructions
+SCALAR_KERNEL(scalar_sub, uint32_t, -)
+SCALAR_KERNEL(scalar_mul, uint32_t, *)
+SCALAR_KERNEL(scalar_add_f, float, +)
+SCALAR_KERNEL(scalar_sub_f, float, -)
+SCALAR_KERNEL(scalar_mul_f, float, *)
+
+//Indexed by VECTOR_OPERATION
+static const VectorKernel scalarKernels[NUM_VECTOR_OPERATIONS] = {
+    [VECTOR_ADD] = scalar_add, [VECTOR_SUB] = scalar_sub, [VECTOR_MUL] = scalar_mul,
+    [VECTOR_ADD_F] = scalar_add_f, [VECTOR_SUB_F] = scalar_sub_f, [VECTOR_MUL_F] = scalar_mul_f,
+};
+
+
+
+#ifdef VECTOR_X86
+
+//SIMD kernels - `width` elements per step with unaligned loads, the remaining elements go to the scalar kernel
+#define SIMD_KERNEL(name, attributes, scalar, type, width, load, store, operation) \
+attributes static void name(uint8_t *destination, const uint8_t *source, size_t count) { \
+    size_t i = 0; \
+    for(; i + width <= count; i += width) { \
+        type left = load((const void*)(destination + i * VECTOR_ELEMENT_SIZE)); \
+        type right = load((const void*)(source + i * VECTOR_ELEMENT_SIZE)); \
+        store((void*)(destination + i * VECTOR_ELEMENT_SIZE), operation(left, right)); \
+    } \
+    scalar(destination + i * VECTOR_ELEMENT_SIZE, source + i * VECTOR_ELEMENT_SIZE, count - i); \
+}
+
+#define SSE2_LOAD_I(address) _mm_loadu_si128((const __m128i*)(address))
+#define SSE2_STORE_I(address, value) _mm_storeu_si128((__m128i*)(address), value)
+#define SSE2_LOAD_F(address) _mm_loadu_ps((const float*)(address))
+#define SSE2_STORE_F(address, value) _mm_storeu_ps((float*)(address), value)
+#define AVX2_LOAD_I(address) _mm256_loadu_si256((const __m256i*)(address))
+#define AVX2_STORE_I(address, value) _mm256_storeu_si256((__m256i*)(address), value)
+#define AVX2_LOAD_F(address) _mm256_loadu_ps((const float*)(address))
+#define AVX2_STORE_F(address, value) _mm256_storeu_ps((float*)(address), value)
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+
+/**
+ * @brief Low 32 bits of the products of four pairs of integers - SSE2 has no _mm_mullo_epi32 (SSE4.1).
+ *
+ * The even and odd lanes are multiplied separately into 64 bit products, then their low halves are interleaved.
+ */
+static inline __m128i sse2_mullo_epi32(__m128i left, __m128i right) {
+
+    __m128i even = _mm_mul_epu32(left, right);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(left, 32), _mm_srli_epi64(right, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+    _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+
+SIMD_KERNEL(sse2_add, , scalar_add, __m128i, 4, SSE2_LOAD_I, SSE2_STORE_I, _mm_add_epi32)
+SIMD_KERNEL(sse2_sub, , scalar_sub, __m128i, 4, SSE2_LOAD_I, SSE2_STORE_I, _mm_sub_epi32)
+SIMD_KERNEL(sse2_mul, , scalar_mul, __m128i, 4, SSE2_LOAD_I, SSE2_STORE_I, sse2_mullo_epi32)
+SIMD_KERNEL(sse2_add_f, , scalar_add_f, __m128, 4, SSE2_LOAD_F, SSE2_STORE_F, _mm_add_ps)
+SIMD_KERNEL(sse2_sub_f, , scalar_sub_f, __m128, 4, SSE2_LOAD_F, SSE2_STORE_F, _mm_sub_ps)
+SIMD_KERNEL(sse2_mul_f, , scalar_mul_f, __m128, 4, SSE2_LOAD_F, SSE2_STORE_F, _mm_mul_ps)
+
+SIMD_KERNEL(avx2_add, AVX2_TARGET, scalar_add, __m256i, 8, AVX2_LOAD_I, AVX2_STORE_I, _mm256_add_epi32)
+SIMD_KERNEL(avx2_sub, AVX2_TARGET, scalar_sub, __m256i, 8, AVX2_LOAD_I, AVX2_STORE_I, _mm256_sub_epi32)
+SIMD_KERNEL(avx2_mul, AVX2_TARGET, scalar_mul, __m256i, 8, AVX2_LOAD_I, AVX2_STORE_I, _mm256_mullo_epi32)
+SIMD_KERNEL(avx2_add_f, AVX2_TARGET, scalar_add_f, __m256, 8, AVX2_LOAD_F, AVX2_STORE_F, _mm256_add_ps)
+SIMD_KERNEL(avx2_sub_f, AVX2_TARGET, scalar_sub_f, __m256, 8, AVX2_LOAD_F, AVX2_STORE_F, _mm256_sub_ps)
+SIMD_KERNEL(avx2_mul_f, AVX2_TARGET, scalar_mul_f, __m256, 8, AVX2_LOAD_F, AVX2_STORE_F, _mm256_mul_ps)
+
+#endif
+
+
+
+/**
+ * @brief Pick the kernels of the widest instruction set the host CPU supports - run once per process.
+ */
+static void select_vector_kernels(void) {
+
+    memcpy(vectorKernels, scalarKernels, sizeof(vectorKernels));
+
+#ifdef VECTOR_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        vectorKernels[VECTOR_ADD] = avx2_add;
+        vectorKernels[VECTOR_SUB] = avx2_sub;
+        vectorKernels[VECTOR_MUL] = avx2_mul;
+        vectorKernels[VECTOR_ADD_F] = avx2_add_f;
+        vectorKernels[VECTOR_SUB_F] = avx2_sub_f;
+        vectorKernels[VECTOR_MUL_F] = avx2_mul_f;
+        vectorInstructionSet = "AVX2";
+    } else if(__builtin_cpu_supports("sse2")) {
+        vectorKernels[VECTOR_ADD] = sse2_add;
+        vectorKernels[VECTOR_SUB] = sse2_sub;
+        vectorKernels[VECTOR_MUL] = sse2_mul;
+        vectorKernels[VECTOR_ADD_F] = sse2_add_f;
+        vectorKernels[VECTOR_SUB_F] = sse2_sub_f;
+        vectorKernels[VECTOR_MUL_F] = sse2_mul_f;
+        vectorInstructionSet = "SSE2";
+    }
+#endif
+
+    return;
+}
+
+
+
+/**
+ * @brief Execute one vector instruction - element i of destination becomes (element i of destination) operation
+ * (element i of source), for i from 0 to count - 1.
+ *
+ * @param vm The VM whose RAM is used.
+ * @param operation The operation to apply.
+ * @param destination RAM address of the first destination element.
+ * @param source RAM address of the first source element.
+ * @param count Number of elements.
+ * @return true if the instruction was executed, false if either range is not inside RAM.
+ */
+bool vector_execute(VirtualMachine *vm, VECTOR_OPERATION operation, uint32_t destination, uint32_t source, uint32_t count) {
+
+    uint64_t bytes = (uint64_t)count * VECTOR_ELEMENT_SIZE;
+    if((uint64_t)destination + bytes > vm->RAMsize || (uint64_t)source + bytes > vm->RAMsize) {
+        return false;
+    }
+
+    pthread_once(&vectorKernelsOnce, select_vector_kernels);
+    uint8_t *RAM = vm->ramArray;
+    if(destination > source && destination < source + bytes) { //Later elements read earlier results - one at a time
+        scalarKernels[operation](RAM + destination, RAM + source, count);
+        return true;
+    }
+
+    vectorKernels[operation](RAM + destination, RAM + source, count);
+
+    return true;
+}
+
+
+/**
+ * @brief Name of the instruction set the vector kernels use on this host ("AVX2", "SSE2" or "scalar").
+ */
+const char *vector_instruction_set(void) {
+
+    pthread_once(&vectorKernelsOnce, select_vector_kernels);
+
+    return vectorInstructionSet;
+}
@@ -0,0 +1,42 @@
+/*
+ * intepret_IR_vector.h
+ *
+ * Description:
+ * Kernels behind the vector instructions (VADD, VSUB, VMUL and their _F forms). Each instruction combines N
+ * contiguous 4 byte elements of RAM with another N elements in place, so a whole array loop costs one dispatch.
+ *
+ * Data Structure:
+ * - One kernel per operation and instruction set - AVX2 (8 elements per step), SSE2 (4 elements per step) and a
+ *   portable scalar loop. The best kernels the host CPU supports are picked the first time a vector instruction
+ *   runs (__builtin_cpu_supports), and every VM in the process shares them.
+ *
+ * Usage:
+ * - `vector_execute` runs one vector instruction on RAM addresses taken from registers. It returns false if
+ *   either range is not inside RAM (the caller raises INTERRUPT_OOB), nothing is written in that case.
+ * - Elements are processed as if one at a time from the first, so overlapping ranges give the same result with
+ *   every kernel (a destination starting inside the source is done by the scalar loop).
+ */
+#ifndef INTEPRET_IR_VECTOR_H
+#define INTEPRET_IR_VECTOR_H
+#include "intepret_IR_structs.h"
+
+
+#define VECTOR_ELEMENT_SIZE 4 //Bytes per vector element - one int or float
+
+
+typedef enum VECTOR_OPERATION {
+    VECTOR_ADD,
+    VECTOR_SUB,
+    VECTOR_MUL,
+    VECTOR_ADD_F,
+    VECTOR_SUB_F,
+    VECTOR_MUL_F,
+    NUM_VECTOR_OPERATIONS,
+} VECTOR_OPERATION;
+
+
+bool vector_execute(VirtualMachine *vm, VECTOR_OPERATION operation, uint32_t destination, uint32_t source, uint32_t count);
+const char *vector_instruction_set(void);
+
+
+#endif
@@ -35,6 +35,8 @@
 #include "stack.h"             
 #include "storage_controller.h"
 #include "intepret_IR.h"
+#include "intepret_IR_batch.h"
+#include "intepret_IR_debug.h"
 
 
 
@@ -42,19 +44,146 @@ int main(int argc, char *argv[]) {
 
     //Currently debugging VM
 
-    initialise_virtual_machine(256, 6, 1);
-    print_VM_properties();
-
-    run_VM("./data/IR_source.txt", true);
-
-    
-    
-
-
-
-
-
-
+    char *fileName = "./data/IR_source.txt";
+    VM_ENGINE engine = VM_ENGINE_THREADED;
+    size_t loadThreads = 0;
+    char *bytecodeFileName = NULL;
+    uint32_t jitThreshold = 64;
+    size_t instructionsPerSecond = VM_UNTHROTTLED;
+    size_t RAMsize = 65536;
+    size_t heapStart = 0;
+    bool guardPages = false;
+    bool lineBuffered = false;
+    bool debugger = false;
+    bool statistics = false;
+    char *statisticsFileName = NULL;
+    char *profileFileName = NULL;
+    size_t numCores = 8;
+    size_t callDepth = 65536;
+    char *manifestFileName = NULL;
+    char *resultsFileName = NULL;
+    size_t numWorkers = 0;
+    bool useSnapshots = false;
+    size_t snapshotLabel = 0;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-e") == 0 && i + 1 < argc) { //Execution engine
+            i++;
+            if(strcmp(argv[i], "switch") == 0) {
+                engine = VM_ENGINE_SWITCH;
+            } else if(strcmp(argv[i], "threaded") == 0) {
+                engine = VM_ENGINE_THREADED;
+            } else if(strcmp(argv[i], "jit") == 0) {
+                engine = VM_ENGINE_JIT;
+            } else if(strcmp(argv[i], "trace") == 0) {
+                engine = VM_ENGINE_TRACE;
+            } else {
+                printf("Unknown engine '%s' - expected switch, threaded, jit or trace\n", argv[i]);
+                return 1;
+            }
+        } else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) { //Loader threads
+            i++;
+            loadThreads = (size_t)strtoul(argv[i], NULL, 10);
+        } else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc) { //JIT threshold
+            i++;
+            jitThreshold = (uint32_t)strtoul(argv[i], NULL, 10);
+        } else if(strcmp(argv[i], "-i") == 0 && i + 1 < argc) { //Instructions per second (0 = unthrottled)
+            i++;
+            instructionsPerSecond = (size_t)strtoul(argv[i], NULL, 10);
+        } else if(strcmp(argv[i], "-m") == 0 && i + 1 < argc) { //RAM size in bytes
+            i++;
+            RAMsize = (size_t)strtoul(argv[i], NULL, 10);
+        } else if(strcmp(argv[i], "-H") == 0 && i + 1 < argc) { //First RAM address used by ALLOCATE
+            i++;
+            heapStart = (size_t)strtoul(argv[i], NULL, 10);
+        } else if(strcmp(argv[i], "-d") == 0) { //Interactive debugger
+            debugger = true;
+        } else if(strcmp(argv[i], "-l") == 0) { //Write program output at every newline
+            lineBuffered = true;
+        } else if(strcmp(argv[i], "-g") == 0) { //Guard pages instead of RAM bounds checks
+            guardPages = true;
+        } else if(strcmp(argv[i], "-s") == 0) { //Statistics
+            statistics = true;
+        } else if(strcmp(argv[i], "-S") == 0 && i + 1 < argc) { //Statistics written as JSON
+            i++;
+            statistics = true;
+            statisticsFileName = argv[i];
+        } else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc) { //Sampling profiler, collapsed stacks written to file
+            i++;
+            profileFileName = argv[i];
+        } else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) { //Cores available to PARALLEL_START
+            i++;
+            numCores = (size_t)strtoul(argv[i], NULL, 10);
+        } else if(strcmp(argv[i], "-C") == 0 && i + 1 < argc) { //Nested calls allowed before JAL raises an interrupt
+            i++;
+            callDepth = (size_t)strtoul(argv[i], NULL, 10);
+        } else if(strcmp(argv[i], "-b") == 0 && i + 2 < argc) { //Batch - manifest and results file
+            manifestFileName = argv[i + 1];
+            resultsFileName = argv[i + 2];
+            i += 2;
+        } else if(strcmp(argv[i], "-w") == 0 && i + 1 < argc) { //Batch worker threads
+            i++;
+            numWorkers = (size_t)strtoul(argv[i], NULL, 10);
+        } else if(strcmp(argv[i], "-k") == 0 && i + 1 < argc) { //Batch - snapshot each program at a label
+            i++;
+            useSnapshots = true;
+            snapshotLabel = (size_t)strtoul(argv[i], NULL, 10);
+        } else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc) { //Write bytecode instead of running
+            i++;
+            bytecodeFileName = argv[i];
+        } else {
+            fileName = argv[i];
+        }
+    }
+
+    if(manifestFileName != NULL) {
+        VMBatchSettings settings = {RAMsize, heapStart, guardPages, 6, engine, numWorkers, useSnapshots, snapshotLabel};
+        return (run_VM_batch(manifestFileName, resultsFileName, settings) == true ? 0 : 1);
+    }
+
+    VirtualMachine *vm = vm_create(RAMsize, 6, instructionsPerSecond);
+    if(vm == NULL) {
+        printf("Failed to create the virtual machine\n");
+        return 1;
+    }
+    set_VM_engine(vm, engine);
+    if(set_VM_heap_start(vm, heapStart) == false) {
+        printf("Heap start %zu is outside RAM (%zu bytes)\n", heapStart, RAMsize);
+    }
+    if(guardPages == true && set_VM_guard_pages(vm, true) == false) {
+        printf("Failed to reserve guard pages - RAM accesses stay bounds checked\n");
+    }
+    set_VM_load_threads(vm, loadThreads);
+    set_VM_line_buffered(vm, lineBuffered);
+    set_VM_cores(vm, numCores);
+    if(set_VM_call_depth(vm, callDepth) == false) {
+        printf("Failed to allocate a return stack of %zu calls\n", callDepth);
+    }
+    set_VM_JIT_threshold(vm, jitThreshold);
+    set_VM_statistics(vm, statistics);
+    set_VM_profiling(vm, profileFileName != NULL);
+    print_VM_properties(vm);
+
+    if(bytecodeFileName != NULL) {
+        convert_IR_to_bytecode(vm, fileName, bytecodeFileName, true);
+    } else if(vm_load(vm, fileName, true) == true) {
+        if(debugger == true) {
+            run_VM_debugger(vm);
+        } else {
+            vm_run(vm, true);
+        }
+        if(statistics == true) {
+            print_VM_statistics(vm);
+        }
+        if(statisticsFileName != NULL) {
+            write_VM_statistics_JSON(vm, statisticsFileName);
+        }
+        if(profileFileName != NULL) {
+            write_VM_profile(vm, profileFileName);
+        }
+    }
+
+    vm_destroy(vm);
 
     return 0;
 